@@ -0,0 +1,188 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bin_buffer.h"
+
+stp2webgl_buffer::stp2webgl_buffer()
+    : buf(0), len(0), alloc(0)
+{
+}
+
+stp2webgl_buffer::~stp2webgl_buffer()
+{
+    free (buf);
+}
+
+void stp2webgl_buffer::grow (size_t sz)
+{
+    if (len + sz <= alloc) return;
+
+    size_t newsz = alloc? alloc * 2: 4096;
+    while (newsz < len + sz) newsz *= 2;
+
+    unsigned char * newbuf = (unsigned char *) realloc (buf, newsz);
+    if (!newbuf) {
+	printf ("Out of memory for %lu byte buffer\n", (unsigned long) newsz);
+	exit (2);
+    }
+    buf = newbuf;
+    alloc = newsz;
+}
+
+void stp2webgl_buffer::putBytes (const void * src, size_t sz)
+{
+    grow (sz);
+    memcpy (buf + len, src, sz);
+    len += sz;
+}
+
+void stp2webgl_buffer::putU8 (unsigned val)
+{
+    grow (1);
+    buf[len++] = val & 0xff;
+}
+
+void stp2webgl_buffer::putU16 (unsigned val)
+{
+    // shifts work properly regardless of endian-ness
+    grow (2);
+    buf[len++] = val & 0xff;
+    buf[len++] = (val >> 8) & 0xff;
+}
+
+void stp2webgl_buffer::putU32 (unsigned long val)
+{
+    grow (4);
+    buf[len++] = val & 0xff;
+    buf[len++] = (val >> 8) & 0xff;
+    buf[len++] = (val >> 16) & 0xff;
+    buf[len++] = (val >> 24) & 0xff;
+}
+
+void stp2webgl_buffer::putF32 (double val)
+{
+    // copy the bits into an integer so the shifts give little endian
+    float fval = (float) val;
+    unsigned int bits;
+    memcpy (&bits, &fval, 4);
+    putU32 (bits);
+}
+
+void stp2webgl_buffer::putF64 (double val)
+{
+    unsigned char bits[8];
+    unsigned i;
+
+    // doubles are stored with the same byte order as integers on
+    // all of the platforms that we support.
+    union { double d; unsigned int w[2]; } test;
+    test.d = 1.0;
+    int big_endian = (test.w[0] != 0);
+
+    memcpy (bits, &val, 8);
+    grow (8);
+    for (i=0; i<8; i++)
+	buf[len++] = bits[big_endian? 7-i: i];
+}
+
+void stp2webgl_buffer::align (unsigned sz)
+{
+    while (len % sz) putU8 (0);
+}
+
+int stp2webgl_buffer::write (FILE * fd) const
+{
+    if (!len) return 0;
+    return (fwrite (buf, 1, len, fd) == len)? 0: 1;
+}
+
+
+
+//======================================================================
+// Reader -- mirrors the writer above
+//
+
+const unsigned char * stp2webgl_reader::getBytes (size_t sz)
+{
+    if ((size_t)(end - cur) < sz) {
+	err = 1;
+	cur = end;
+	return 0;
+    }
+    const unsigned char * ret = cur;
+    cur += sz;
+    return ret;
+}
+
+unsigned stp2webgl_reader::getU8()
+{
+    const unsigned char * b = getBytes(1);
+    return b? b[0]: 0;
+}
+
+unsigned stp2webgl_reader::getU16()
+{
+    const unsigned char * b = getBytes(2);
+    return b? (b[0] | (b[1] << 8)): 0;
+}
+
+unsigned long stp2webgl_reader::getU32()
+{
+    const unsigned char * b = getBytes(4);
+    if (!b) return 0;
+    return ((unsigned long) b[0] |
+	    ((unsigned long) b[1] << 8) |
+	    ((unsigned long) b[2] << 16) |
+	    ((unsigned long) b[3] << 24));
+}
+
+double stp2webgl_reader::getF32()
+{
+    unsigned int bits = (unsigned int) getU32();
+    float fval;
+    memcpy (&fval, &bits, 4);
+    return fval;
+}
+
+double stp2webgl_reader::getF64()
+{
+    unsigned char bits[8];
+    double val;
+    unsigned i;
+
+    union { double d; unsigned int w[2]; } test;
+    test.d = 1.0;
+    int big_endian = (test.w[0] != 0);
+
+    const unsigned char * b = getBytes(8);
+    if (!b) return 0.;
+
+    for (i=0; i<8; i++)
+	bits[big_endian? 7-i: i] = b[i];
+    memcpy (&val, bits, 8);
+    return val;
+}
+
+void stp2webgl_reader::align (unsigned sz)
+{
+    while (!err && (offset() % sz)) getU8();
+}
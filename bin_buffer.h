@@ -0,0 +1,85 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Growable byte buffer used to assemble binary output in memory
+// before it is written with a single call.  All multi-byte values
+// are stored little endian regardless of the host byte order.
+//
+
+class stp2webgl_buffer {
+    unsigned char * buf;
+    size_t len;
+    size_t alloc;
+
+    void grow (size_t sz);
+
+public:
+    stp2webgl_buffer();
+    ~stp2webgl_buffer();
+
+    const unsigned char * data() const	{ return buf; }
+    size_t size() const			{ return len; }
+    void reset()			{ len = 0; }
+
+    void putBytes (const void * src, size_t sz);
+    void putU8  (unsigned val);
+    void putU16 (unsigned val);
+    void putU32 (unsigned long val);
+    void putF32 (double val);
+    void putF64 (double val);
+
+    // pad with zeros to a multiple of the given size
+    void align (unsigned sz);
+
+    // returns zero on success
+    int write (FILE * fd) const;
+
+private:
+    // not copyable
+    stp2webgl_buffer (const stp2webgl_buffer &);
+    stp2webgl_buffer & operator= (const stp2webgl_buffer &);
+};
+
+
+// Cursor for reading values written by stp2webgl_buffer.  Reading
+// past the end returns zeros and sets the error flag rather than
+// failing, so callers can check once at the end.
+//
+class stp2webgl_reader {
+    const unsigned char * start;
+    const unsigned char * cur;
+    const unsigned char * end;
+    int err;
+
+public:
+    stp2webgl_reader (const unsigned char * data, size_t sz)
+	: start(data), cur(data), end(data+sz), err(0) {}
+
+    int error() const		{ return err; }
+    size_t offset() const	{ return cur - start; }
+    size_t remaining() const	{ return end - cur; }
+
+    const unsigned char * getBytes (size_t sz);
+    unsigned getU8();
+    unsigned getU16();
+    unsigned long getU32();
+    double getF32();
+    double getF64();
+
+    void align (unsigned sz);
+};
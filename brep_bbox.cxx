@@ -0,0 +1,200 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+// stp2webgl_solid_bbox() -- bounding box of a solid from its boundary
+// topology, without faceting it.  This visits the vertices of every
+// face bound and widens the box by the radius of any circular edges,
+// which covers everything but surfaces that bulge out past their
+// edges.  Good enough to stand in for a solid that could not be
+// faceted, or to judge its size before faceting it.
+//
+// Handles manifold solid breps, which includes faceted breps, and
+// shell based surface models.  AP242 tessellated items are measured
+// from their triangles.  The box is in the coordinates of the
+// representation, same as the facets.  Returns zero if nothing was
+// found, in which case the box is left alone.
+//
+
+extern int stp2webgl_solid_bbox (
+    stp_representation_item * solid,
+    StixMeshBoundingBox * bbox
+    );
+extern int stp2webgl_is_tessellated (stp_representation_item * it);
+extern int stp2webgl_tessellated_bbox (
+    stp_representation_item * it,
+    StixMeshBoundingBox * bbox
+    );
+
+
+static int add_point (StixMeshBoundingBox * bbox, stp_cartesian_point * pt)
+{
+    if (!pt) return 0;
+
+    ListOfDouble * coords = pt->coordinates();
+    if (!coords || coords->size() < 2) return 0;
+
+    double xyz[3];
+    xyz[0] = coords->get(0);
+    xyz[1] = coords->get(1);
+    xyz[2] = (coords->size() > 2)? coords->get(2): 0.;
+
+    bbox->update(xyz);
+    return 1;
+}
+
+static int add_vertex (StixMeshBoundingBox * bbox, stp_vertex * v)
+{
+    if (!v || !v->isa(ROSE_DOMAIN(stp_vertex_point)))
+	return 0;
+
+    stp_point * pt = ROSE_CAST(stp_vertex_point,v)->vertex_geometry();
+    if (!pt || !pt->isa(ROSE_DOMAIN(stp_cartesian_point)))
+	return 0;
+
+    return add_point (bbox, ROSE_CAST(stp_cartesian_point,pt));
+}
+
+// A full circle can be a single edge that starts and ends at one
+// vertex, so take the whole square around it.
+static void add_edge_curve (StixMeshBoundingBox * bbox, stp_edge * e)
+{
+    if (!e->isa(ROSE_DOMAIN(stp_edge_curve))) return;
+
+    stp_curve * c = ROSE_CAST(stp_edge_curve,e)->edge_geometry();
+    if (!c || !c->isa(ROSE_DOMAIN(stp_circle))) return;
+
+    stp_circle * circ = ROSE_CAST(stp_circle,c);
+    RoseObject * pos = circ->position()?
+	rose_get_nested_object(circ->position()): 0;
+
+    if (!pos || !pos->isa(ROSE_DOMAIN(stp_axis2_placement_3d))) return;
+
+    StixMeshBoundingBox ctr;
+    stp_cartesian_point * loc =
+	ROSE_CAST(stp_axis2_placement_3d,pos)->location();
+    if (!add_point (&ctr, loc)) return;
+
+    double r = circ->radius();
+    double lo[3] = { ctr.minx - r, ctr.miny - r, ctr.minz - r };
+    double hi[3] = { ctr.minx + r, ctr.miny + r, ctr.minz + r };
+    bbox->update(lo);
+    bbox->update(hi);
+}
+
+static int add_loop (StixMeshBoundingBox * bbox, stp_loop * lp)
+{
+    unsigned i,sz;
+    int found = 0;
+
+    if (!lp) return 0;
+
+    if (lp->isa(ROSE_DOMAIN(stp_edge_loop)))
+    {
+	ListOfstp_oriented_edge * edges =
+	    ROSE_CAST(stp_edge_loop,lp)->edge_list();
+
+	for (i=0, sz=edges? edges->size(): 0; i<sz; i++)
+	{
+	    stp_oriented_edge * oe = edges->get(i);
+	    stp_edge * e = oe? oe->edge_element(): 0;
+	    if (!e) continue;
+
+	    found |= add_vertex (bbox, e->edge_start());
+	    found |= add_vertex (bbox, e->edge_end());
+	    add_edge_curve (bbox, e);
+	}
+    }
+    else if (lp->isa(ROSE_DOMAIN(stp_poly_loop)))
+    {
+	ListOfstp_cartesian_point * pts =
+	    ROSE_CAST(stp_poly_loop,lp)->polygon();
+
+	for (i=0, sz=pts? pts->size(): 0; i<sz; i++)
+	    found |= add_point (bbox, pts->get(i));
+    }
+    else if (lp->isa(ROSE_DOMAIN(stp_vertex_loop)))
+    {
+	found |= add_vertex (bbox, ROSE_CAST(stp_vertex_loop,lp)->loop_vertex());
+    }
+
+    return found;
+}
+
+static int add_face_set (StixMeshBoundingBox * bbox, stp_connected_face_set * cfs)
+{
+    unsigned i,sz;
+    unsigned j,szz;
+    int found = 0;
+
+    SetOfstp_face * faces = cfs? cfs->cfs_faces(): 0;
+    for (i=0, sz=faces? faces->size(): 0; i<sz; i++)
+    {
+	stp_face * f = faces->get(i);
+	SetOfstp_face_bound * bounds = f? f->bounds(): 0;
+
+	for (j=0, szz=bounds? bounds->size(): 0; j<szz; j++)
+	{
+	    stp_face_bound * fb = bounds->get(j);
+	    if (fb) found |= add_loop (bbox, fb->bound());
+	}
+    }
+    return found;
+}
+
+
+int stp2webgl_solid_bbox (
+    stp_representation_item * solid,
+    StixMeshBoundingBox * bbox
+    )
+{
+    unsigned i,sz;
+    int found = 0;
+
+    if (!solid) return 0;
+
+    if (stp2webgl_is_tessellated(solid))
+	found = stp2webgl_tessellated_bbox (solid, bbox);
+
+    else if (solid->isa(ROSE_DOMAIN(stp_manifold_solid_brep)))
+    {
+	// voids are inside the outer shell, so they never matter
+	found = add_face_set (
+	    bbox, ROSE_CAST(stp_manifold_solid_brep,solid)->outer()
+	    );
+    }
+    else if (solid->isa(ROSE_DOMAIN(stp_shell_based_surface_model)))
+    {
+	SetOfstp_shell * shells =
+	    ROSE_CAST(stp_shell_based_surface_model,solid)->sbsm_boundary();
+
+	for (i=0, sz=shells? shells->size(): 0; i<sz; i++)
+	{
+	    RoseObject * sh = rose_get_nested_object(shells->get(i));
+	    if (sh && sh->isa(ROSE_DOMAIN(stp_connected_face_set)))
+		found |= add_face_set (
+		    bbox, ROSE_CAST(stp_connected_face_set,sh)
+		    );
+	}
+    }
+
+    return found;
+}
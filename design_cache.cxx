@@ -0,0 +1,182 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include "stp2webgl.h"
+#include "stats.h"
+
+// Snapshot of the parsed design (-cache option).  Reading a large
+// Part 21 file is most of the startup time, so a copy of the design
+// is saved next to the STEP file in the native ROSE format, which is
+// much faster to read, and used in place of the STEP file on later
+// runs.  A small key file next to it holds a hash and the size of
+// the STEP file, and the snapshot is only used when both match, so
+// a changed file is parsed again and the snapshot replaced.
+//
+// The back pointers, assembly and unit tags, and presentation are
+// not part of the saved data, so those are always done after the
+// design is read.
+//
+//   foo.stp		STEP file
+//   foo.stp.rose	snapshot
+//   foo.stp.rose.key	hash and size of foo.stp for the snapshot
+//
+
+extern RoseDesign * stp2webgl_read_design (
+    stp2webgl_opts * opts,
+    const char * path
+    );
+
+
+// FNV-1a over the whole file.  Returns zero if it could not be read.
+static int hash_file (
+    const char * path,
+    unsigned long long * hash,
+    unsigned long long * size
+    )
+{
+    FILE * fd = rose_fopen(path, "rb");
+    if (!fd) return 0;
+
+    unsigned char * buf = new unsigned char[1<<20];
+    unsigned long long h = 14695981039346656037ULL;
+    unsigned long long total = 0;
+    size_t i, len;
+
+    while ((len = fread(buf, 1, 1<<20, fd)) > 0)
+    {
+	for (i=0; i<len; i++) {
+	    h ^= buf[i];
+	    h *= 1099511628211ULL;
+	}
+	total += len;
+    }
+
+    int ok = !ferror(fd);
+    fclose(fd);
+    delete [] buf;
+
+    *hash = h;
+    *size = total;
+    return ok;
+}
+
+static int read_key (
+    const char * path,
+    unsigned long long * hash,
+    unsigned long long * size
+    )
+{
+    FILE * fd = rose_fopen(path, "r");
+    if (!fd) return 0;
+
+    int ok = (fscanf(fd, "stp2webgl %llx %llu", hash, size) == 2);
+    fclose(fd);
+    return ok;
+}
+
+static int write_key (
+    const char * path,
+    unsigned long long hash,
+    unsigned long long size
+    )
+{
+    FILE * fd = rose_fopen(path, "w");
+    if (!fd) return 0;
+
+    fprintf(fd, "stp2webgl %016llx %llu\n", hash, size);
+    return !fclose(fd);
+}
+
+
+// Save the design under the snapshot name, then put its path back.
+// The key is written last, so a snapshot cut short by a crash is
+// never used.
+//
+static void save_snapshot (
+    RoseDesign * design,
+    const char * snap,
+    const char * key,
+    unsigned long long hash,
+    unsigned long long size
+    )
+{
+    RoseStringObject oldpath;
+    oldpath += design->path();
+
+    remove(key);
+    design->format("rose");
+    design->path(snap);
+
+    if (!design->save() || !write_key(key, hash, size))
+	printf ("Could not write snapshot %s\n", snap);
+
+    // nothing else looks at the format
+    design->path(oldpath);
+}
+
+
+RoseDesign * stp2webgl_read_design (
+    stp2webgl_opts * opts,
+    const char * path
+    )
+{
+    RoseDesign * design;
+
+    if (!opts->do_cache)
+	return ROSE.findDesign(path);
+
+    unsigned long long hash, size;
+    unsigned long long khash, ksize;
+    double start = stats_time();
+
+    if (!hash_file(path, &hash, &size))
+	return ROSE.findDesign(path);
+
+    stats_add("snapshot hash seconds", stats_time() - start);
+
+    RoseStringObject snap;
+    snap += path;
+    snap += ".rose";
+
+    RoseStringObject key;
+    key += snap;
+    key += ".key";
+
+    if (read_key(key, &khash, &ksize) && khash == hash && ksize == size &&
+	rose_file_exists(snap))
+    {
+	design = ROSE.findDesign(snap);
+	if (design) {
+	    stats_add("snapshot used", 1);
+	    return design;
+	}
+    }
+
+    design = ROSE.findDesign(path);
+    if (design) {
+	double save = stats_time();
+	save_snapshot(design, snap, key, hash, size);
+	stats_add("snapshot save seconds", stats_time() - save);
+    }
+    return design;
+}
@@ -0,0 +1,481 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include "stp2webgl.h"
+#include "parallel.h"
+#include "stats.h"
+
+// External references (-extref option).  Some systems write a large
+// assembly as a top level file with the product structure and a file
+// for each part with its geometry, much like the part files that the
+// -d option links to.  The top level file names the file for a part
+// with a document_file on the product definition, either through an
+// applied_document_reference or as a product definition with
+// associated documents.  The file name is the external id assigned
+// to the document, or else the id of the document itself, relative
+// to the directory of the top level file.
+//
+// Each part file is read into a design of its own.  ROSE parses one
+// file at a time, so the worker threads read ahead the next few files
+// while the main thread parses, which keeps the disk or network busy
+// instead of waiting on each file in turn.  The entity ids of each
+// part file are moved past those of the files before it, since the
+// writers name things by entity id.
+//
+// Once everything is tagged, each shape of a product with a part file
+// is given the shapes of the matching product in that file as child
+// shapes, placed where they are.  The writers walk down into those
+// like any other child shape, so the solids of every file go through
+// the same mesher.
+//
+
+extern RoseDesign * stp2webgl_read_design (
+    stp2webgl_opts * opts,
+    const char * path
+    );
+extern void stp2webgl_load_external (
+    stp2webgl_opts * opts,
+    rose_vector * designs
+    );
+extern void stp2webgl_link_external (stp2webgl_opts * opts);
+extern const rose_vector * stp2webgl_external_shapes (
+    stp_representation * rep
+    );
+
+
+// A product in the top level file and the part file it refers to
+struct ext_ref {
+    stp_product_definition * pd;
+    RoseStringObject path;
+    RoseDesign * design;
+};
+
+// top level shapes with child shapes from a part file, by address
+struct ext_key {
+    RoseObject * rep;
+    rose_vector * shapes;
+};
+
+// external id assigned to a document
+struct ext_name {
+    RoseObject * doc;
+    const char * name;
+};
+
+static rose_vector ext_refs;
+static ext_key * ext_keys = 0;
+static unsigned ext_key_count = 0;
+
+
+static int ext_key_cmp (const void * a, const void * b)
+{
+    const ext_key * ka = (const ext_key *) a;
+    const ext_key * kb = (const ext_key *) b;
+
+    if (ka->rep != kb->rep) return (ka->rep < kb->rep)? -1: 1;
+    return 0;
+}
+
+static int ext_name_cmp (const void * a, const void * b)
+{
+    const ext_name * na = (const ext_name *) a;
+    const ext_name * nb = (const ext_name *) b;
+
+    if (na->doc != nb->doc) return (na->doc < nb->doc)? -1: 1;
+    return 0;
+}
+
+
+
+//------------------------------------------------------------
+// FIND THE REFERENCES -- The external ids are attached to the
+// documents, so collect those first, sorted by document.
+//------------------------------------------------------------
+
+static ext_name * find_file_names (RoseDesign * design, unsigned * count)
+{
+    unsigned i,sz;
+    rose_vector docs;
+    rose_vector names;
+    RoseCursor objs;
+    RoseObject * obj;
+
+    objs.traverse(design);
+    objs.domain(ROSE_DOMAIN(stp_applied_external_identification_assignment));
+    while ((obj = objs.next()) != 0)
+    {
+	stp_applied_external_identification_assignment * aeia =
+	    ROSE_CAST(stp_applied_external_identification_assignment,obj);
+	SetOfstp_external_identification_item * items = aeia->items();
+
+	if (!aeia->assigned_id()) continue;
+	for (i=0, sz=items? items->size(): 0; i<sz; i++)
+	{
+	    RoseObject * doc = rose_get_nested_object(items->get(i));
+	    if (doc && doc->isa(ROSE_DOMAIN(stp_document_file))) {
+		docs.append(doc);
+		names.append(aeia->assigned_id());
+	    }
+	}
+    }
+
+    *count = docs.size();
+    ext_name * keys = new ext_name[docs.size()+1];
+    for (i=0, sz=docs.size(); i<sz; i++) {
+	keys[i].doc = (RoseObject *) docs[i];
+	keys[i].name = (const char *) names[i];
+    }
+    qsort (keys, docs.size(), sizeof(ext_name), ext_name_cmp);
+    return keys;
+}
+
+static const char * file_name (
+    const ext_name * names,
+    unsigned count,
+    stp_document * doc
+    )
+{
+    ext_name key;
+    key.doc = doc;
+
+    const ext_name * found = (const ext_name *) bsearch (
+	&key, names, count, sizeof(ext_name), ext_name_cmp
+	);
+
+    if (found) return found->name;
+    return doc->id();
+}
+
+static int is_absolute (const char * name)
+{
+    if (name[0] == '/' || name[0] == '\\') return 1;
+    return name[0] && name[1] == ':';
+}
+
+static void add_ref (
+    stp2webgl_opts * opts,
+    const ext_name * names,
+    unsigned count,
+    stp_product_definition * pd,
+    stp_document * doc
+    )
+{
+    unsigned i,sz;
+
+    if (!pd || !doc || !doc->isa(ROSE_DOMAIN(stp_document_file)))
+	return;
+
+    const char * name = file_name (names, count, doc);
+    if (!name || !*name) return;
+
+    // once for each product
+    for (i=0, sz=ext_refs.size(); i<sz; i++) {
+	if (((ext_ref *) ext_refs[i])->pd == pd) return;
+    }
+
+    ext_ref * ref = new ext_ref;
+    ref->pd = pd;
+    ref->design = 0;
+
+    if (!is_absolute (name))
+    {
+	const char * src = opts->srcfile;
+	const char * end = src + strlen(src);
+	while (end > src && end[-1] != '/' && end[-1] != '\\') end--;
+
+	char * dir = new char[end - src + 1];
+	memcpy (dir, src, end - src);
+	dir[end - src] = 0;
+	ref->path += dir;
+	delete [] dir;
+    }
+    ref->path += name;
+    ext_refs.append(ref);
+}
+
+static void find_refs (stp2webgl_opts * opts)
+{
+    unsigned i,sz;
+    unsigned count;
+    RoseCursor objs;
+    RoseObject * obj;
+
+    ext_name * names = find_file_names (opts->design, &count);
+
+    objs.traverse(opts->design);
+    objs.domain(ROSE_DOMAIN(stp_applied_document_reference));
+    while ((obj = objs.next()) != 0)
+    {
+	stp_applied_document_reference * adr =
+	    ROSE_CAST(stp_applied_document_reference,obj);
+	SetOfstp_document_reference_item * items = adr->items();
+
+	for (i=0, sz=items? items->size(): 0; i<sz; i++)
+	{
+	    RoseObject * it = rose_get_nested_object(items->get(i));
+	    if (it && it->isa(ROSE_DOMAIN(stp_product_definition)))
+		add_ref (opts, names, count,
+			 ROSE_CAST(stp_product_definition,it),
+			 adr->assigned_document());
+	}
+    }
+
+    objs.traverse(opts->design);
+    objs.domain(ROSE_DOMAIN(stp_product_definition_with_associated_documents));
+    while ((obj = objs.next()) != 0)
+    {
+	stp_product_definition_with_associated_documents * pd =
+	    ROSE_CAST(stp_product_definition_with_associated_documents,obj);
+	SetOfstp_document * docs = pd->documentation_ids();
+
+	for (i=0, sz=docs? docs->size(): 0; i<sz; i++)
+	    add_ref (opts, names, count, pd, docs->get(i));
+    }
+
+    delete [] names;
+}
+
+
+
+//------------------------------------------------------------
+// READ THE FILES -- Parsed one at a time by the main thread, with
+// the next few files read ahead by the workers.  The read ahead only
+// pulls the bytes into the file cache and never touches ROSE.
+//------------------------------------------------------------
+
+struct read_ahead_job {
+    RoseStringObject path;
+};
+
+static unsigned long max_entity_id (RoseDesign * design)
+{
+    RoseCursor objs;
+    RoseObject * obj;
+    unsigned long max = 0;
+
+    objs.traverse(design);
+    objs.domain(ROSE_DOMAIN(RoseStructure));
+    while ((obj = objs.next()) != 0) {
+	if (obj->entity_id() > max) max = obj->entity_id();
+    }
+    return max;
+}
+
+// Move the ids past the given one, returns the largest after that
+static unsigned long shift_entity_ids (RoseDesign * design, unsigned long base)
+{
+    RoseCursor objs;
+    RoseObject * obj;
+    unsigned long max = base;
+
+    objs.traverse(design);
+    objs.domain(ROSE_DOMAIN(RoseStructure));
+    while ((obj = objs.next()) != 0)
+    {
+	if (!obj->entity_id()) continue;
+	obj->entity_id(obj->entity_id() + base);
+	if (obj->entity_id() > max) max = obj->entity_id();
+    }
+    return max;
+}
+
+static void read_ahead_fn (void * ctx)
+{
+    read_ahead_job * job = (read_ahead_job *) ctx;
+    FILE * fd = rose_fopen(job->path, "rb");
+
+    if (fd) {
+	char * buf = new char[1<<20];
+	while (fread(buf, 1, 1<<20, fd) > 0)
+	    ;
+	delete [] buf;
+	fclose(fd);
+    }
+    delete job;
+}
+
+void stp2webgl_load_external (
+    stp2webgl_opts * opts,
+    rose_vector * designs
+    )
+{
+    unsigned i,j,sz;
+    unsigned loaded = 0;
+    double start = stats_time();
+    rose_uint_vector files;	// first ref for each file
+
+    find_refs (opts);
+
+    // several products may share a file
+    for (i=0, sz=ext_refs.size(); i<sz; i++)
+    {
+	ext_ref * ref = (ext_ref *) ext_refs[i];
+	for (j=0; j<files.size(); j++) {
+	    if (!strcmp(((ext_ref *) ext_refs[files[j]])->path, ref->path))
+		break;
+	}
+	if (j == files.size() && rose_file_exists(ref->path))
+	    files.append(i);
+	else if (j == files.size())
+	    printf ("Could not find referenced file %s\n",
+		    (const char *) ref->path);
+    }
+
+    if (files.size())
+    {
+	unsigned long last_id = max_entity_id(opts->design);
+	stp2webgl_workers workers(opts->threads);
+	unsigned ahead = workers.size();
+	unsigned next = 0;
+
+	for (i=0, sz=files.size(); i<sz; i++)
+	{
+	    for (; next < sz && next <= i + ahead; next++) {
+		read_ahead_job * job = new read_ahead_job;
+		job->path += ((ext_ref *) ext_refs[files[next]])->path;
+		workers.submit(read_ahead_fn, job);
+	    }
+
+	    ext_ref * ref = (ext_ref *) ext_refs[files[i]];
+	    ref->design = stp2webgl_read_design(opts, ref->path);
+	    if (ref->design) {
+		last_id = shift_entity_ids(ref->design, last_id);
+		designs->append(ref->design);
+		loaded++;
+	    }
+	    else
+		printf ("Could not open referenced file %s\n",
+			(const char *) ref->path);
+	}
+    }	// waits for the workers
+
+    // products sharing a file get the same design
+    for (i=0, sz=ext_refs.size(); i<sz; i++)
+    {
+	ext_ref * ref = (ext_ref *) ext_refs[i];
+	for (j=0; !ref->design && j<files.size(); j++) {
+	    ext_ref * first = (ext_ref *) ext_refs[files[j]];
+	    if (!strcmp(first->path, ref->path))
+		ref->design = first->design;
+	}
+    }
+
+    stats_add("external references", ext_refs.size());
+    stats_add("external files", loaded);
+    stats_add("external read seconds", stats_time() - start);
+}
+
+
+
+//------------------------------------------------------------
+// LINK THE SHAPES -- Match each referencing product with a root
+// product of its file by product id, or take the only root.  Needs
+// the assembly tags of every design.
+//------------------------------------------------------------
+
+static stp_product_definition * find_part (ext_ref * ref)
+{
+    unsigned i,sz;
+    StpAsmProductDefVec roots;
+
+    stix_find_root_products(&roots, ref->design);
+    if (roots.size() == 1) return roots[0];
+
+    stp_product_definition_formation * pdf = ref->pd->formation();
+    stp_product * prod = pdf? pdf->of_product(): 0;
+    const char * id = prod? prod->id(): 0;
+    if (!id) return 0;
+
+    for (i=0, sz=roots.size(); i<sz; i++)
+    {
+	pdf = roots[i]->formation();
+	prod = pdf? pdf->of_product(): 0;
+	if (prod && prod->id() && !strcmp(prod->id(), id))
+	    return roots[i];
+    }
+    return 0;
+}
+
+void stp2webgl_link_external (stp2webgl_opts * opts)
+{
+    unsigned i,j,sz,szz;
+    unsigned linked = 0;
+    rose_vector reps;
+    rose_vector lists;
+
+    for (i=0, sz=ext_refs.size(); i<sz; i++)
+    {
+	ext_ref * ref = (ext_ref *) ext_refs[i];
+	if (!ref->design) continue;
+
+	stp_product_definition * part = find_part (ref);
+	StixMgrAsmProduct * top_mgr = StixMgrAsmProduct::find(ref->pd);
+	StixMgrAsmProduct * part_mgr =
+	    part? StixMgrAsmProduct::find(part): 0;
+
+	if (!part_mgr || !top_mgr || !top_mgr->shapes.size()) {
+	    printf ("Could not place the part from %s\n",
+		    (const char *) ref->path);
+	    continue;
+	}
+
+	rose_vector * shapes = new rose_vector;
+	for (j=0, szz=part_mgr->shapes.size(); j<szz; j++)
+	    shapes->append(part_mgr->shapes[j]);
+
+	// the same list hangs off of every shape of the product
+	for (j=0, szz=top_mgr->shapes.size(); j<szz; j++) {
+	    reps.append(top_mgr->shapes[j]);
+	    lists.append(shapes);
+	}
+	linked++;
+    }
+
+    delete [] ext_keys;
+    ext_key_count = reps.size();
+    ext_keys = new ext_key[ext_key_count+1];
+    for (i=0; i<ext_key_count; i++) {
+	ext_keys[i].rep = (RoseObject *) reps[i];
+	ext_keys[i].shapes = (rose_vector *) lists[i];
+    }
+    qsort (ext_keys, ext_key_count, sizeof(ext_key), ext_key_cmp);
+
+    stats_add("external parts linked", linked);
+}
+
+
+// Shapes from a part file to place under a shape of the top level
+// file, or null if there are none.
+//
+const rose_vector * stp2webgl_external_shapes (stp_representation * rep)
+{
+    if (!ext_key_count || !rep) return 0;
+
+    ext_key key;
+    key.rep = rep;
+
+    const ext_key * found = (const ext_key *) bsearch (
+	&key, ext_keys, ext_key_count, sizeof(ext_key), ext_key_cmp
+	);
+    return found? found->shapes: 0;
+}
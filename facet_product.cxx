@@ -25,6 +25,30 @@
 #include <stp_shape_representation.h>
 
 #include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "mesh_pump.h"
+#include "stats.h"
+
+extern void facet_all_products (stp2webgl_opts * opts);
+extern const stp2webgl_shell * find_fallback_shell (
+    stp_representation_item * solid
+    );
+extern int stp2webgl_solid_bbox (
+    stp_representation_item * solid,
+    StixMeshBoundingBox * bbox
+    );
+extern int stp2webgl_is_tessellated (stp_representation_item * it);
+extern int stp2webgl_has_tessellation (stp_representation_item * it);
+extern const rose_vector * stp2webgl_external_shapes (
+    stp_representation * rep
+    );
+
+// Shells that did not come from the mesher, boxes for solids that
+// took too long to facet (-timeout option) and triangles already in
+// the file.  These have no mesh in the cache, so the writers look
+// here instead, by address once sorted.
+static rose_vector fallback_shells;
+static int fallback_sorted = 0;
 
 
 // FACET THE SHAPE INFORMATION -- This follows the tree of shape
@@ -34,7 +58,7 @@
 //
 static void facet_shape_tree(
     stp2webgl_opts * opts, 
-    StixMeshStpAsyncMaker * mesher,
+    stp2webgl_mesh_pump * pump,
     stp_representation * rep
     )
 {
@@ -49,12 +73,29 @@ static void facet_shape_tree(
     // when finished, but the cache functions take care of that and
     // delete the cached mesh when the STEP data is deleted.
     //
+    // Tessellated items already have their triangles, so those are
+    // copied now, and a B-rep with a tessellation is not faceted.
+    //
     SetOfstp_representation_item * items = rep->items();
     for (i=0, sz=items->size(); i<sz; i++) 
     {
 	stp_representation_item  * it = items->get(i);
+
+	if (stp2webgl_is_tessellated(it)) {
+	    if (!rose_is_marked(it)) {
+		stp2webgl_shell * shell = stp2webgl_make_tessellated_shell(it);
+		if (shell) {
+		    fallback_shells.append(shell);
+		    fallback_sorted = 0;
+		    stats_add("tessellated facets", shell->getFacetCount());
+		}
+		rose_mark_set(it);
+	    }
+	    continue;
+	}
 	
-	if (!StixMeshStpBuilder::canMake(rep, it)) 
+	if (!StixMeshStpBuilder::canMake(rep, it) ||
+	    stp2webgl_has_tessellation(it)) 
 	    continue;
     
 	// Chance that it might have been previously faceted if it is
@@ -62,12 +103,15 @@ static void facet_shape_tree(
 	if (stixmesh_cache_find(it))
 	    continue;
 
-	if (mesher-> startMesh(rep, it, &opts->mesh)) {
-	    // printf ("Solid #%lu started\n", it-> entity_id());
-	}
+	pump-> add(rep, it, &opts->mesh);
     }
 
 
+    // Shapes from a part file (-extref option)
+    const rose_vector * ext = stp2webgl_external_shapes(rep);
+    for (i=0, sz=ext? ext->size(): 0; i<sz; i++)
+	facet_shape_tree (opts, pump, (stp_representation *) (*ext)[i]);
+
     // Now look for attached shapes
     StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
     if (!rep_mgr) return;
@@ -79,7 +123,7 @@ static void facet_shape_tree(
 	stp_shape_representation_relationship * rel = rep_mgr->child_rels[i];
 	stp_representation * child = stix_get_shape_usage_child_rep (rel);
 
-	facet_shape_tree(opts, mesher, child);
+	facet_shape_tree(opts, pump, child);
     }
 
 
@@ -89,7 +133,7 @@ static void facet_shape_tree(
 	stp_mapped_item * rel = rep_mgr->child_mapped_items[i];
 	stp_representation * child = stix_get_shape_usage_child_rep (rel);
 
-	facet_shape_tree (opts, mesher, child);
+	facet_shape_tree (opts, pump, child);
     }
 }
 
@@ -97,7 +141,7 @@ static void facet_shape_tree(
 
 static void facet_product(
     stp2webgl_opts * opts, 
-    StixMeshStpAsyncMaker * mesher,
+    stp2webgl_mesh_pump * pump,
     stp_product_definition * pd
     )
 {
@@ -112,34 +156,91 @@ static void facet_product(
     for (i=0, sz=pd_mgr->shapes.size(); i<sz; i++) 
     {
 	stp_representation * rep = pd_mgr->shapes[i];
-	facet_shape_tree (opts, mesher, rep);
+	facet_shape_tree (opts, pump, rep);
     }
 }
 
 
-extern void facet_all_products (
+
+static int fallback_cmp (const void * a, const void * b)
+{
+    const stp2webgl_shell * sa = *(const stp2webgl_shell **) a;
+    const stp2webgl_shell * sb = *(const stp2webgl_shell **) b;
+
+    if (sa->solid != sb->solid) return (sa->solid < sb->solid)? -1: 1;
+    return 0;
+}
+
+const stp2webgl_shell * find_fallback_shell (
+    stp_representation_item * solid
+    )
+{
+    if (!fallback_sorted) {
+	qsort (fallback_shells._buffer(), fallback_shells.size(),
+	       sizeof(void *), fallback_cmp);
+	fallback_sorted = 1;
+    }
+
+    unsigned lo = 0;
+    unsigned hi = fallback_shells.size();
+
+    while (lo < hi)
+    {
+	unsigned mid = (lo + hi) / 2;
+	stp2webgl_shell * shell = (stp2webgl_shell *) fallback_shells[mid];
+	if (shell->solid < solid) lo = mid+1;
+	else hi = mid;
+    }
+
+    if (lo < fallback_shells.size()) {
+	stp2webgl_shell * shell = (stp2webgl_shell *) fallback_shells[lo];
+	if (shell->solid == solid) return shell;
+    }
+    return 0;
+}
+
+
+void facet_all_products (
     stp2webgl_opts * opts
     )
 {
-    // Mesh the geometry present in each assembly
-    StixMeshStpAsyncMaker mesher;
+    // Mesh the geometry present in each assembly.  Solids go to the
+    // mesher through the pump, which gives up on any that take
+    // longer than the -timeout limit.
+    StixMeshStpAsyncMaker * mesher = new StixMeshStpAsyncMaker;
+    stp2webgl_mesh_pump pump(mesher, opts->solid_timeout);
     unsigned i,sz;
 
     rose_mark_begin();
     for (i=0, sz=opts->root_prods.size(); i<sz; i++)
     {
-	facet_product (opts, &mesher, opts->root_prods[i]);
+	facet_product (opts, &pump, opts->root_prods[i]);
     }
     rose_mark_end();
 
     // Now collect the meshed representations as they are completed.
-    // The getResults() function takes an argument that tells it
-    // whether to block or poll.  Here we block, but you may want to
-    // poll if your application is also servicing a UI.
+    // The pump blocks when there is no time limit, and otherwise
+    // polls the mesher to check the time.
     //
     StixMeshStp * mesh;
-    while ((mesh = mesher.getResult(1)) != 0)
+    stp_representation_item * lost;
+    while ((mesh = pump.next(&lost)) != 0 || lost)
     {
+	if (!mesh) {
+	    StixMeshBoundingBox bbox;
+	    stp2webgl_shell * box = 0;
+
+	    if (stp2webgl_solid_bbox(lost, &bbox))
+		box = stp2webgl_make_box_shell(lost, &bbox);
+
+	    if (box) {
+		fallback_shells.append(box);
+		fallback_sorted = 0;
+	    }
+	    else stats_add("timed out solids dropped", 1);
+	    continue;
+	}
+
 	stp_representation * rep = mesh-> getRepresentation();
 	stp_representation_item * it = mesh->getStepSolid();
 	stixmesh_cache_add (it, mesh);
@@ -148,4 +249,6 @@ extern void facet_all_products (
 	//  rep-> entity_id(), it-> entity_id()
 	// );
     }
+
+    pump.release();
 }
@@ -0,0 +1,159 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+stp2webgl_mapped_file::stp2webgl_mapped_file()
+{
+    ptr = 0;
+    len = 0;
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = 0;
+#else
+    fd = -1;
+#endif
+}
+
+stp2webgl_mapped_file::~stp2webgl_mapped_file()
+{
+    close();
+}
+
+
+#ifdef _WIN32
+
+int stp2webgl_mapped_file::create (const char * path, size_t sz)
+{
+    LARGE_INTEGER end;
+
+    close();
+    if (!sz) return 1;
+
+    file = CreateFileA(path, GENERIC_READ|GENERIC_WRITE, 0, 0,
+		       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) return 1;
+
+    // set the length first, the mapping can not grow the file
+    end.QuadPart = (LONGLONG) sz;
+    if (!SetFilePointerEx((HANDLE)file, end, 0, FILE_BEGIN) ||
+	!SetEndOfFile((HANDLE)file))
+    {
+	close();
+	return 1;
+    }
+
+    mapping = CreateFileMappingA((HANDLE)file, 0, PAGE_READWRITE, 0, 0, 0);
+    if (!mapping) {
+	close();
+	return 1;
+    }
+
+    ptr = (unsigned char *) MapViewOfFile(
+	(HANDLE)mapping, FILE_MAP_WRITE, 0, 0, sz
+	);
+    if (!ptr) {
+	close();
+	return 1;
+    }
+
+    len = sz;
+    return 0;
+}
+
+int stp2webgl_mapped_file::close()
+{
+    int err = 0;
+
+    if (ptr && !UnmapViewOfFile(ptr)) err = 1;
+    if (mapping && !CloseHandle((HANDLE)mapping)) err = 1;
+    if (file != INVALID_HANDLE_VALUE && !CloseHandle((HANDLE)file))
+	err = 1;
+
+    ptr = 0;
+    len = 0;
+    mapping = 0;
+    file = INVALID_HANDLE_VALUE;
+    return err;
+}
+
+#else
+
+int stp2webgl_mapped_file::create (const char * path, size_t sz)
+{
+    close();
+    if (!sz) return 1;
+
+    fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0) return 1;
+
+    // Reserve the blocks now so a full disk shows up here rather
+    // than as a fault when a thread touches the mapping.  Some file
+    // systems can not preallocate, so just set the length for those.
+#ifdef __linux__
+    int err = posix_fallocate(fd, 0, (off_t) sz);
+    if (err == EINVAL || err == EOPNOTSUPP)
+	err = ftruncate(fd, (off_t) sz);
+#else
+    int err = ftruncate(fd, (off_t) sz);
+#endif
+    if (err) {
+	close();
+	return 1;
+    }
+
+    void * mem = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+	close();
+	return 1;
+    }
+
+    ptr = (unsigned char *) mem;
+    len = sz;
+    return 0;
+}
+
+int stp2webgl_mapped_file::close()
+{
+    int err = 0;
+
+    if (ptr && munmap(ptr, len) != 0) err = 1;
+    if (fd >= 0 && ::close(fd) != 0) err = 1;
+
+    ptr = 0;
+    len = 0;
+    fd = -1;
+    return err;
+}
+
+#endif
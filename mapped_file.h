@@ -0,0 +1,54 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Output file mapped into memory at a size known up front.  Worker
+// threads can then fill disjoint parts of the file without having to
+// write them in order.  Not every output can be mapped, stdout for
+// example, so callers keep a streaming path to fall back on.
+//
+
+class stp2webgl_mapped_file {
+    unsigned char * ptr;
+    size_t len;
+#ifdef _WIN32
+    void * file;
+    void * mapping;
+#else
+    int fd;
+#endif
+
+public:
+    stp2webgl_mapped_file();
+    ~stp2webgl_mapped_file();	// unmaps if still open
+
+    // Create or truncate the file, reserve the given number of bytes
+    // on disk and map it for writing.  Returns zero on success.
+    int create (const char * path, size_t sz);
+
+    unsigned char * data() const	{ return ptr; }
+    size_t size() const			{ return len; }
+
+    // Unmap and close the file.  Returns zero on success.
+    int close();
+
+private:
+    // not copyable
+    stp2webgl_mapped_file (const stp2webgl_mapped_file &);
+    stp2webgl_mapped_file & operator= (const stp2webgl_mapped_file &);
+};
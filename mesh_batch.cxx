@@ -0,0 +1,202 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include "shell_mesh.h"
+
+// batch_shell_colors() -- move the face groups of a shell so that all
+// of the faces with the same color are next to each other.  Each run
+// of one color can then be drawn as a single group, while the face
+// groups themselves are kept for picking.  Colors are placed in the
+// order of their first face, and faces keep their order within a
+// color, so a shell with one color is not changed at all.
+//
+// Returns the number of color runs, which is the number of draw
+// groups needed afterwards.
+//
+// shell_colors_batched() checks that a shell can be drawn that way,
+// with one run for each color and the groups covering the facets one
+// after another.
+//
+
+extern unsigned batch_shell_colors (stp2webgl_shell * shell);
+extern unsigned count_color_runs (const stp2webgl_shell * shell);
+extern int shell_colors_batched (const stp2webgl_shell * shell);
+
+
+struct batch_key {
+    unsigned color;
+    unsigned rank;		// first face with the color
+    unsigned face;
+};
+
+static int batch_color_cmp (const void * a, const void * b)
+{
+    const batch_key * ka = (const batch_key *) a;
+    const batch_key * kb = (const batch_key *) b;
+
+    if (ka->color != kb->color) return (ka->color < kb->color)? -1: 1;
+    if (ka->face != kb->face) return (ka->face < kb->face)? -1: 1;
+    return 0;
+}
+
+static int batch_rank_cmp (const void * a, const void * b)
+{
+    const batch_key * ka = (const batch_key *) a;
+    const batch_key * kb = (const batch_key *) b;
+
+    if (ka->rank != kb->rank) return (ka->rank < kb->rank)? -1: 1;
+    if (ka->face != kb->face) return (ka->face < kb->face)? -1: 1;
+    return 0;
+}
+
+
+unsigned count_color_runs (const stp2webgl_shell * shell)
+{
+    unsigned i,sz;
+    unsigned runs = 0;
+
+    for (i=0, sz=shell->getFaceCount(); i<sz; i++) {
+	if (!i || shell->face_color.get(i) != shell->face_color.get(i-1))
+	    runs++;
+    }
+    return runs;
+}
+
+
+static int unsigned_cmp (const void * a, const void * b)
+{
+    unsigned ua = *(const unsigned *) a;
+    unsigned ub = *(const unsigned *) b;
+    return (ua < ub)? -1: (ua > ub)? 1: 0;
+}
+
+int shell_colors_batched (const stp2webgl_shell * shell)
+{
+    unsigned i;
+    unsigned count = shell->getFaceCount();
+    unsigned covered = 0;
+    unsigned colors = 0;
+
+    for (i=0; i<count; i++) {
+	if (shell->face_first.get(i) != covered) return 0;
+	covered += shell->face_count.get(i);
+    }
+    if (covered != shell->getFacetCount())
+	return 0;
+
+    unsigned * sorted = new unsigned[count+1];
+    for (i=0; i<count; i++)
+	sorted[i] = shell->face_color.get(i);
+    qsort (sorted, count, sizeof(unsigned), unsigned_cmp);
+
+    for (i=0; i<count; i++)
+	if (!i || sorted[i] != sorted[i-1]) colors++;
+
+    delete [] sorted;
+    return colors == count_color_runs (shell);
+}
+
+
+unsigned batch_shell_colors (stp2webgl_shell * shell)
+{
+    unsigned i,j,k;
+    unsigned count = shell->getFaceCount();
+
+    if (count < 2)
+	return count;
+
+    batch_key * keys = new batch_key[count];
+    for (i=0; i<count; i++) {
+	keys[i].color = shell->face_color[i];
+	keys[i].face = i;
+    }
+
+    // Sorting by color and then face puts the first face of each
+    // color at the start of its run.
+    qsort (keys, count, sizeof(batch_key), batch_color_cmp);
+    for (i=0; i<count; i++) {
+	keys[i].rank = (i && keys[i].color == keys[i-1].color)?
+	    keys[i-1].rank: keys[i].face;
+    }
+    qsort (keys, count, sizeof(batch_key), batch_rank_cmp);
+
+    // Leave it alone if already together, or if the groups do not
+    // cover the facets one after another.
+    unsigned moved = 0;
+    unsigned covered = 0;
+    for (i=0; i<count; i++) {
+	if (keys[i].face != i) moved++;
+	if (shell->face_first[i] != covered) break;
+	covered += shell->face_count[i];
+    }
+    if (!moved || i < count || covered != shell->getFacetCount()) {
+	delete [] keys;
+	return count_color_runs (shell);
+    }
+
+    // Copy the facets in the new face order
+    unsigned corners = shell->facets.size();
+    unsigned * facets = new unsigned[corners+1];
+    unsigned * normals = new unsigned[corners+1];
+
+    for (i=0; i<corners; i++) {
+	facets[i] = shell->facets[i];
+	normals[i] = shell->facet_normals[i];
+    }
+
+    rose_uint_vector old_first;
+    rose_uint_vector old_count;
+    rose_uint_vector old_color;
+    rose_uint_vector old_ids;
+
+    for (i=0; i<count; i++) {
+	old_first.append(shell->face_first[i]);
+	old_count.append(shell->face_count[i]);
+	old_color.append(shell->face_color[i]);
+	old_ids.append(shell->face_ids[i]);
+    }
+
+    unsigned next = 0;
+    for (i=0; i<count; i++)
+    {
+	unsigned face = keys[i].face;
+	unsigned first = old_first[face];
+
+	shell->face_first[i] = next;
+	shell->face_count[i] = old_count[face];
+	shell->face_color[i] = old_color[face];
+	shell->face_ids[i] = old_ids[face];
+
+	for (j=0; j<old_count[face]; j++, next++) {
+	    for (k=0; k<3; k++) {
+		shell->facets[3*next+k] = facets[3*(first+j)+k];
+		shell->facet_normals[3*next+k] = normals[3*(first+j)+k];
+	    }
+	}
+    }
+
+    delete [] normals;
+    delete [] facets;
+    delete [] keys;
+    return count_color_runs (shell);
+}
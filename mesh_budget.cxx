@@ -0,0 +1,155 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+// budget_fractions() -- pick a fractional faceting tolerance for each
+// solid so that the total facet count lands near a budget.  Used by
+// the -budget option.
+//
+// The caller facets everything twice at coarse tolerances and passes
+// in the facet counts and the size of each solid.  Facet counts go
+// roughly as a + b/tol, where a is what the flat faces need and b/tol
+// comes from the curved ones, so the two samples give a and b for
+// each solid.
+//
+// Every solid then gets the same deviation in absolute terms, which
+// is what a viewer sees at a given distance.  As a fraction of the
+// solid size that is tighter for large parts and looser for small
+// ones.  The fractions are clamped so that tiny parts still keep
+// their shape and huge parts do not produce endless facets.  The
+// common deviation is found by bisection, since the total only goes
+// down as it grows.
+//
+// Sizes are in one unit for all solids, and zero for solids that did
+// not facet.  Returns the estimated total facet count.
+//
+
+extern double budget_fractions (
+    unsigned count,
+    const double * coarse_facets,
+    const double * fine_facets,
+    const double * sizes,
+    double coarse_frac,
+    double fine_frac,
+    unsigned long budget,
+    double * fracs
+    );
+
+#define BUDGET_MIN_FRACTION	0.0005
+#define BUDGET_MAX_FRACTION	0.1
+#define BUDGET_ITERATIONS	60
+
+
+static double solid_fraction (double dev, double size)
+{
+    if (size <= 0.) return BUDGET_MAX_FRACTION;
+
+    double frac = dev / size;
+    if (frac < BUDGET_MIN_FRACTION) return BUDGET_MIN_FRACTION;
+    if (frac > BUDGET_MAX_FRACTION) return BUDGET_MAX_FRACTION;
+    return frac;
+}
+
+static double estimate_total (
+    unsigned count,
+    const double * a,
+    const double * b,
+    const double * sizes,
+    double dev
+    )
+{
+    unsigned i;
+    double total = 0.;
+
+    for (i=0; i<count; i++)
+	total += a[i] + b[i] / solid_fraction (dev, sizes[i]);
+
+    return total;
+}
+
+
+double budget_fractions (
+    unsigned count,
+    const double * coarse_facets,
+    const double * fine_facets,
+    const double * sizes,
+    double coarse_frac,
+    double fine_frac,
+    unsigned long budget,
+    double * fracs
+    )
+{
+    unsigned i;
+    double * a = new double[count+1];
+    double * b = new double[count+1];
+    double lo = 0.;
+    double hi = 0.;
+
+    for (i=0; i<count; i++)
+    {
+	double nc = coarse_facets[i];
+	double nf = fine_facets[i];
+
+	b[i] = (nf - nc) / (1./fine_frac - 1./coarse_frac);
+	if (b[i] < 0.) b[i] = 0.;
+
+	a[i] = nc - b[i] / coarse_frac;
+	if (a[i] < 0.) {
+	    a[i] = 0.;
+	    b[i] = nf * fine_frac;
+	}
+
+	if (sizes[i] > 0.) {
+	    double smallest = sizes[i] * BUDGET_MIN_FRACTION;
+	    double largest = sizes[i] * BUDGET_MAX_FRACTION;
+	    if (lo == 0. || smallest < lo) lo = smallest;
+	    if (largest > hi) hi = largest;
+	}
+    }
+
+    // Past these limits every fraction is clamped, so the total does
+    // not change any more.
+    double dev = hi;
+    if (lo > 0. && estimate_total (count, a, b, sizes, hi) < budget)
+    {
+	if (estimate_total (count, a, b, sizes, lo) <= budget)
+	    dev = lo;
+	else
+	{
+	    for (i=0; i<BUDGET_ITERATIONS; i++)
+	    {
+		double mid = sqrt (lo * hi);
+		if (estimate_total (count, a, b, sizes, mid) > budget)
+		    lo = mid;
+		else
+		    hi = mid;
+	    }
+	    dev = hi;
+	}
+    }
+
+    for (i=0; i<count; i++)
+	fracs[i] = solid_fraction (dev, sizes[i]);
+
+    double total = estimate_total (count, a, b, sizes, dev);
+
+    delete [] a;
+    delete [] b;
+    return total;
+}
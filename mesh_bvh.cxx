@@ -0,0 +1,510 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <math.h>
+#include <float.h>
+
+#include "mesh_bvh.h"
+#include "parallel.h"
+
+#define BVH_LEAF_SIZE	4	// always split above this
+#define BVH_MAX_LEAF	16	// never keep a leaf bigger than this
+#define BVH_BINS	12	// split planes tested per node
+#define BVH_MAX_DEPTH	64
+
+// Smallest subtree handed to its own thread.  The top of the tree is
+// built on the calling thread until the pieces are this small, or
+// small enough to give each thread a few, then the pieces are built
+// in parallel and stitched back together.
+#define BVH_PARALLEL_MIN	65536
+
+// marks a node of the top tree that stands in for a subtree
+#define BVH_SUBTREE	0x80000000u
+
+
+stp2webgl_bvh::stp2webgl_bvh()
+    : tris(0), ids(0), tri_count(0), nodes(0), node_count(0)
+{
+}
+
+stp2webgl_bvh::~stp2webgl_bvh()
+{
+    delete [] tris;
+    delete [] ids;
+    delete [] nodes;
+}
+
+
+
+//======================================================================
+// Build
+//
+
+struct bvh_subtree {
+    unsigned first;
+    unsigned count;
+    unsigned depth;
+    stp2webgl_bvh_node * nodes;
+    unsigned node_count;
+};
+
+struct bvh_builder {
+    float * tris;
+    unsigned * ids;
+    float * ctrs;		// three floats per triangle
+    stp2webgl_bvh_node * nodes;
+    unsigned node_count;
+
+    unsigned split_count;	// leave subtrees this small for later
+    rose_vector * subtrees;	// bvh_subtree, indexed by the stand in
+};
+
+static void box_reset (float lo[3], float hi[3])
+{
+    lo[0] = lo[1] = lo[2] = FLT_MAX;
+    hi[0] = hi[1] = hi[2] = -FLT_MAX;
+}
+
+static void box_add (float lo[3], float hi[3], const float pt[3])
+{
+    unsigned k;
+    for (k=0; k<3; k++) {
+	if (pt[k] < lo[k]) lo[k] = pt[k];
+	if (pt[k] > hi[k]) hi[k] = pt[k];
+    }
+}
+
+static double box_area (const float lo[3], const float hi[3])
+{
+    if (lo[0] > hi[0]) return 0.;
+
+    double dx = hi[0] - lo[0];
+    double dy = hi[1] - lo[1];
+    double dz = hi[2] - lo[2];
+    return dx*dy + dy*dz + dz*dx;
+}
+
+static void swap_tris (bvh_builder * b, unsigned i, unsigned j)
+{
+    unsigned k;
+    float f;
+
+    for (k=0; k<9; k++) {
+	f = b->tris[9*i+k]; b->tris[9*i+k] = b->tris[9*j+k]; b->tris[9*j+k] = f;
+    }
+    for (k=0; k<3; k++) {
+	f = b->ctrs[3*i+k]; b->ctrs[3*i+k] = b->ctrs[3*j+k]; b->ctrs[3*j+k] = f;
+    }
+    unsigned id = b->ids[i]; b->ids[i] = b->ids[j]; b->ids[j] = id;
+}
+
+static unsigned bin_of (float c, float lo, float scale)
+{
+    int bin = (int) ((c - lo) * scale);
+    if (bin < 0) return 0;
+    if (bin >= BVH_BINS) return BVH_BINS-1;
+    return (unsigned) bin;
+}
+
+static void build_node (
+    bvh_builder * b,
+    unsigned idx,
+    unsigned first,
+    unsigned count,
+    unsigned depth
+    )
+{
+    unsigned i,k;
+    stp2webgl_bvh_node * n = b->nodes + idx;
+    float clo[3], chi[3];
+
+    box_reset (n->lo, n->hi);
+    box_reset (clo, chi);
+    for (i=first; i<first+count; i++) {
+	for (k=0; k<3; k++) box_add (n->lo, n->hi, b->tris + 9*i + 3*k);
+	box_add (clo, chi, b->ctrs + 3*i);
+    }
+
+    n->first = first;
+    n->count = count;
+    if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH)
+	return;
+
+    if (b->split_count && count <= b->split_count)
+    {
+	bvh_subtree * sub = new bvh_subtree;
+	sub->first = first;
+	sub->count = count;
+	sub->depth = depth;
+	sub->nodes = 0;
+	sub->node_count = 0;
+
+	n->first = BVH_SUBTREE | b->subtrees->size();
+	n->count = 0;
+	b->subtrees->append(sub);
+	return;
+    }
+
+    // split along the widest spread of triangle centers
+    unsigned axis = 0;
+    for (k=1; k<3; k++)
+	if (chi[k] - clo[k] > chi[axis] - clo[axis]) axis = k;
+
+    float ext = chi[axis] - clo[axis];
+    if (ext <= 0.) {
+	if (count <= BVH_MAX_LEAF) return;
+    }
+
+    unsigned mid = first + count/2;
+    if (ext > 0.)
+    {
+	// Bin the centers and cost each plane between bins by the
+	// area of the boxes on either side times their counts.
+	unsigned bin_count[BVH_BINS];
+	float bin_lo[BVH_BINS][3], bin_hi[BVH_BINS][3];
+	float scale = BVH_BINS / ext;
+
+	for (i=0; i<BVH_BINS; i++) {
+	    bin_count[i] = 0;
+	    box_reset (bin_lo[i], bin_hi[i]);
+	}
+	for (i=first; i<first+count; i++) {
+	    unsigned bin = bin_of (b->ctrs[3*i+axis], clo[axis], scale);
+	    bin_count[bin]++;
+	    for (k=0; k<3; k++)
+		box_add (bin_lo[bin], bin_hi[bin], b->tris + 9*i + 3*k);
+	}
+
+	double right_cost[BVH_BINS];
+	float lo[3], hi[3];
+	unsigned num = 0;
+
+	box_reset (lo, hi);
+	for (i=BVH_BINS-1; i>0; i--) {
+	    num += bin_count[i];
+	    box_add (lo, hi, bin_lo[i]);
+	    box_add (lo, hi, bin_hi[i]);
+	    right_cost[i] = num * box_area (lo, hi);
+	}
+
+	double best = DBL_MAX;
+	unsigned best_split = 0;
+	num = 0;
+
+	box_reset (lo, hi);
+	for (i=0; i<BVH_BINS-1; i++) {
+	    num += bin_count[i];
+	    box_add (lo, hi, bin_lo[i]);
+	    box_add (lo, hi, bin_hi[i]);
+
+	    double cost = num * box_area (lo, hi) + right_cost[i+1];
+	    if (num && num < count && cost < best) {
+		best = cost;
+		best_split = i+1;
+	    }
+	}
+
+	// stop if a leaf is cheaper than any split
+	double leaf_cost = count * box_area (n->lo, n->hi);
+	if (count <= BVH_MAX_LEAF && best >= leaf_cost)
+	    return;
+
+	if (best_split)
+	{
+	    unsigned lo_end = first;
+	    unsigned hi_end = first + count;
+	    while (lo_end < hi_end)
+	    {
+		unsigned bin = bin_of (b->ctrs[3*lo_end+axis], clo[axis], scale);
+		if (bin < best_split) lo_end++;
+		else swap_tris (b, lo_end, --hi_end);
+	    }
+	    mid = lo_end;
+	}
+    }
+
+    // Depth first, the left child is numbered right after this node
+    // and the right one after the whole left subtree.
+    unsigned left = b->node_count++;
+    build_node (b, left, first, mid - first, depth+1);
+
+    unsigned right = b->node_count++;
+    build_node (b, right, mid, first + count - mid, depth+1);
+
+    n = b->nodes + idx;
+    n->first = right;
+    n->count = 0;
+}
+
+
+struct bvh_parallel {
+    bvh_builder * top;
+    rose_vector * subtrees;
+    stp2webgl_bvh_node * out;
+    unsigned out_count;
+};
+
+static void build_subtree_fn (void * ctx, unsigned idx)
+{
+    bvh_parallel * par = (bvh_parallel *) ctx;
+    bvh_subtree * sub = (bvh_subtree *) (*par->subtrees)[idx];
+    bvh_builder b;
+
+    b.tris = par->top->tris;
+    b.ids = par->top->ids;
+    b.ctrs = par->top->ctrs;
+    b.nodes = new stp2webgl_bvh_node[2*sub->count];
+    b.node_count = 1;
+    b.split_count = 0;
+    b.subtrees = 0;
+
+    build_node (&b, 0, sub->first, sub->count, sub->depth);
+    sub->nodes = b.nodes;
+    sub->node_count = b.node_count;
+}
+
+// Copy a tree depth first into the final array, replacing the stand
+// ins with their subtrees.  Returns the new position of the node.
+static unsigned stitch_node (
+    bvh_parallel * par,
+    const stp2webgl_bvh_node * nodes,
+    unsigned idx,
+    int top
+    )
+{
+    const stp2webgl_bvh_node * n = nodes + idx;
+
+    if (top && !n->count && (n->first & BVH_SUBTREE)) {
+	bvh_subtree * sub = (bvh_subtree *)
+	    (*par->subtrees)[n->first & ~BVH_SUBTREE];
+	return stitch_node (par, sub->nodes, 0, 0);
+    }
+
+    unsigned out = par->out_count++;
+    par->out[out] = *n;
+    if (!n->count)
+    {
+	stitch_node (par, nodes, idx+1, top);
+	par->out[out].first = stitch_node (par, nodes, n->first, top);
+    }
+    return out;
+}
+
+
+void stp2webgl_bvh::build (
+    float * t,
+    unsigned * id,
+    unsigned count,
+    unsigned nthreads
+    )
+{
+    unsigned i,k,sz;
+    bvh_builder b;
+
+    delete [] tris;
+    delete [] ids;
+    delete [] nodes;
+
+    tris = t;
+    ids = id;
+    tri_count = count;
+    nodes = 0;
+    node_count = 0;
+    if (!count) return;
+
+    b.tris = tris;
+    b.ids = ids;
+    b.ctrs = new float[3*count];
+    b.nodes = new stp2webgl_bvh_node[2*count];
+    b.node_count = 1;
+    b.split_count = 0;
+    b.subtrees = 0;
+
+    for (i=0; i<count; i++) {
+	for (k=0; k<3; k++)
+	    b.ctrs[3*i+k] = (tris[9*i+k] + tris[9*i+3+k] + tris[9*i+6+k]) / 3.f;
+    }
+
+    nthreads = stp2webgl_thread_count(nthreads);
+    if (nthreads < 2 || count < 2 * BVH_PARALLEL_MIN)
+    {
+	build_node (&b, 0, 0, count, 0);
+
+	delete [] b.ctrs;
+	nodes = b.nodes;
+	node_count = b.node_count;
+	return;
+    }
+
+    rose_vector subtrees;
+    bvh_parallel par;
+
+    b.split_count = count / (4 * nthreads);
+    if (b.split_count < BVH_PARALLEL_MIN)
+	b.split_count = BVH_PARALLEL_MIN;
+    b.subtrees = &subtrees;
+
+    build_node (&b, 0, 0, count, 0);
+
+    par.top = &b;
+    par.subtrees = &subtrees;
+    stp2webgl_parallel_for (subtrees.size(), build_subtree_fn, &par, nthreads);
+
+    // one stand in is replaced by each subtree
+    unsigned total = b.node_count - subtrees.size();
+    for (i=0, sz=subtrees.size(); i<sz; i++)
+	total += ((bvh_subtree *) subtrees[i])->node_count;
+
+    par.out = new stp2webgl_bvh_node[total];
+    par.out_count = 0;
+    stitch_node (&par, b.nodes, 0, 1);
+
+    for (i=0, sz=subtrees.size(); i<sz; i++) {
+	bvh_subtree * sub = (bvh_subtree *) subtrees[i];
+	delete [] sub->nodes;
+	delete sub;
+    }
+
+    delete [] b.ctrs;
+    delete [] b.nodes;
+    nodes = par.out;
+    node_count = par.out_count;
+}
+
+
+
+//======================================================================
+// Ray casts
+//
+
+// Entry distance of the ray into the box, or a negative value if it
+// misses the box or enters it past tmax.
+static double box_entry (
+    const stp2webgl_bvh_node * n,
+    const double org[3],
+    const double inv[3],
+    double tmin,
+    double tmax
+    )
+{
+    unsigned k;
+    for (k=0; k<3; k++)
+    {
+	double t0 = (n->lo[k] - org[k]) * inv[k];
+	double t1 = (n->hi[k] - org[k]) * inv[k];
+	if (t0 > t1) { double tmp = t0; t0 = t1; t1 = tmp; }
+
+	// a zero direction gives NaN when the origin is on the slab
+	if (t0 == t0 && t0 > tmin) tmin = t0;
+	if (t1 == t1 && t1 < tmax) tmax = t1;
+	if (tmin > tmax) return -1.;
+    }
+    return tmin;
+}
+
+// Moller-Trumbore, returns the distance or a negative value
+static double tri_hit (const float * tri, const double org[3], const double dir[3])
+{
+    double e1[3], e2[3], p[3], q[3], s[3];
+    unsigned k;
+
+    for (k=0; k<3; k++) {
+	e1[k] = tri[3+k] - tri[k];
+	e2[k] = tri[6+k] - tri[k];
+	s[k] = org[k] - tri[k];
+    }
+
+    p[0] = dir[1]*e2[2] - dir[2]*e2[1];
+    p[1] = dir[2]*e2[0] - dir[0]*e2[2];
+    p[2] = dir[0]*e2[1] - dir[1]*e2[0];
+
+    double det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+    if (det == 0.) return -1.;
+
+    double inv = 1. / det;
+    double u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv;
+    if (u < 0. || u > 1.) return -1.;
+
+    q[0] = s[1]*e1[2] - s[2]*e1[1];
+    q[1] = s[2]*e1[0] - s[0]*e1[2];
+    q[2] = s[0]*e1[1] - s[1]*e1[0];
+
+    double v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]) * inv;
+    if (v < 0. || u + v > 1.) return -1.;
+
+    return (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * inv;
+}
+
+
+unsigned stp2webgl_bvh::intersect (
+    const double org[3],
+    const double dir[3],
+    double tmin,
+    double * t
+    ) const
+{
+    unsigned i,k;
+    unsigned stack[BVH_MAX_DEPTH * 2 + 2];
+    unsigned depth = 0;
+    unsigned hit = ROSE_NOTFOUND;
+    double best = DBL_MAX;
+    double inv[3];
+
+    if (!node_count) return ROSE_NOTFOUND;
+
+    for (k=0; k<3; k++)
+	inv[k] = 1. / dir[k];
+
+    stack[depth++] = 0;
+    while (depth)
+    {
+	const stp2webgl_bvh_node * n = nodes + stack[--depth];
+	if (box_entry (n, org, inv, tmin, best) < 0.)
+	    continue;
+
+	if (n->count)
+	{
+	    for (i=n->first; i<n->first + n->count; i++) {
+		double d = tri_hit (tris + 9*i, org, dir);
+		if (d > tmin && d < best) {
+		    best = d;
+		    hit = i;
+		}
+	    }
+	    continue;
+	}
+
+	// visit the nearer child first
+	unsigned near_child = (unsigned) (n - nodes) + 1;
+	unsigned far_child = n->first;
+	double tn = box_entry (nodes + near_child, org, inv, tmin, best);
+	double tf = box_entry (nodes + far_child, org, inv, tmin, best);
+	if (tn >= 0. && tf >= 0. && tf < tn) {
+	    unsigned tmp = near_child; near_child = far_child; far_child = tmp;
+	}
+	if (tf >= 0.) stack[depth++] = far_child;
+	if (tn >= 0.) stack[depth++] = near_child;
+    }
+
+    if (hit != ROSE_NOTFOUND) {
+	*t = best;
+	return ids[hit];
+    }
+    return ROSE_NOTFOUND;
+}
@@ -0,0 +1,75 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Bounding volume hierarchy over a soup of triangles, for ray casts
+// against the faceted shells.
+//
+// Triangles are nine floats each, along with a caller id that comes
+// back from a ray hit.  The build reorders both arrays so that every
+// leaf covers a contiguous range of triangles.  Nodes are stored
+// depth first, so the left child of a node immediately follows it.
+//
+// Splits are picked with the surface area heuristic, testing a few
+// evenly spaced planes along the widest axis of the triangle centers.
+// Large trees are built with several threads, which gives the same
+// tree as a build on one thread.
+//
+
+struct stp2webgl_bvh_node {
+    float lo[3];
+    float hi[3];
+    unsigned first;	// first triangle of a leaf, or the right child
+    unsigned count;	// triangles in a leaf, zero for an inner node
+};
+
+class stp2webgl_bvh {
+public:
+    float * tris;		// nine floats per triangle
+    unsigned * ids;		// caller id of each triangle
+    unsigned tri_count;
+
+    stp2webgl_bvh_node * nodes;
+    unsigned node_count;
+
+    stp2webgl_bvh();
+    ~stp2webgl_bvh();
+
+    // Takes over the arrays, which must have been allocated with
+    // new[], and builds the tree over them.  Zero threads means one
+    // per processor.
+    void build (
+	float * tris,
+	unsigned * ids,
+	unsigned count,
+	unsigned nthreads = 1
+	);
+
+    // Nearest triangle hit by the ray past tmin, or ROSE_NOTFOUND.
+    // The distance in units of dir goes in t.  Read only, so any
+    // number of threads can cast rays at once.
+    unsigned intersect (
+	const double org[3],
+	const double dir[3],
+	double tmin,
+	double * t
+	) const;
+
+private:
+    stp2webgl_bvh (const stp2webgl_bvh &);
+    stp2webgl_bvh & operator= (const stp2webgl_bvh &);
+};
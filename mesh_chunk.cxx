@@ -0,0 +1,332 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include "shell_mesh.h"
+
+// split_shell_chunks() -- break a shell into chunks that each have
+// at most max_verts vertices and fewer than max_verts normals, so a
+// client can draw every chunk with 16bit index buffers.
+//
+// Face groups are sorted along a Morton curve through the centers of
+// the groups, and then packed into chunks in that order, so chunks
+// are spatially coherent.  A face that does not fit in the current
+// chunk continues in the next one as another group with the same
+// color and face id.  The facets of a face too large for any chunk
+// are first sorted along the Morton curve themselves.
+//
+// Returns null if the shell already fits, otherwise an array of new
+// shells, with the size returned in count.  The caller owns both the
+// array and the shells.
+//
+
+extern stp2webgl_shell ** split_shell_chunks (
+    const stp2webgl_shell * shell,
+    unsigned max_verts,
+    unsigned * count
+    );
+
+#define NOT_USED	((unsigned)-1)
+#define MORTON_BITS	10
+
+
+// Spread the low ten bits of a value out to every third bit
+static unsigned morton_spread (unsigned val)
+{
+    val &= 0x3ff;
+    val = (val | (val << 16)) & 0x030000ff;
+    val = (val | (val << 8))  & 0x0300f00f;
+    val = (val | (val << 4))  & 0x030c30c3;
+    val = (val | (val << 2))  & 0x09249249;
+    return val;
+}
+
+static unsigned morton_code (
+    const double pt[3],
+    const StixMeshBoundingBox * bbox
+    )
+{
+    double lo[3] = { bbox->minx, bbox->miny, bbox->minz };
+    double hi[3] = { bbox->maxx, bbox->maxy, bbox->maxz };
+    unsigned code = 0;
+    unsigned k;
+
+    for (k=0; k<3; k++)
+    {
+	double ext = hi[k] - lo[k];
+	double val = (ext > 0.)? (pt[k] - lo[k]) / ext: 0.;
+	unsigned cell = (unsigned) (val * ((1 << MORTON_BITS) - 1) + 0.5);
+	code |= morton_spread (cell) << k;
+    }
+    return code;
+}
+
+static void facet_center (
+    double ctr[3],
+    const stp2webgl_shell * shell,
+    unsigned fidx
+    )
+{
+    const unsigned * f = shell->getFacet(fidx);
+    unsigned k;
+    for (k=0; k<3; k++)
+	ctr[k] = (shell->getVertex(f[0])[k] +
+		  shell->getVertex(f[1])[k] +
+		  shell->getVertex(f[2])[k]) / 3.;
+}
+
+
+// Sort keys, the morton code followed by the original position to
+// keep the sort stable.
+//
+struct chunk_key {
+    unsigned code;
+    unsigned idx;
+};
+
+static int chunk_key_cmp (const void * a, const void * b)
+{
+    const chunk_key * ka = (const chunk_key *) a;
+    const chunk_key * kb = (const chunk_key *) b;
+
+    if (ka->code != kb->code) return (ka->code < kb->code)? -1: 1;
+    if (ka->idx != kb->idx) return (ka->idx < kb->idx)? -1: 1;
+    return 0;
+}
+
+
+
+//======================================================================
+// Chunk builder -- copies facets into the current chunk, mapping the
+// vertices and normals to local numbers.
+//
+
+struct chunk_builder {
+    const stp2webgl_shell * src;
+    unsigned max_verts;
+
+    unsigned * vmap;		// source vertex to chunk vertex
+    unsigned * nmap;		// source normal to chunk normal
+    rose_uint_vector used_verts;
+    rose_uint_vector used_norms;
+
+    stp2webgl_shell * cur;
+    unsigned cur_group;		// source group of the last chunk group
+    rose_vector * chunks;
+};
+
+static void finish_chunk (chunk_builder * cb)
+{
+    unsigned i,sz;
+
+    if (!cb->cur) return;
+
+    for (i=0, sz=cb->used_verts.size(); i<sz; i++)
+	cb->vmap[cb->used_verts[i]] = NOT_USED;
+    for (i=0, sz=cb->used_norms.size(); i<sz; i++)
+	cb->nmap[cb->used_norms[i]] = NOT_USED;
+
+    cb->used_verts.empty();
+    cb->used_norms.empty();
+    cb->cur = 0;
+    cb->cur_group = NOT_USED;
+}
+
+static void start_chunk (chunk_builder * cb)
+{
+    finish_chunk (cb);
+
+    cb->cur = new stp2webgl_shell;
+    cb->cur->solid = cb->src->solid;
+    cb->cur->color = cb->src->color;
+    cb->cur->fallback = cb->src->fallback;
+    cb->cur->hidden = cb->src->hidden;
+    cb->chunks->append(cb->cur);
+}
+
+static unsigned map_vertex (chunk_builder * cb, unsigned v)
+{
+    if (cb->vmap[v] == NOT_USED)
+    {
+	const double * pt = cb->src->getVertex(v);
+	cb->vmap[v] = cb->cur->getVertexCount();
+	cb->used_verts.append(v);
+	cb->cur->verts.append(pt[0]);
+	cb->cur->verts.append(pt[1]);
+	cb->cur->verts.append(pt[2]);
+    }
+    return cb->vmap[v];
+}
+
+static unsigned map_normal (chunk_builder * cb, unsigned n)
+{
+    if (n == ROSE_NOTFOUND) return ROSE_NOTFOUND;
+
+    if (cb->nmap[n] == NOT_USED)
+    {
+	const double * d = cb->src->getNormal(n);
+	cb->nmap[n] = cb->cur->getNormalCount();
+	cb->used_norms.append(n);
+	cb->cur->normals.append(d[0]);
+	cb->cur->normals.append(d[1]);
+	cb->cur->normals.append(d[2]);
+    }
+    return cb->nmap[n];
+}
+
+static void add_facet (chunk_builder * cb, unsigned group, unsigned fidx)
+{
+    const unsigned * f = cb->src->getFacet(fidx);
+    const unsigned * fn = cb->src->getFacetNormals(fidx);
+    unsigned newv = 0;
+    unsigned newn = 0;
+    unsigned k;
+
+    if (cb->cur) {
+	for (k=0; k<3; k++) {
+	    if (cb->vmap[f[k]] == NOT_USED) newv++;
+	    if (fn[k] != ROSE_NOTFOUND && cb->nmap[fn[k]] == NOT_USED) newn++;
+	}
+    }
+
+    // normals must stay below the limit to leave room for the "no
+    // normal" marker in a 16bit index.
+    if (!cb->cur ||
+	cb->cur->getVertexCount() + newv > cb->max_verts ||
+	cb->cur->getNormalCount() + newn >= cb->max_verts)
+	start_chunk (cb);
+
+    stp2webgl_shell * cur = cb->cur;
+    if (cb->cur_group != group)
+    {
+	cb->cur_group = group;
+	cur->face_first.append(cur->getFacetCount());
+	cur->face_count.append(0);
+	cur->face_color.append(cb->src->face_color.get(group));
+	cur->face_ids.append(cb->src->face_ids.get(group));
+    }
+    cur->face_count[cur->getFaceCount()-1]++;
+
+    for (k=0; k<3; k++) {
+	cur->facets.append(map_vertex (cb, f[k]));
+	cur->facet_normals.append(map_normal (cb, fn[k]));
+    }
+}
+
+
+stp2webgl_shell ** split_shell_chunks (
+    const stp2webgl_shell * shell,
+    unsigned max_verts,
+    unsigned * count
+    )
+{
+    unsigned i,j,sz;
+    unsigned vcount = shell->getVertexCount();
+    unsigned ncount = shell->getNormalCount();
+    unsigned gcount = shell->getFaceCount();
+
+    *count = 1;
+    if (vcount <= max_verts && ncount < max_verts)
+	return 0;
+
+    StixMeshBoundingBox bbox;
+    shell->getBoundingBox(&bbox);
+
+    // order the face groups by the center of their facets
+    chunk_key * groups = new chunk_key[gcount+1];
+    for (i=0; i<gcount; i++)
+    {
+	unsigned first = shell->face_first.get(i);
+	unsigned fcount = shell->face_count.get(i);
+	double sum[3] = { 0., 0., 0. };
+	double ctr[3];
+
+	for (j=0; j<fcount; j++) {
+	    facet_center (ctr, shell, first+j);
+	    sum[0] += ctr[0];  sum[1] += ctr[1];  sum[2] += ctr[2];
+	}
+	if (fcount) {
+	    sum[0] /= fcount;  sum[1] /= fcount;  sum[2] /= fcount;
+	}
+
+	groups[i].code = morton_code (sum, &bbox);
+	groups[i].idx = i;
+    }
+    qsort (groups, gcount, sizeof(chunk_key), chunk_key_cmp);
+
+    chunk_builder cb;
+    rose_vector chunks;
+
+    cb.src = shell;
+    cb.max_verts = max_verts;
+    cb.vmap = new unsigned[vcount+1];
+    cb.nmap = new unsigned[ncount+1];
+    cb.cur = 0;
+    cb.cur_group = NOT_USED;
+    cb.chunks = &chunks;
+
+    for (i=0; i<vcount; i++) cb.vmap[i] = NOT_USED;
+    for (i=0; i<ncount; i++) cb.nmap[i] = NOT_USED;
+
+    for (i=0; i<gcount; i++)
+    {
+	unsigned g = groups[i].idx;
+	unsigned first = shell->face_first.get(g);
+	unsigned fcount = shell->face_count.get(g);
+
+	// A face with more facets than fit in a chunk is split along
+	// the curve too.  Three vertices per facet is the worst case.
+	if (fcount * 3 <= max_verts)
+	{
+	    for (j=0; j<fcount; j++)
+		add_facet (&cb, g, first+j);
+	}
+	else
+	{
+	    chunk_key * facets = new chunk_key[fcount];
+	    for (j=0; j<fcount; j++) {
+		double ctr[3];
+		facet_center (ctr, shell, first+j);
+		facets[j].code = morton_code (ctr, &bbox);
+		facets[j].idx = first+j;
+	    }
+	    qsort (facets, fcount, sizeof(chunk_key), chunk_key_cmp);
+
+	    for (j=0; j<fcount; j++)
+		add_facet (&cb, g, facets[j].idx);
+
+	    delete [] facets;
+	}
+    }
+    finish_chunk (&cb);
+
+    delete [] groups;
+    delete [] cb.vmap;
+    delete [] cb.nmap;
+
+    sz = chunks.size();
+    stp2webgl_shell ** ret = new stp2webgl_shell * [sz+1];
+    for (i=0; i<sz; i++)
+	ret[i] = (stp2webgl_shell *) chunks[i];
+
+    *count = sz;
+    return ret;
+}
@@ -0,0 +1,198 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bin_buffer.h"
+#include "mesh_codec.h"
+
+#define NOT_USED	((unsigned)-1)
+
+
+static unsigned long zigzag (long val)
+{
+    return (val < 0)? ((unsigned long)(-(val+1)) << 1) | 1:
+	((unsigned long) val << 1);
+}
+
+static long unzigzag (unsigned long val)
+{
+    return (val & 1)? -(long)(val >> 1) - 1: (long)(val >> 1);
+}
+
+
+void codec_put_varint (stp2webgl_buffer * buf, unsigned long val)
+{
+    while (val >= 0x80) {
+	buf->putU8 ((val & 0x7f) | 0x80);
+	val >>= 7;
+    }
+    buf->putU8 (val);
+}
+
+unsigned long codec_get_varint (stp2webgl_reader * rd)
+{
+    unsigned long val = 0;
+    unsigned shift = 0;
+    unsigned b;
+
+    do {
+	b = rd->getU8();
+	if (shift < 8*sizeof(val))
+	    val |= (unsigned long)(b & 0x7f) << shift;
+	shift += 7;
+    } while ((b & 0x80) && !rd->error());
+
+    return val;
+}
+
+
+
+//======================================================================
+// Index streams
+//
+
+void codec_encode_indices (
+    stp2webgl_buffer * buf,
+    const unsigned * idx,
+    unsigned count
+    )
+{
+    unsigned i;
+    unsigned next = 0;
+    unsigned last = 0;
+
+    for (i=0; i<count; i++)
+    {
+	unsigned val = idx[i];
+	if (val == next) {
+	    codec_put_varint (buf, 0);
+	    next++;
+	}
+	else {
+	    codec_put_varint (buf, zigzag ((long) val - (long) last) + 1);
+	    if (val >= next) next = val + 1;
+	}
+	last = val;
+    }
+}
+
+int codec_decode_indices (
+    stp2webgl_reader * rd,
+    unsigned * idx,
+    unsigned count
+    )
+{
+    unsigned i;
+    unsigned next = 0;
+    unsigned last = 0;
+
+    for (i=0; i<count && !rd->error(); i++)
+    {
+	unsigned long code = codec_get_varint (rd);
+	unsigned val;
+
+	if (!code) {
+	    val = next++;
+	}
+	else {
+	    val = (unsigned)((long) last + unzigzag (code - 1));
+	    if (val >= next) next = val + 1;
+	}
+	idx[i] = last = val;
+    }
+    return rd->error();
+}
+
+
+
+//======================================================================
+// Attribute streams
+//
+
+void codec_encode_deltas (
+    stp2webgl_buffer * buf,
+    const int * vals,
+    unsigned count,
+    unsigned stride
+    )
+{
+    unsigned i, k;
+    for (i=0; i<count; i++)
+    {
+	for (k=0; k<stride; k++)
+	{
+	    long prev = i? vals[(i-1)*stride + k]: 0;
+	    codec_put_varint (buf, zigzag (vals[i*stride + k] - prev));
+	}
+    }
+}
+
+int codec_decode_deltas (
+    stp2webgl_reader * rd,
+    int * vals,
+    unsigned count,
+    unsigned stride
+    )
+{
+    unsigned i, k;
+    for (i=0; i<count && !rd->error(); i++)
+    {
+	for (k=0; k<stride; k++)
+	{
+	    long prev = i? vals[(i-1)*stride + k]: 0;
+	    vals[i*stride + k] = (int)(prev + unzigzag (codec_get_varint (rd)));
+	}
+    }
+    return rd->error();
+}
+
+
+
+void codec_first_use_order (
+    const unsigned * idx,
+    unsigned count,
+    unsigned nvals,
+    unsigned * order,
+    unsigned * remap
+    )
+{
+    unsigned i;
+    unsigned next = 0;
+
+    for (i=0; i<nvals; i++)
+	remap[i] = NOT_USED;
+
+    for (i=0; i<count; i++)
+    {
+	unsigned val = idx[i];
+	if (val < nvals && remap[val] == NOT_USED) {
+	    remap[val] = next;
+	    order[next++] = val;
+	}
+    }
+
+    for (i=0; i<nvals; i++)
+    {
+	if (remap[i] == NOT_USED) {
+	    remap[i] = next;
+	    order[next++] = i;
+	}
+    }
+}
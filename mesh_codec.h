@@ -0,0 +1,73 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stream codecs used to compress the binary shell payloads.  These
+// are simple byte oriented coders in the spirit of the meshoptimizer
+// index and vertex codecs, and need no outside libraries.
+//
+// Index streams: each index is coded relative to a high water mark.
+// A vertex seen for the first time is exactly the high water mark,
+// which costs a single zero byte when the vertices are stored in the
+// order that they are first used.  Other indices are coded as a
+// zigzag delta from the previous index, which is small for facets
+// that share edges with the one before.
+//
+// Attribute streams: integer attributes are coded as zigzag deltas
+// from the same component of the previous element.
+//
+// Everything is written as LEB128 variable length integers.
+//
+
+extern void codec_put_varint (stp2webgl_buffer * buf, unsigned long val);
+extern unsigned long codec_get_varint (stp2webgl_reader * rd);
+
+extern void codec_encode_indices (
+    stp2webgl_buffer * buf,
+    const unsigned * idx,
+    unsigned count
+    );
+extern int codec_decode_indices (
+    stp2webgl_reader * rd,
+    unsigned * idx,
+    unsigned count
+    );
+
+extern void codec_encode_deltas (
+    stp2webgl_buffer * buf,
+    const int * vals,
+    unsigned count,
+    unsigned stride
+    );
+extern int codec_decode_deltas (
+    stp2webgl_reader * rd,
+    int * vals,
+    unsigned count,
+    unsigned stride
+    );
+
+// Compute the order that values are first used by an index list.
+// Values never used are placed at the end in their original order.
+// Fills order[new] = old and remap[old] = new, both nvals long.
+//
+extern void codec_first_use_order (
+    const unsigned * idx,
+    unsigned count,
+    unsigned nvals,
+    unsigned * order,
+    unsigned * remap
+    );
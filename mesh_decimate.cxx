@@ -0,0 +1,743 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include <math.h>
+#include <queue>
+#include <vector>
+
+#include "shell_mesh.h"
+
+// decimate_shell() -- reduce the facets of a shell to a target count
+// by collapsing edges in the order given by the quadric error metric
+// of Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics" (SIGGRAPH 1997).
+//
+// Only vertices inside a face group are removed.  Vertices on the
+// boundary of a STEP face, or used by more than one face, are locked
+// so face groups keep their outline, colors and picking ids.  Each
+// collapse moves a vertex onto one of its neighbors, so the remaining
+// vertices and normals are unchanged copies of the originals.
+//
+// A collapse is skipped if it would make the mesh non-manifold or
+// turn any facet by more than sixty degrees.  Decimation stops at the
+// target or when no legal collapse remains.  The quadrics are sums of
+// squared distances to the original facet planes, so the square root
+// of the largest collapse cost bounds the distance of every moved
+// vertex from the planes of the facets it replaced.  That is returned
+// in max_err for the -stats report.
+//
+// decimate_budgets() divides an assembly-wide facet budget between
+// shells in proportion to their surface area.  Shells that need less
+// than their share keep all of their facets and the rest is spread
+// over the others.
+//
+
+extern unsigned decimate_shell (
+    stp2webgl_shell * shell,
+    unsigned target,
+    double * max_err
+    );
+
+extern void decimate_budgets (
+    stp2webgl_shell * const * shells,
+    unsigned count,
+    unsigned long budget,
+    unsigned * targets
+    );
+
+#define NOT_USED	((unsigned)-1)
+#define MIN_FLIP_DOT	0.5
+
+
+struct collapse {
+    double cost;
+    unsigned from;
+    unsigned to;
+    unsigned stamp;
+
+    // lowest cost first out of the priority queue
+    bool operator< (const collapse & other) const {
+	return cost > other.cost;
+    }
+};
+
+
+struct decimator {
+    stp2webgl_shell * shell;
+    unsigned vcount;
+    unsigned fcount;
+    unsigned live;		// facets still in the mesh
+
+    double * quad;		// ten quadric terms per vertex
+    rose_uint_vector * adj;	// facets around each vertex
+    unsigned * stamp;		// bumped when a vertex changes
+    unsigned char * locked;
+    unsigned char * vdead;
+    unsigned char * fdead;
+    unsigned * fgroup;		// face group of each facet
+
+    std::priority_queue<collapse> heap;
+    double max_cost;
+};
+
+
+//======================================================================
+// Quadrics, stored as the upper triangle of the symmetric 4x4 matrix
+//
+
+static void quadric_add_plane (double q[10], const double n[3], double d)
+{
+    q[0] += n[0]*n[0];  q[1] += n[0]*n[1];  q[2] += n[0]*n[2];
+    q[3] += n[0]*d;
+    q[4] += n[1]*n[1];  q[5] += n[1]*n[2];  q[6] += n[1]*d;
+    q[7] += n[2]*n[2];  q[8] += n[2]*d;
+    q[9] += d*d;
+}
+
+static double quadric_eval (
+    const double a[10],
+    const double b[10],
+    const double p[3]
+    )
+{
+    double q[10];
+    unsigned k;
+    for (k=0; k<10; k++) q[k] = a[k] + b[k];
+
+    double x = p[0], y = p[1], z = p[2];
+    double val =
+	q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x +
+	q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y +
+	q[7]*z*z + 2*q[8]*z +
+	q[9];
+
+    return (val > 0.)? val: 0.;
+}
+
+static int facet_has (const stp2webgl_shell * shell, unsigned f, unsigned v)
+{
+    const unsigned * fv = shell->getFacet(f);
+    return fv[0] == v || fv[1] == v || fv[2] == v;
+}
+
+static void facet_normal_with (
+    double n[3],
+    const stp2webgl_shell * shell,
+    unsigned f,
+    unsigned from,
+    unsigned to
+    )
+{
+    const unsigned * fv = shell->getFacet(f);
+    const double * p[3];
+    unsigned k;
+
+    for (k=0; k<3; k++)
+	p[k] = shell->getVertex((fv[k] == from)? to: fv[k]);
+
+    double u[3] = { p[1][0]-p[0][0], p[1][1]-p[0][1], p[1][2]-p[0][2] };
+    double v[3] = { p[2][0]-p[0][0], p[2][1]-p[0][1], p[2][2]-p[0][2] };
+
+    n[0] = u[1]*v[2] - u[2]*v[1];
+    n[1] = u[2]*v[0] - u[0]*v[2];
+    n[2] = u[0]*v[1] - u[1]*v[0];
+
+    double len = sqrt (n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    if (len > 0.) {
+	n[0] /= len;  n[1] /= len;  n[2] /= len;
+    }
+}
+
+
+//======================================================================
+// Setup -- quadrics, adjacency and locked vertices
+//
+
+struct edge_key {
+    unsigned a, b, group;
+};
+
+static int edge_key_cmp (const void * x, const void * y)
+{
+    const edge_key * ka = (const edge_key *) x;
+    const edge_key * kb = (const edge_key *) y;
+
+    if (ka->group != kb->group) return (ka->group < kb->group)? -1: 1;
+    if (ka->a != kb->a) return (ka->a < kb->a)? -1: 1;
+    if (ka->b != kb->b) return (ka->b < kb->b)? -1: 1;
+    return 0;
+}
+
+static void lock_boundaries (decimator * d)
+{
+    unsigned i,j,k;
+    stp2webgl_shell * shell = d->shell;
+    unsigned ecount = d->fcount * 3;
+    edge_key * edges = new edge_key[ecount+1];
+    unsigned * vgroup = new unsigned[d->vcount+1];
+
+    for (i=0; i<d->vcount; i++) vgroup[i] = NOT_USED;
+
+    for (i=0; i<d->fcount; i++)
+    {
+	const unsigned * fv = shell->getFacet(i);
+	for (k=0; k<3; k++)
+	{
+	    unsigned a = fv[k];
+	    unsigned b = fv[(k+1)%3];
+	    edge_key * e = &edges[i*3+k];
+	    e->a = (a < b)? a: b;
+	    e->b = (a < b)? b: a;
+	    e->group = d->fgroup[i];
+
+	    // used by more than one face
+	    if (vgroup[a] == NOT_USED) vgroup[a] = d->fgroup[i];
+	    else if (vgroup[a] != d->fgroup[i]) d->locked[a] = 1;
+	}
+    }
+
+    // An edge used once within a face is on its boundary.  An edge
+    // used more than twice is non-manifold, and also left alone.
+    qsort (edges, ecount, sizeof(edge_key), edge_key_cmp);
+
+    for (i=0; i<ecount; i=j)
+    {
+	for (j=i+1; j<ecount && !edge_key_cmp(&edges[i], &edges[j]); j++)
+	    ;
+	if (j-i != 2) {
+	    d->locked[edges[i].a] = 1;
+	    d->locked[edges[i].b] = 1;
+	}
+    }
+
+    delete [] edges;
+    delete [] vgroup;
+}
+
+static void setup (decimator * d, stp2webgl_shell * shell)
+{
+    unsigned i,j,k;
+
+    d->shell = shell;
+    d->vcount = shell->getVertexCount();
+    d->fcount = shell->getFacetCount();
+    d->live = d->fcount;
+    d->max_cost = 0.;
+
+    d->quad = new double[d->vcount*10+1];
+    d->adj = new rose_uint_vector[d->vcount+1];
+    d->stamp = new unsigned[d->vcount+1];
+    d->locked = new unsigned char[d->vcount+1];
+    d->vdead = new unsigned char[d->vcount+1];
+    d->fdead = new unsigned char[d->fcount+1];
+    d->fgroup = new unsigned[d->fcount+1];
+
+    for (i=0; i<d->vcount*10; i++) d->quad[i] = 0.;
+    for (i=0; i<d->vcount; i++) {
+	d->stamp[i] = 0;
+	d->locked[i] = 0;
+	d->vdead[i] = 0;
+    }
+
+    for (i=0; i<shell->getFaceCount(); i++)
+    {
+	unsigned first = shell->face_first.get(i);
+	for (j=0; j<shell->face_count.get(i); j++)
+	    d->fgroup[first+j] = i;
+    }
+
+    for (i=0; i<d->fcount; i++)
+    {
+	const unsigned * fv = shell->getFacet(i);
+	double n[3];
+
+	d->fdead[i] = 0;
+	shell->getFacetNormal(n, i);
+
+	const double * p = shell->getVertex(fv[0]);
+	double dist = -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]);
+
+	for (k=0; k<3; k++) {
+	    quadric_add_plane (d->quad + fv[k]*10, n, dist);
+	    d->adj[fv[k]].append(i);
+	}
+    }
+
+    lock_boundaries (d);
+}
+
+static void cleanup (decimator * d)
+{
+    delete [] d->quad;
+    delete [] d->adj;
+    delete [] d->stamp;
+    delete [] d->locked;
+    delete [] d->vdead;
+    delete [] d->fdead;
+    delete [] d->fgroup;
+}
+
+
+
+//======================================================================
+// Collapses
+//
+
+// Facets on the edge between two vertices.  Returns the count and
+// fills in at most two of them.
+static unsigned edge_facets (
+    decimator * d,
+    unsigned from,
+    unsigned to,
+    unsigned found[2]
+    )
+{
+    unsigned i,sz;
+    unsigned cnt = 0;
+    rose_uint_vector & adj = d->adj[from];
+
+    for (i=0, sz=adj.size(); i<sz; i++)
+    {
+	unsigned f = adj[i];
+	if (d->fdead[f] || !facet_has (d->shell, f, to)) continue;
+	if (cnt < 2) found[cnt] = f;
+	cnt++;
+    }
+    return cnt;
+}
+
+static void mark_neighbors (
+    decimator * d,
+    unsigned v,
+    unsigned * marks,
+    unsigned mark
+    )
+{
+    unsigned i,sz,k;
+    rose_uint_vector & adj = d->adj[v];
+
+    for (i=0, sz=adj.size(); i<sz; i++)
+    {
+	unsigned f = adj[i];
+	if (d->fdead[f]) continue;
+
+	const unsigned * fv = d->shell->getFacet(f);
+	for (k=0; k<3; k++) marks[fv[k]] = mark;
+    }
+}
+
+static int can_collapse (
+    decimator * d,
+    unsigned from,
+    unsigned to,
+    unsigned * marks,
+    unsigned * mark
+    )
+{
+    unsigned i,sz,k;
+    unsigned edge[2];
+
+    if (d->locked[from] || d->vdead[from] || d->vdead[to])
+	return 0;
+
+    // interior edges of a manifold have exactly two facets
+    if (edge_facets (d, from, to, edge) != 2)
+	return 0;
+
+    // Link condition -- the only vertices next to both ends should be
+    // the two across the edge, otherwise the collapse pinches the mesh
+    unsigned mine = ++(*mark);
+    mark_neighbors (d, from, marks, mine);
+
+    unsigned shared = 0;
+    rose_uint_vector & adj = d->adj[to];
+    unsigned seen = ++(*mark);
+
+    for (i=0, sz=adj.size(); i<sz; i++)
+    {
+	unsigned f = adj[i];
+	if (d->fdead[f]) continue;
+
+	const unsigned * fv = d->shell->getFacet(f);
+	for (k=0; k<3; k++) {
+	    unsigned v = fv[k];
+	    if (v == from || v == to) continue;
+	    if (marks[v] == mine) {
+		marks[v] = seen;
+		shared++;
+	    }
+	}
+    }
+    if (shared != 2)
+	return 0;
+
+    // no facet may fold over
+    rose_uint_vector & fadj = d->adj[from];
+    for (i=0, sz=fadj.size(); i<sz; i++)
+    {
+	unsigned f = fadj[i];
+	if (d->fdead[f] || facet_has (d->shell, f, to)) continue;
+
+	double before[3], after[3];
+	facet_normal_with (before, d->shell, f, from, from);
+	facet_normal_with (after, d->shell, f, from, to);
+
+	double dot = before[0]*after[0] + before[1]*after[1] +
+	    before[2]*after[2];
+	if (dot < MIN_FLIP_DOT)
+	    return 0;
+    }
+
+    return 1;
+}
+
+
+// Queue the collapse of a free vertex onto each of its neighbors.
+// The cheapest comes out first, and if it turns out not to be legal
+// the next one is still there to try.
+static void queue_vertex (decimator * d, unsigned v)
+{
+    unsigned i,j,sz,k;
+    collapse c;
+    rose_uint_vector seen;
+
+    if (d->locked[v] || d->vdead[v])
+	return;
+
+    c.from = v;
+    c.stamp = d->stamp[v];
+
+    rose_uint_vector & adj = d->adj[v];
+    for (i=0, sz=adj.size(); i<sz; i++)
+    {
+	unsigned f = adj[i];
+	if (d->fdead[f]) continue;
+
+	const unsigned * fv = d->shell->getFacet(f);
+	for (k=0; k<3; k++)
+	{
+	    unsigned to = fv[k];
+	    if (to == v) continue;
+
+	    // each edge is shared by two facets
+	    for (j=0; j<seen.size(); j++)
+		if (seen[j] == to) break;
+	    if (j < seen.size()) continue;
+	    seen.append(to);
+
+	    c.to = to;
+	    c.cost = quadric_eval (
+		d->quad + v*10, d->quad + to*10, d->shell->getVertex(to)
+		);
+	    d->heap.push(c);
+	}
+    }
+}
+
+
+static void do_collapse (decimator * d, const collapse * c)
+{
+    unsigned i,sz,k;
+    unsigned from = c->from;
+    unsigned to = c->to;
+    unsigned edge[2];
+    stp2webgl_shell * shell = d->shell;
+
+    edge_facets (d, from, to, edge);
+
+    // The moved corners take the normal that the target vertex has in
+    // this face.  Collapses stay inside one face, so any facet on the
+    // edge has it.
+    unsigned normal = ROSE_NOTFOUND;
+    const unsigned * ev = shell->getFacet(edge[0]);
+    for (k=0; k<3; k++) {
+	if (ev[k] == to)
+	    normal = shell->facet_normals[edge[0]*3+k];
+    }
+
+    d->fdead[edge[0]] = 1;
+    d->fdead[edge[1]] = 1;
+    d->live -= 2;
+
+    rose_uint_vector & adj = d->adj[from];
+    for (i=0, sz=adj.size(); i<sz; i++)
+    {
+	unsigned f = adj[i];
+	if (d->fdead[f]) continue;
+
+	for (k=0; k<3; k++) {
+	    if (shell->facets[f*3+k] == from) {
+		shell->facets[f*3+k] = to;
+		shell->facet_normals[f*3+k] = normal;
+	    }
+	}
+	d->adj[to].append(f);
+    }
+
+    for (k=0; k<10; k++)
+	d->quad[to*10+k] += d->quad[from*10+k];
+
+    d->vdead[from] = 1;
+    adj.empty();
+
+    if (c->cost > d->max_cost)
+	d->max_cost = c->cost;
+
+    // everything around the target has new costs
+    d->stamp[to]++;
+    queue_vertex (d, to);
+
+    rose_uint_vector & tadj = d->adj[to];
+    for (i=0, sz=tadj.size(); i<sz; i++)
+    {
+	unsigned f = tadj[i];
+	if (d->fdead[f]) continue;
+
+	const unsigned * fv = shell->getFacet(f);
+	for (k=0; k<3; k++) {
+	    if (fv[k] == to) continue;
+	    d->stamp[fv[k]]++;
+	    queue_vertex (d, fv[k]);
+	}
+    }
+}
+
+
+
+//======================================================================
+// Rebuild the shell from the facets that are left, dropping vertices
+// and normals that nothing uses any more.
+//
+
+static void compact_table (
+    rose_real_vector &vals,
+    rose_uint_vector &idx,
+    unsigned count
+    )
+{
+    unsigned i,k;
+    unsigned next = 0;
+    unsigned * remap = new unsigned[count+1];
+
+    for (i=0; i<count; i++) remap[i] = NOT_USED;
+
+    for (i=0; i<idx.size(); i++)
+    {
+	unsigned v = idx[i];
+	if (v == ROSE_NOTFOUND) continue;
+	if (remap[v] == NOT_USED) remap[v] = 0;
+    }
+
+    // keep the original order, which is still good for the cache
+    for (i=0; i<count; i++)
+    {
+	if (remap[i] == NOT_USED) continue;
+	remap[i] = next;
+	for (k=0; k<3; k++) vals[next*3+k] = vals[i*3+k];
+	next++;
+    }
+
+    for (i=0; i<idx.size(); i++) {
+	if (idx[i] != ROSE_NOTFOUND)
+	    idx[i] = remap[idx[i]];
+    }
+
+    rose_real_vector keep;
+    for (i=0; i<next*3; i++) keep.append(vals[i]);
+    vals.empty();
+    for (i=0; i<next*3; i++) vals.append(keep[i]);
+
+    delete [] remap;
+}
+
+static void rebuild (decimator * d)
+{
+    unsigned i,j,k;
+    stp2webgl_shell * shell = d->shell;
+    rose_uint_vector facets;
+    rose_uint_vector normals;
+
+    for (i=0; i<shell->getFaceCount(); i++)
+    {
+	unsigned first = shell->face_first[i];
+	unsigned count = shell->face_count[i];
+	unsigned kept = 0;
+
+	shell->face_first[i] = facets.size() / 3;
+	for (j=first; j<first+count; j++)
+	{
+	    if (d->fdead[j]) continue;
+	    for (k=0; k<3; k++) {
+		facets.append(shell->facets[j*3+k]);
+		normals.append(shell->facet_normals[j*3+k]);
+	    }
+	    kept++;
+	}
+	shell->face_count[i] = kept;
+    }
+
+    shell->facets.empty();
+    shell->facet_normals.empty();
+    for (i=0; i<facets.size(); i++) {
+	shell->facets.append(facets[i]);
+	shell->facet_normals.append(normals[i]);
+    }
+
+    compact_table (shell->verts, shell->facets, d->vcount);
+    compact_table (shell->normals, shell->facet_normals,
+		   shell->getNormalCount());
+}
+
+
+unsigned decimate_shell (
+    stp2webgl_shell * shell,
+    unsigned target,
+    double * max_err
+    )
+{
+    unsigned i;
+    decimator d;
+
+    if (max_err) *max_err = 0.;
+    if (shell->getFacetCount() <= target)
+	return shell->getFacetCount();
+
+    setup (&d, shell);
+
+    unsigned * marks = new unsigned[d.vcount+1];
+    unsigned mark = 0;
+    for (i=0; i<d.vcount; i++) marks[i] = 0;
+
+    for (i=0; i<d.vcount; i++)
+	queue_vertex (&d, i);
+
+    while (d.live > target && !d.heap.empty())
+    {
+	collapse c = d.heap.top();
+	d.heap.pop();
+
+	// stale entry, the vertex has been requeued since
+	if (d.vdead[c.from] || c.stamp != d.stamp[c.from])
+	    continue;
+
+	// the other targets for this vertex are still queued
+	if (!can_collapse (&d, c.from, c.to, marks, &mark))
+	    continue;
+
+	do_collapse (&d, &c);
+    }
+
+    rebuild (&d);
+
+    if (max_err) *max_err = sqrt (d.max_cost);
+
+    delete [] marks;
+    cleanup (&d);
+    return shell->getFacetCount();
+}
+
+
+
+//======================================================================
+// Assembly budget
+//
+
+static double shell_surface_area (const stp2webgl_shell * shell)
+{
+    unsigned i,sz;
+    double area = 0.;
+
+    for (i=0, sz=shell->getFacetCount(); i<sz; i++)
+    {
+	const unsigned * fv = shell->getFacet(i);
+	const double * a = shell->getVertex(fv[0]);
+	const double * b = shell->getVertex(fv[1]);
+	const double * c = shell->getVertex(fv[2]);
+
+	double u[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] };
+	double v[3] = { c[0]-a[0], c[1]-a[1], c[2]-a[2] };
+	double n[3] = {
+	    u[1]*v[2] - u[2]*v[1],
+	    u[2]*v[0] - u[0]*v[2],
+	    u[0]*v[1] - u[1]*v[0]
+	};
+	area += 0.5 * sqrt (n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    }
+    return area;
+}
+
+void decimate_budgets (
+    stp2webgl_shell * const * shells,
+    unsigned count,
+    unsigned long budget,
+    unsigned * targets
+    )
+{
+    unsigned i;
+    double * area = new double[count+1];
+    unsigned char * done = new unsigned char[count+1];
+    double left = (double) budget;
+    int changed = 1;
+
+    for (i=0; i<count; i++) {
+	area[i] = shell_surface_area (shells[i]);
+	targets[i] = shells[i]->getFacetCount();
+	done[i] = 0;
+    }
+
+    // Shells that need less than their share keep everything, which
+    // leaves more for the others, so repeat until nothing changes.
+    while (changed)
+    {
+	double total = 0.;
+	changed = 0;
+
+	for (i=0; i<count; i++)
+	    if (!done[i]) total += area[i];
+
+	for (i=0; i<count; i++)
+	{
+	    if (done[i]) continue;
+
+	    double share = (total > 0.)? left * area[i] / total: 0.;
+	    if (shells[i]->getFacetCount() <= share) {
+		done[i] = 1;
+		left -= shells[i]->getFacetCount();
+		changed = 1;
+	    }
+	}
+    }
+
+    double total = 0.;
+    for (i=0; i<count; i++)
+	if (!done[i]) total += area[i];
+
+    for (i=0; i<count; i++)
+    {
+	if (done[i]) continue;
+	double share = (total > 0. && left > 0.)? left * area[i] / total: 0.;
+	targets[i] = (unsigned) share;
+    }
+
+    delete [] area;
+    delete [] done;
+}
@@ -0,0 +1,205 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <math.h>
+
+#include "shell_mesh.h"
+#include "mesh_meshlet.h"
+
+// stp2webgl_meshlets::build() -- cut the facets of a shell into
+// meshlets.  Used by the -meshlets option for both the XML and the
+// binary shells.
+//
+// Facets are taken in order, and a new meshlet is started whenever
+// the next facet would bring in too many vertices or triangles.  The
+// shell facets already follow the STEP faces, and the -reorder option
+// makes neighboring facets share even more vertices, so this gives
+// compact clusters without any search.
+//
+// The normal cone follows the usual cluster culling test.  A meshlet
+// with bounding sphere (center, radius) can be skipped when seen from
+// a camera at position c if
+//
+//    dot(center - c, axis) >= cutoff * length(center - c) + radius
+//
+// The cutoff is the sine of the widest angle between a facet normal
+// and the axis.  It is set to one, which never passes the test, when
+// the facets spread over more than a hemisphere or so.
+//
+
+// smallest cosine between the axis and a facet to keep a cone
+#define MESHLET_CONE_MIN_DOT	0.1
+
+
+stp2webgl_meshlets::stp2webgl_meshlets()
+    : meshlets(0), count(0), verts(0), vert_count(0), tris(0), tri_count(0)
+{
+}
+
+stp2webgl_meshlets::~stp2webgl_meshlets()
+{
+    delete [] meshlets;
+    delete [] verts;
+    delete [] tris;
+}
+
+
+static void meshlet_bounds (
+    const stp2webgl_shell * shell,
+    stp2webgl_meshlet * m,
+    const unsigned * verts
+    )
+{
+    unsigned i,k;
+    double lo[3], hi[3], ctr[3];
+    double r2 = 0.;
+
+    for (k=0; k<3; k++) {
+	lo[k] = hi[k] = shell->getVertex(verts[m->vert_first])[k];
+    }
+    for (i=1; i<m->vert_count; i++)
+    {
+	const double * pt = shell->getVertex(verts[m->vert_first + i]);
+	for (k=0; k<3; k++) {
+	    if (pt[k] < lo[k]) lo[k] = pt[k];
+	    if (pt[k] > hi[k]) hi[k] = pt[k];
+	}
+    }
+
+    for (k=0; k<3; k++) ctr[k] = (lo[k] + hi[k]) / 2.;
+    for (i=0; i<m->vert_count; i++)
+    {
+	const double * pt = shell->getVertex(verts[m->vert_first + i]);
+	double d = 0.;
+	for (k=0; k<3; k++) d += (pt[k] - ctr[k]) * (pt[k] - ctr[k]);
+	if (d > r2) r2 = d;
+    }
+
+    for (k=0; k<3; k++) m->center[k] = (float) ctr[k];
+    m->radius = (float) sqrt(r2);
+
+    // normal cone from the facet geometry, degenerate facets ignored
+    double axis[3] = { 0., 0., 0. };
+    double n[3];
+    for (i=0; i<m->tri_count; i++) {
+	shell->getFacetNormal(n, m->tri_first + i);
+	for (k=0; k<3; k++) axis[k] += n[k];
+    }
+
+    double len = sqrt (axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    double min_dot = -1.;
+    if (len > 0.)
+    {
+	for (k=0; k<3; k++) axis[k] /= len;
+
+	min_dot = 1.;
+	for (i=0; i<m->tri_count; i++) {
+	    shell->getFacetNormal(n, m->tri_first + i);
+	    double nlen = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+	    if (nlen == 0.) continue;
+
+	    double dot = axis[0]*n[0] + axis[1]*n[1] + axis[2]*n[2];
+	    if (dot < min_dot) min_dot = dot;
+	}
+    }
+
+    for (k=0; k<3; k++) m->cone_axis[k] = (float) axis[k];
+    if (min_dot < MESHLET_CONE_MIN_DOT)
+	m->cone_cutoff = 1.f;
+    else
+	m->cone_cutoff = (float) sqrt (1. - min_dot * min_dot);
+}
+
+
+void stp2webgl_meshlets::build (
+    const stp2webgl_shell * shell,
+    unsigned max_verts,
+    unsigned max_tris
+    )
+{
+    unsigned i,j;
+    unsigned vcount = shell->getVertexCount();
+    unsigned fcount = shell->getFacetCount();
+
+    delete [] meshlets;
+    delete [] verts;
+    delete [] tris;
+
+    if (max_verts < 3) max_verts = 3;
+    if (max_verts > 256) max_verts = 256;
+    if (max_tris < 1) max_tris = 1;
+
+    // at most every facet starts a meshlet and brings three vertices
+    meshlets = new stp2webgl_meshlet[fcount+1];
+    verts = new unsigned[fcount*3+1];
+    tris = new unsigned char[fcount*3+1];
+    count = 0;
+    vert_count = 0;
+    tri_count = fcount;
+
+    // position of each shell vertex in the current meshlet, valid
+    // only when the owner matches
+    unsigned * slot = new unsigned[vcount+1];
+    unsigned * owner = new unsigned[vcount+1];
+    for (i=0; i<vcount; i++) owner[i] = ROSE_NOTFOUND;
+
+    stp2webgl_meshlet * m = 0;
+    for (i=0; i<fcount; i++)
+    {
+	const unsigned * f = shell->getFacet(i);
+	unsigned added = 0;
+
+	for (j=0; m && j<3; j++) {
+	    if (owner[f[j]] == count-1) continue;
+	    if (j > 0 && f[j] == f[0]) continue;
+	    if (j > 1 && f[j] == f[1]) continue;
+	    added++;
+	}
+
+	if (!m || m->vert_count + added > max_verts ||
+	    m->tri_count + 1 > max_tris)
+	{
+	    m = meshlets + count++;
+	    m->vert_first = vert_count;
+	    m->vert_count = 0;
+	    m->tri_first = i;
+	    m->tri_count = 0;
+	}
+
+	for (j=0; j<3; j++)
+	{
+	    unsigned v = f[j];
+	    if (owner[v] != count-1) {
+		owner[v] = count-1;
+		slot[v] = m->vert_count++;
+		verts[vert_count++] = v;
+	    }
+	    tris[3*i+j] = (unsigned char) slot[v];
+	}
+	m->tri_count++;
+    }
+
+    for (i=0; i<count; i++)
+	meshlet_bounds (shell, meshlets + i, verts);
+
+    delete [] slot;
+    delete [] owner;
+}
@@ -0,0 +1,67 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Meshlets -- the facets of a shell cut into small clusters that a
+// mesh shader or a compute culling pass can handle one at a time.
+//
+// Each meshlet covers a run of consecutive facets in the shell, so
+// the ordinary index buffer still draws everything and the face
+// groups are not disturbed.  A meshlet lists the shell vertices that
+// it uses, and each of its triangles is three byte-sized positions
+// in that list.  The bounding sphere and normal cone let a client
+// skip clusters that are out of view or facing away.
+//
+
+#define MESHLET_MAX_VERTS	64
+#define MESHLET_MAX_TRIS	124
+
+struct stp2webgl_meshlet {
+    unsigned vert_first;	// first entry in the vertex list
+    unsigned vert_count;
+    unsigned tri_first;		// first facet of the shell
+    unsigned tri_count;
+    float center[3];		// bounding sphere
+    float radius;
+    float cone_axis[3];		// average facet direction
+    float cone_cutoff;		// one if the cone is too wide to cull
+};
+
+class stp2webgl_meshlets {
+public:
+    stp2webgl_meshlet * meshlets;
+    unsigned count;
+
+    unsigned * verts;		// shell vertex numbers, by meshlet
+    unsigned vert_count;
+
+    unsigned char * tris;	// three meshlet vertex numbers per facet
+    unsigned tri_count;
+
+    stp2webgl_meshlets();
+    ~stp2webgl_meshlets();
+
+    void build (
+	const stp2webgl_shell * shell,
+	unsigned max_verts = MESHLET_MAX_VERTS,
+	unsigned max_tris = MESHLET_MAX_TRIS
+	);
+
+private:
+    stp2webgl_meshlets (const stp2webgl_meshlets &);
+    stp2webgl_meshlets & operator= (const stp2webgl_meshlets &);
+};
@@ -0,0 +1,242 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include <chrono>
+#include <thread>
+
+#include "mesh_pump.h"
+#include "parallel.h"
+#include "stats.h"
+
+// How often to look for finished meshes when there is a time limit
+#define PUMP_POLL_MSEC	10
+
+
+stp2webgl_mesh_pump::stp2webgl_mesh_pump (
+    StixMeshStpAsyncMaker * m,
+    double secs
+    )
+    : mesher(m), timeout(secs), limit(0), first(0),
+      running(0), started(0), running_count(0), started_head(0),
+      stuck(0)
+{
+    if (timeout > 0.) {
+	limit = stp2webgl_thread_count(0);
+	running = new stp_representation_item * [limit];
+	started = new double[limit];
+    }
+}
+
+stp2webgl_mesh_pump::~stp2webgl_mesh_pump()
+{
+    delete [] running;
+    delete [] started;
+}
+
+void stp2webgl_mesh_pump::add (
+    stp_representation * rep,
+    stp_representation_item * solid,
+    StixMeshOptions * mo
+    )
+{
+    // a solid that was given up is still stuck in the mesher
+    if (isAbandoned(solid)) return;
+
+    reps.append(rep);
+    items.append(solid);
+    options.append(mo);
+}
+
+void stp2webgl_mesh_pump::cancel()
+{
+    reps.empty();
+    items.empty();
+    options.empty();
+    first = 0;
+}
+
+unsigned stp2webgl_mesh_pump::pending() const
+{
+    return items.size() - first + running_count;
+}
+
+int stp2webgl_mesh_pump::isAbandoned (stp_representation_item * solid) const
+{
+    unsigned i,sz;
+    for (i=0, sz=abandoned.size(); i<sz; i++)
+	if (abandoned[i] == solid) return 1;
+    return 0;
+}
+
+void stp2webgl_mesh_pump::release()
+{
+    if (!abandoned.size())
+	delete mesher;
+    mesher = 0;
+}
+
+void stp2webgl_mesh_pump::finished (unsigned idx)
+{
+    running_count--;
+    if (limit) {
+	running[idx] = running[running_count];
+	started[idx] = started[running_count];
+    }
+}
+
+// Without a limit, results mostly come back in the order the solids
+// were started, so the search from the front is short.
+void stp2webgl_mesh_pump::finishedUnlimited (stp_representation_item * it)
+{
+    unsigned i,sz;
+
+    running_count--;
+    for (i=started_head, sz=started_list.size(); i<sz; i++) {
+	if (started_list[i] == it) {
+	    started_list[i] = 0;
+	    break;
+	}
+    }
+
+    while (started_head < started_list.size() && !started_list[started_head])
+	started_head++;
+
+    if (started_head == started_list.size()) {
+	started_list.empty();
+	started_head = 0;
+    }
+}
+
+void stp2webgl_mesh_pump::abandonAll()
+{
+    unsigned i,sz;
+
+    cancel();
+    if (limit) {
+	for (i=0; i<running_count; i++)
+	    abandoned.append(running[i]);
+    }
+    else {
+	for (i=started_head, sz=started_list.size(); i<sz; i++)
+	    if (started_list[i]) abandoned.append(started_list[i]);
+	started_list.empty();
+	started_head = 0;
+    }
+
+    stuck += running_count;
+    stats_add("abandoned solids", running_count);
+    running_count = 0;
+}
+
+
+StixMeshStp * stp2webgl_mesh_pump::next (
+    stp_representation_item ** timed_out,
+    double until
+    )
+{
+    unsigned i;
+    StixMeshStp * mesh;
+
+    *timed_out = 0;
+    while (1)
+    {
+	// Threads still working on abandoned solids are not free, but
+	// always keep one solid going in case they never come back.
+	while (first < items.size() &&
+	       (!limit || !running_count || running_count + stuck < limit))
+	{
+	    stp_representation_item * it =
+		(stp_representation_item *) items[first];
+
+	    if (mesher->startMesh((stp_representation *) reps[first], it,
+				  (StixMeshOptions *) options[first]))
+	    {
+		if (limit) {
+		    running[running_count] = it;
+		    started[running_count] = stats_time();
+		}
+		else
+		    started_list.append(it);
+		running_count++;
+	    }
+	    first++;
+	}
+
+	if (first && first == items.size())
+	    cancel();
+
+	if (!running_count)
+	    return 0;
+
+	mesh = mesher->getResult((limit || until > 0.)? 0: 1);
+	if (!mesh && !limit && until <= 0.) {
+	    // nothing else is coming
+	    running_count = 0;
+	    return 0;
+	}
+
+	if (mesh)
+	{
+	    stp_representation_item * it = mesh->getStepSolid();
+	    if (isAbandoned(it)) {
+		if (stuck) stuck--;
+		delete mesh;
+		continue;
+	    }
+
+	    if (!limit)
+		finishedUnlimited(it);
+
+	    for (i=0; limit && i<running_count; i++) {
+		if (running[i] == it) {
+		    finished(i);
+		    break;
+		}
+	    }
+	    return mesh;
+	}
+
+	// Give up on the solid that has been running longest if it is
+	// over the limit.
+	if (limit)
+	{
+	    unsigned oldest = 0;
+	    for (i=1; i<running_count; i++)
+		if (started[i] < started[oldest]) oldest = i;
+
+	    if (stats_time() - started[oldest] > timeout)
+	    {
+		*timed_out = running[oldest];
+		abandoned.append(running[oldest]);
+		stuck++;
+		stats_add("timed out solids", 1);
+		finished(oldest);
+		return 0;
+	    }
+	}
+
+	if (until > 0. && stats_time() >= until)
+	    return 0;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(PUMP_POLL_MSEC));
+    }
+}
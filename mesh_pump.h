@@ -0,0 +1,105 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Feeds solids to the mesher and collects the results, giving up on
+// any solid that takes longer than a time limit.
+//
+// The mesher threads can not be stopped, so a solid that is given up
+// keeps its thread busy until it finishes, if ever.  The pump only
+// hands the mesher as many solids as it has free threads, so that the
+// time for each one is measured from when it actually starts.  Late
+// results for a solid that was given up are thrown away, and free up
+// its thread again.
+//
+// Without a time limit everything goes to the mesher at once and the
+// results are collected by blocking, same as using it directly.
+//
+// The pump is kept for the whole run since the mesher may still send
+// back late results.  When anything was given up, the mesher should
+// not be deleted, since that waits for the stuck threads.
+//
+
+class stp2webgl_mesh_pump {
+    StixMeshStpAsyncMaker * mesher;
+    double timeout;
+    unsigned limit;
+
+    rose_vector reps;		// queued solids and their options
+    rose_vector items;
+    rose_vector options;
+    unsigned first;		// first queued solid not yet started
+
+    // solids with the mesher and their start times when there is a
+    // limit.  Otherwise every solid started, in order, with finished
+    // ones set to null and skipped from the front.
+    stp_representation_item ** running;
+    double * started;
+    unsigned running_count;
+    rose_vector started_list;
+    unsigned started_head;
+
+    rose_vector abandoned;	// solids given up, never finished
+    unsigned stuck;		// mesher threads still busy with them
+
+public:
+    // zero timeout for no limit
+    stp2webgl_mesh_pump (StixMeshStpAsyncMaker * m, double timeout);
+    ~stp2webgl_mesh_pump();
+
+    // Queue a solid.  The options must stay around until the solid
+    // comes back from next().
+    void add (
+	stp_representation * rep,
+	stp_representation_item * solid,
+	StixMeshOptions * mo
+	);
+
+    // Drop any queued solids that have not been started yet.
+    void cancel();
+
+    // Wait for the next finished mesh, which the caller must delete.
+    // Returns null when all solids are done.  A solid that runs past
+    // the time limit also comes back as null, with the solid in
+    // timed_out, which is otherwise set to null.  If given a time
+    // from stats_time(), also returns null at that time with solids
+    // still pending.
+    StixMeshStp * next (
+	stp_representation_item ** timed_out,
+	double until = 0.
+	);
+
+    // Stop waiting on everything.  Queued solids are dropped and the
+    // running ones are given up as if they had timed out.
+    void abandonAll();
+
+    unsigned pending() const;
+    int isAbandoned (stp_representation_item * solid) const;
+    unsigned abandonedCount() const	{ return abandoned.size(); }
+
+    // Delete the mesher once the pump is done with it.  Deleting it
+    // waits for its threads, which may never finish a solid that was
+    // abandoned, so in that case it is left for process exit.
+    void release();
+
+private:
+    void finished (unsigned idx);
+    void finishedUnlimited (stp_representation_item * it);
+
+    stp2webgl_mesh_pump (const stp2webgl_mesh_pump &);
+    stp2webgl_mesh_pump & operator= (const stp2webgl_mesh_pump &);
+};
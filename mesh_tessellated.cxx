@@ -0,0 +1,597 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include <math.h>
+
+#include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "stats.h"
+
+// Tessellated geometry -- AP242 files may carry triangles for a
+// shape, either alongside the exact boundary or in place of it.
+// Those are copied straight into a shell and never go to the mesher,
+// so they come out exactly as the sending system made them, whatever
+// tolerance was asked for.
+//
+// Handles tessellated solids and shells made of triangulated faces,
+// and triangulated surface sets.  Triangles, strips, and fans are
+// all turned into plain facets.  The facets of each face are a face
+// group, colored like the face or else like the whole item, and the
+// vertices are shared by every face that uses the same coordinates
+// list.  Other tessellated faces, such as cubic bezier patches, are
+// ignored.
+//
+// A tessellated solid or shell may also name the B-rep that it was
+// made from.  When that tessellation is in the model, the B-rep is
+// left alone rather than drawing the same shape twice.
+//
+
+extern int stp2webgl_is_tessellated (stp_representation_item * it);
+extern int stp2webgl_has_tessellation (stp_representation_item * it);
+extern void stp2webgl_find_tessellations (stp2webgl_opts * opts);
+extern int stp2webgl_tessellated_bbox (
+    stp_representation_item * it,
+    StixMeshBoundingBox * bbox
+    );
+extern const rose_vector * stp2webgl_external_shapes (
+    stp_representation * rep
+    );
+
+
+// B-rep items named by a tessellation in the model, sorted by address
+static rose_vector tess_links;
+
+
+// Everything needed from one triangulated face or surface set.  The
+// two have the same attributes but are not related in the schema.
+//
+struct tess_face {
+    RoseObject * obj;
+    stp_coordinates_list * coords;
+    unsigned pnmax;
+    ListOfListOfDouble * normals;
+    ListOfInteger * pnindex;	// may be empty, then indices are points
+    ListOfListOfInteger * triangles;
+    ListOfListOfInteger * strips;
+    ListOfListOfInteger * fans;
+};
+
+// Working state while copying the triangles of one face
+struct tess_copy {
+    stp2webgl_shell * shell;
+    const tess_face * face;
+    unsigned base;		// first shell vertex of the coordinates
+    unsigned npoints;		// points in the coordinates list
+    unsigned nbase;		// first shell normal or ROSE_NOTFOUND
+    unsigned ncount;		// normals given for the face
+};
+
+static int get_tess_face (RoseObject * obj, tess_face * tf)
+{
+    tf->obj = obj;
+    tf->coords = 0;
+    tf->pnmax = 0;
+    tf->normals = 0;
+    tf->pnindex = 0;
+    tf->triangles = 0;
+    tf->strips = 0;
+    tf->fans = 0;
+
+    if (!obj) return 0;
+
+    if (obj->isa(ROSE_DOMAIN(stp_triangulated_face)))
+    {
+	stp_triangulated_face * f = ROSE_CAST(stp_triangulated_face,obj);
+	tf->coords = f->coordinates();
+	tf->pnmax = f->pnmax();
+	tf->normals = f->normals();
+	tf->pnindex = f->pnindex();
+	tf->triangles = f->triangles();
+    }
+    else if (obj->isa(ROSE_DOMAIN(stp_complex_triangulated_face)))
+    {
+	stp_complex_triangulated_face * f =
+	    ROSE_CAST(stp_complex_triangulated_face,obj);
+	tf->coords = f->coordinates();
+	tf->pnmax = f->pnmax();
+	tf->normals = f->normals();
+	tf->pnindex = f->pnindex();
+	tf->strips = f->triangle_strips();
+	tf->fans = f->triangle_fans();
+    }
+    else if (obj->isa(ROSE_DOMAIN(stp_triangulated_surface_set)))
+    {
+	stp_triangulated_surface_set * f =
+	    ROSE_CAST(stp_triangulated_surface_set,obj);
+	tf->coords = f->coordinates();
+	tf->pnmax = f->pnmax();
+	tf->normals = f->normals();
+	tf->pnindex = f->pnindex();
+	tf->triangles = f->triangles();
+    }
+    else if (obj->isa(ROSE_DOMAIN(stp_complex_triangulated_surface_set)))
+    {
+	stp_complex_triangulated_surface_set * f =
+	    ROSE_CAST(stp_complex_triangulated_surface_set,obj);
+	tf->coords = f->coordinates();
+	tf->pnmax = f->pnmax();
+	tf->normals = f->normals();
+	tf->pnindex = f->pnindex();
+	tf->strips = f->triangle_strips();
+	tf->fans = f->triangle_fans();
+    }
+
+    return tf->coords != 0;
+}
+
+
+int stp2webgl_is_tessellated (stp_representation_item * it)
+{
+    if (!it) return 0;
+
+    return it->isa(ROSE_DOMAIN(stp_tessellated_solid)) ||
+	it->isa(ROSE_DOMAIN(stp_tessellated_shell)) ||
+	it->isa(ROSE_DOMAIN(stp_triangulated_surface_set)) ||
+	it->isa(ROSE_DOMAIN(stp_complex_triangulated_surface_set));
+}
+
+
+
+//------------------------------------------------------------
+// COPY THE TRIANGLES -- Indices in the file count from one.  With a
+// pnindex list, the triangles index into it and it gives the point,
+// otherwise they give the point directly.  Normals, when there is
+// one for each pnindex entry, use the same index as the triangles.
+//------------------------------------------------------------
+
+static void copy_points (
+    stp2webgl_shell * shell,
+    stp_coordinates_list * coords
+    )
+{
+    unsigned i,sz;
+    unsigned k;
+    ListOfListOfDouble * pts = coords->position_coords();
+
+    for (i=0, sz=pts? pts->size(): 0; i<sz; i++)
+    {
+	ListOfDouble * pt = pts->get(i);
+	for (k=0; k<3; k++)
+	    shell->verts.append((pt && k < pt->size())? pt->get(k): 0.);
+    }
+}
+
+static unsigned point_count (stp_coordinates_list * coords)
+{
+    ListOfListOfDouble * pts = coords->position_coords();
+    return pts? pts->size(): 0;
+}
+
+static void copy_normals (tess_copy * tc)
+{
+    unsigned i,k;
+    ListOfListOfDouble * nl = tc->face->normals;
+
+    tc->nbase = ROSE_NOTFOUND;
+    tc->ncount = nl? nl->size(): 0;
+
+    // either one for the whole face or one for each pnindex entry
+    if (!tc->ncount ||
+	(tc->ncount != 1 && tc->ncount != tc->face->pnmax)) {
+	tc->ncount = 0;
+	return;
+    }
+
+    tc->nbase = tc->shell->getNormalCount();
+    for (i=0; i<tc->ncount; i++)
+    {
+	ListOfDouble * n = nl->get(i);
+	for (k=0; k<3; k++)
+	    tc->shell->normals.append((n && k < n->size())? n->get(k): 0.);
+    }
+}
+
+static void add_triangle (tess_copy * tc, int a, int b, int c)
+{
+    unsigned k;
+    unsigned verts[3];
+    unsigned norms[3];
+    int idx[3];
+    ListOfInteger * pn = tc->face->pnindex;
+    unsigned pnsz = pn? pn->size(): 0;
+
+    // strips repeat an index to start over, drop those
+    if (a == b || b == c || a == c) return;
+
+    idx[0] = a;  idx[1] = b;  idx[2] = c;
+    for (k=0; k<3; k++)
+    {
+	if (idx[k] <= 0) return;
+	unsigned i = idx[k] - 1;
+	int pt = idx[k];
+
+	if (pnsz) {
+	    if (i >= pnsz) return;
+	    pt = pn->get(i);
+	}
+	if (pt <= 0 || (unsigned) pt > tc->npoints) return;
+
+	verts[k] = tc->base + pt - 1;
+	norms[k] = (tc->ncount == 1)? tc->nbase:
+	    (tc->ncount && i < tc->ncount)? tc->nbase + i: ROSE_NOTFOUND;
+    }
+
+    for (k=0; k<3; k++) {
+	tc->shell->facets.append(verts[k]);
+	tc->shell->facet_normals.append(norms[k]);
+    }
+}
+
+static void add_triangles (tess_copy * tc, ListOfListOfInteger * tris)
+{
+    unsigned i,sz;
+    for (i=0, sz=tris? tris->size(): 0; i<sz; i++)
+    {
+	ListOfInteger * t = tris->get(i);
+	if (t && t->size() >= 3)
+	    add_triangle (tc, t->get(0), t->get(1), t->get(2));
+    }
+}
+
+// Every other triangle in a strip is flipped to keep the winding
+static void add_strips (tess_copy * tc, ListOfListOfInteger * strips)
+{
+    unsigned i,j,sz,szz;
+    for (i=0, sz=strips? strips->size(): 0; i<sz; i++)
+    {
+	ListOfInteger * s = strips->get(i);
+	for (j=2, szz=s? s->size(): 0; j<szz; j++)
+	{
+	    if (j & 1)
+		add_triangle (tc, s->get(j-1), s->get(j-2), s->get(j));
+	    else
+		add_triangle (tc, s->get(j-2), s->get(j-1), s->get(j));
+	}
+    }
+}
+
+static void add_fans (tess_copy * tc, ListOfListOfInteger * fans)
+{
+    unsigned i,j,sz,szz;
+    for (i=0, sz=fans? fans->size(): 0; i<sz; i++)
+    {
+	ListOfInteger * f = fans->get(i);
+	for (j=2, szz=f? f->size(): 0; j<szz; j++)
+	    add_triangle (tc, f->get(0), f->get(j-1), f->get(j));
+    }
+}
+
+static double facet_area (const stp2webgl_shell * shell, unsigned i)
+{
+    const unsigned * f = shell->getFacet(i);
+    const double * a = shell->getVertex(f[0]);
+    const double * b = shell->getVertex(f[1]);
+    const double * c = shell->getVertex(f[2]);
+
+    double u[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] };
+    double v[3] = { c[0]-a[0], c[1]-a[1], c[2]-a[2] };
+    double n[3] = {
+	u[1]*v[2] - u[2]*v[1],
+	u[2]*v[0] - u[0]*v[2],
+	u[0]*v[1] - u[1]*v[0]
+    };
+    return sqrt (n[0]*n[0] + n[1]*n[1] + n[2]*n[2]) / 2.;
+}
+
+static void copy_face (
+    stp2webgl_shell * shell,
+    const tess_face * tf,
+    unsigned base
+    )
+{
+    unsigned i,sz;
+    tess_copy tc;
+
+    tc.shell = shell;
+    tc.face = tf;
+    tc.base = base;
+    tc.npoints = point_count (tf->coords);
+    copy_normals (&tc);
+
+    unsigned first = shell->getFacetCount();
+    add_triangles (&tc, tf->triangles);
+    add_strips (&tc, tf->strips);
+    add_fans (&tc, tf->fans);
+
+    unsigned count = shell->getFacetCount() - first;
+    if (!count) return;
+
+    for (i=first, sz=first+count; i<sz; i++)
+	shell->area += facet_area (shell, i);
+
+    unsigned color = stixmesh_get_color (tf->obj);
+    if (color == STIXMESH_NULL_COLOR)
+	color = shell->color;
+
+    shell->face_first.append(first);
+    shell->face_count.append(count);
+    shell->face_color.append(color);
+    shell->face_ids.append(tf->obj->entity_id());
+}
+
+
+
+//------------------------------------------------------------
+// BUILD THE SHELL -- Faces often share one coordinates list for the
+// whole shell, but may each have their own.  Sort the faces by list
+// so each list is copied once, the first time a face uses it, and
+// the vertex order follows the file.
+//------------------------------------------------------------
+
+struct tess_key {
+    stp_coordinates_list * coords;
+    unsigned face;
+};
+
+static int tess_key_cmp (const void * a, const void * b)
+{
+    const tess_key * ka = (const tess_key *) a;
+    const tess_key * kb = (const tess_key *) b;
+
+    if (ka->coords != kb->coords) return (ka->coords < kb->coords)? -1: 1;
+    if (ka->face != kb->face) return (ka->face < kb->face)? -1: 1;
+    return 0;
+}
+
+static void find_faces (
+    rose_vector * faces,
+    stp_representation_item * it
+    )
+{
+    unsigned i,sz;
+    SetOfstp_tessellated_structured_item * items = 0;
+
+    if (it->isa(ROSE_DOMAIN(stp_tessellated_solid)))
+	items = ROSE_CAST(stp_tessellated_solid,it)->items();
+    else if (it->isa(ROSE_DOMAIN(stp_tessellated_shell)))
+	items = ROSE_CAST(stp_tessellated_shell,it)->items();
+    else {
+	faces->append(it);
+	return;
+    }
+
+    for (i=0, sz=items? items->size(): 0; i<sz; i++)
+	faces->append(items->get(i));
+}
+
+// Box around every point of the coordinates lists, without copying
+// any triangles.  Returns zero if there were none.
+//
+int stp2webgl_tessellated_bbox (
+    stp_representation_item * it,
+    StixMeshBoundingBox * bbox
+    )
+{
+    unsigned i,j,sz,szz;
+    unsigned k;
+    rose_vector objs;
+    stp_coordinates_list * last = 0;
+    int found = 0;
+
+    if (!stp2webgl_is_tessellated(it)) return 0;
+    find_faces (&objs, it);
+
+    for (i=0, sz=objs.size(); i<sz; i++)
+    {
+	tess_face tf;
+	if (!get_tess_face ((RoseObject *) objs[i], &tf)) continue;
+	if (tf.coords == last) continue;
+	last = tf.coords;
+
+	ListOfListOfDouble * pts = tf.coords->position_coords();
+	for (j=0, szz=pts? pts->size(): 0; j<szz; j++)
+	{
+	    ListOfDouble * pt = pts->get(j);
+	    double xyz[3];
+	    for (k=0; k<3; k++)
+		xyz[k] = (pt && k < pt->size())? pt->get(k): 0.;
+
+	    bbox->update(xyz);
+	    found = 1;
+	}
+    }
+    return found;
+}
+
+stp2webgl_shell * stp2webgl_make_tessellated_shell (
+    stp_representation_item * it
+    )
+{
+    unsigned i,sz;
+    rose_vector objs;
+
+    if (!stp2webgl_is_tessellated(it)) return 0;
+    find_faces (&objs, it);
+
+    // keep just the triangulated faces
+    tess_face * faces = new tess_face[objs.size()+1];
+    unsigned count = 0;
+    for (i=0, sz=objs.size(); i<sz; i++) {
+	if (get_tess_face ((RoseObject *) objs[i], &faces[count]))
+	    count++;
+    }
+
+    tess_key * keys = new tess_key[count+1];
+    unsigned * lead = new unsigned[count+1];
+    unsigned * bases = new unsigned[count+1];
+
+    for (i=0; i<count; i++) {
+	keys[i].coords = faces[i].coords;
+	keys[i].face = i;
+    }
+    qsort (keys, count, sizeof(tess_key), tess_key_cmp);
+
+    // first face to use each list
+    for (i=0; i<count; i++) {
+	if (!i || keys[i].coords != keys[i-1].coords)
+	    lead[keys[i].face] = keys[i].face;
+	else
+	    lead[keys[i].face] = lead[keys[i-1].face];
+    }
+
+    stp2webgl_shell * shell = new stp2webgl_shell;
+    shell->solid = it;
+    shell->color = stixmesh_get_color (it);
+
+    for (i=0; i<count; i++)
+    {
+	if (lead[i] == i) {
+	    bases[i] = shell->getVertexCount();
+	    copy_points (shell, faces[i].coords);
+	}
+	else
+	    bases[i] = bases[lead[i]];
+
+	copy_face (shell, &faces[i], bases[i]);
+    }
+
+    delete [] faces;
+    delete [] keys;
+    delete [] lead;
+    delete [] bases;
+
+    return shell;
+}
+
+
+
+//------------------------------------------------------------
+// LINKED B-REPS -- Look through the shapes that will be written for
+// tessellations that name their B-rep.  Only shapes reached from the
+// roots count, so a tessellation that is never drawn does not hide
+// the B-rep it came from.
+//------------------------------------------------------------
+
+static int link_cmp (const void * a, const void * b)
+{
+    const void * la = *(const void **) a;
+    const void * lb = *(const void **) b;
+    return (la < lb)? -1: (la > lb)? 1: 0;
+}
+
+static void find_links (stp_representation * rep)
+{
+    unsigned i,sz;
+
+    if (!rep || rose_is_marked(rep)) return;
+    rose_mark_set(rep);
+
+    SetOfstp_representation_item * items = rep->items();
+    for (i=0, sz=items->size(); i<sz; i++)
+    {
+	stp_representation_item * it = items->get(i);
+	RoseObject * link = 0;
+
+	if (it->isa(ROSE_DOMAIN(stp_tessellated_solid)))
+	    link = ROSE_CAST(stp_tessellated_solid,it)->geometric_link();
+	else if (it->isa(ROSE_DOMAIN(stp_tessellated_shell)))
+	    link = ROSE_CAST(stp_tessellated_shell,it)->topological_link();
+
+	if (link) tess_links.append(link);
+    }
+
+    const rose_vector * ext = stp2webgl_external_shapes(rep);
+    for (i=0, sz=ext? ext->size(): 0; i<sz; i++)
+	find_links ((stp_representation *) (*ext)[i]);
+
+    StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
+    if (!rep_mgr) return;
+
+    for (i=0, sz=rep_mgr->child_rels.size(); i<sz; i++)
+	find_links (stix_get_shape_usage_child_rep (rep_mgr->child_rels[i]));
+
+    for (i=0, sz=rep_mgr->child_mapped_items.size(); i<sz; i++)
+	find_links (stix_get_shape_usage_child_rep (
+			rep_mgr->child_mapped_items[i]));
+}
+
+void stp2webgl_find_tessellations (stp2webgl_opts * opts)
+{
+    unsigned i,j,sz,szz;
+
+    rose_mark_begin();
+    for (i=0, sz=opts->root_prods.size(); i<sz; i++)
+    {
+	StixMgrAsmProduct * pd_mgr =
+	    StixMgrAsmProduct::find(opts->root_prods[i]);
+	if (!pd_mgr) continue;
+
+	for (j=0, szz=pd_mgr->shapes.size(); j<szz; j++)
+	    find_links (pd_mgr->shapes[j]);
+    }
+    rose_mark_end();
+
+    qsort (tess_links._buffer(), tess_links.size(), sizeof(void *), link_cmp);
+    if (tess_links.size())
+	stats_add("tessellated links", tess_links.size());
+}
+
+static int is_linked (RoseObject * obj)
+{
+    unsigned lo = 0;
+    unsigned hi = tess_links.size();
+
+    while (lo < hi)
+    {
+	unsigned mid = (lo + hi) / 2;
+	if ((RoseObject *) tess_links[mid] < obj) lo = mid+1;
+	else hi = mid;
+    }
+    return lo < tess_links.size() && (RoseObject *) tess_links[lo] == obj;
+}
+
+// True if the item is a B-rep that a tessellation stands in for.  A
+// shell link names the face set, which is inside the item we see.
+//
+int stp2webgl_has_tessellation (stp_representation_item * it)
+{
+    unsigned i,sz;
+
+    if (!it || !tess_links.size()) return 0;
+    if (is_linked (it)) return 1;
+
+    if (it->isa(ROSE_DOMAIN(stp_manifold_solid_brep)))
+	return is_linked (ROSE_CAST(stp_manifold_solid_brep,it)->outer());
+
+    if (it->isa(ROSE_DOMAIN(stp_shell_based_surface_model)))
+    {
+	SetOfstp_shell * shells =
+	    ROSE_CAST(stp_shell_based_surface_model,it)->sbsm_boundary();
+
+	for (i=0, sz=shells? shells->size(): 0; i<sz; i++) {
+	    if (is_linked (rose_get_nested_object(shells->get(i))))
+		return 1;
+	}
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <math.h>
+
+#include "mesh_bvh.h"
+#include "parallel.h"
+
+// find_visible_ids() -- find which triangle ids can be seen from
+// outside of a model.  Used by the -cull option to find parts that
+// are buried inside an assembly.
+//
+// The model is looked at from a number of directions spread evenly
+// over a sphere, using the golden angle spiral.  From each direction
+// a square grid of parallel rays covering the whole bounding box is
+// cast, and the id of the first triangle each ray hits is marked as
+// visible.  Anything between grid rays in every direction is missed,
+// so the grid should be fine compared to the smallest part that must
+// not be culled.
+//
+// Directions are spread over the threads, each with its own marks,
+// which are merged at the end.
+//
+
+extern void find_visible_ids (
+    const stp2webgl_bvh * bvh,
+    const StixMeshBoundingBox * bbox,
+    unsigned directions,
+    unsigned grid,
+    unsigned id_count,
+    unsigned char * visible,
+    unsigned nthreads
+    );
+
+#define GOLDEN_ANGLE	2.39996322972865332
+
+
+struct visibility_job {
+    const stp2webgl_bvh * bvh;
+    double ctr[3];
+    double radius;
+    unsigned directions;
+    unsigned grid;
+    unsigned id_count;
+    unsigned char * marks;	// id_count marks for each direction
+};
+
+
+static void normalize (double v[3])
+{
+    double len = sqrt (v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (len > 0.) {
+	v[0] /= len;  v[1] /= len;  v[2] /= len;
+    }
+}
+
+static void cast_direction (void * ctx, unsigned idx)
+{
+    visibility_job * job = (visibility_job *) ctx;
+    unsigned char * marks = job->marks + (size_t) idx * job->id_count;
+    unsigned i,j,k;
+
+    // point on the spiral, from pole to pole
+    double z = 1. - (2. * idx + 1.) / job->directions;
+    double r = sqrt (1. - z*z);
+    double a = GOLDEN_ANGLE * idx;
+    double dir[3] = { r * cos(a), r * sin(a), z };
+
+    // two axes across the view
+    double u[3], v[3];
+    double up[3] = { 0., 0., 1. };
+    if (fabs(dir[2]) > 0.9) { up[0] = 1.; up[2] = 0.; }
+
+    u[0] = up[1]*dir[2] - up[2]*dir[1];
+    u[1] = up[2]*dir[0] - up[0]*dir[2];
+    u[2] = up[0]*dir[1] - up[1]*dir[0];
+    normalize (u);
+
+    v[0] = dir[1]*u[2] - dir[2]*u[1];
+    v[1] = dir[2]*u[0] - dir[0]*u[2];
+    v[2] = dir[0]*u[1] - dir[1]*u[0];
+
+    double step = 2. * job->radius / job->grid;
+    for (i=0; i<job->grid; i++)
+    {
+	double s = (i + 0.5) * step - job->radius;
+	for (j=0; j<job->grid; j++)
+	{
+	    double t = (j + 0.5) * step - job->radius;
+	    double org[3];
+	    double dist;
+
+	    // start outside the sphere around the box, looking in
+	    for (k=0; k<3; k++)
+		org[k] = job->ctr[k] - 2. * job->radius * dir[k] +
+		    s * u[k] + t * v[k];
+
+	    unsigned id = job->bvh->intersect (org, dir, 0., &dist);
+	    if (id < job->id_count)
+		marks[id] = 1;
+	}
+    }
+}
+
+
+void find_visible_ids (
+    const stp2webgl_bvh * bvh,
+    const StixMeshBoundingBox * bbox,
+    unsigned directions,
+    unsigned grid,
+    unsigned id_count,
+    unsigned char * visible,
+    unsigned nthreads
+    )
+{
+    unsigned i,j;
+    visibility_job job;
+
+    if (!directions || !grid || bbox->isEmpty())
+	return;
+
+    job.bvh = bvh;
+    job.ctr[0] = (bbox->minx + bbox->maxx) / 2.;
+    job.ctr[1] = (bbox->miny + bbox->maxy) / 2.;
+    job.ctr[2] = (bbox->minz + bbox->maxz) / 2.;
+    job.radius = bbox->diagonal() / 2.;
+    job.directions = directions;
+    job.grid = grid;
+    job.id_count = id_count;
+    job.marks = new unsigned char[(size_t) directions * id_count + 1];
+
+    memset (job.marks, 0, (size_t) directions * id_count);
+
+    stp2webgl_parallel_for (directions, cast_direction, &job, nthreads);
+
+    for (i=0; i<directions; i++) {
+	const unsigned char * marks = job.marks + (size_t) i * id_count;
+	for (j=0; j<id_count; j++)
+	    if (marks[j]) visible[j] = 1;
+    }
+
+    delete [] job.marks;
+}
@@ -0,0 +1,373 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include "stp2webgl.h"
+#include "occurrence.h"
+#include "parallel.h"
+#include "stats.h"
+
+// stp2webgl_occurrences::build() -- walk down the shape trees of the
+// root products once and record every placement.  This is the same
+// walk the STL writers used to make for every facet pass.
+//
+// The walk itself reads the STEP data, so it runs on the calling
+// thread and only keeps the transform of each node relative to its
+// parent.  The world transforms are then filled in over the subtrees
+// under each root in parallel, each one parents first.
+//
+
+static void occ_build (
+    stp2webgl_occurrences * occ,
+    stp2webgl_opts * opts,
+    int parts
+    );
+extern const rose_vector * stp2webgl_external_shapes (
+    stp_representation * rep
+    );
+
+// subtrees smaller than this are not worth a thread
+#define OCC_PARALLEL_MIN	1024
+
+
+struct occ_product_key {
+    RoseObject * rep;
+    stp_product_definition * pd;
+};
+
+static int occ_product_cmp (const void * a, const void * b)
+{
+    const occ_product_key * ka = (const occ_product_key *) a;
+    const occ_product_key * kb = (const occ_product_key *) b;
+
+    if (ka->rep != kb->rep) return (ka->rep < kb->rep)? -1: 1;
+    return 0;
+}
+
+struct occ_builder {
+    stp2webgl_occurrences * occ;
+    occ_product_key * keys;	// shapes of each product, by address
+    unsigned key_count;
+
+    StixMtrx * locals;		// placement of each node in its parent
+    unsigned local_cap;
+    int parts;			// stop at the shapes of products
+
+    rose_uint_vector roots;	// first node of each root subtree
+};
+
+
+// Product whose shape this is, or null
+static stp_product_definition * occ_find_product (
+    const occ_builder * b,
+    RoseObject * rep
+    )
+{
+    unsigned lo = 0;
+    unsigned hi = b->key_count;
+
+    while (lo < hi)
+    {
+	unsigned mid = (lo + hi) / 2;
+	if (b->keys[mid].rep < rep) lo = mid+1;
+	else hi = mid;
+    }
+
+    if (lo < b->key_count && b->keys[lo].rep == rep)
+	return b->keys[lo].pd;
+    return 0;
+}
+
+static int occ_ptr_cmp (const void * a, const void * b)
+{
+    const void * pa = *(const void * const *) a;
+    const void * pb = *(const void * const *) b;
+
+    if (pa != pb) return (pa < pb)? -1: 1;
+    return 0;
+}
+
+// Every product under the roots, once each.  Done a level at a time
+// rather than with marks, since the caller may be using the marks.
+static void occ_collect_products (
+    rose_vector * prods,
+    const StpAsmProductDefVec &roots
+    )
+{
+    unsigned i,j,sz,szz;
+    rose_vector level;
+    rose_vector next;
+
+    for (i=0, sz=roots.size(); i<sz; i++)
+	level.append(roots[i]);
+
+    while (level.size())
+    {
+	// drop repeats and anything seen on an earlier level
+	qsort (level._buffer(), level.size(), sizeof(void*), occ_ptr_cmp);
+	qsort (prods->_buffer(), prods->size(), sizeof(void*), occ_ptr_cmp);
+
+	next.empty();
+	for (i=0, sz=level.size(); i<sz; i++)
+	{
+	    void * pd = level[i];
+	    if (!pd || (i && level[i-1] == pd)) continue;
+	    if (bsearch (&pd, prods->_buffer(), prods->size(),
+			 sizeof(void*), occ_ptr_cmp))
+		continue;
+	    next.append(pd);
+	}
+
+	level.empty();
+	for (i=0, sz=next.size(); i<sz; i++)
+	{
+	    prods->append(next[i]);
+
+	    StixMgrAsmProduct * pm = StixMgrAsmProduct::find(
+		(stp_product_definition *) next[i]
+		);
+	    for (j=0, szz=pm? pm->child_nauos.size(): 0; j<szz; j++)
+		level.append(stix_get_related_pdef(pm->child_nauos[j]));
+	}
+    }
+}
+
+
+static void occ_add_node (
+    occ_builder * b,
+    stp_representation * rep,
+    unsigned parent,
+    const StixMtrx &local
+    )
+{
+    unsigned i,sz;
+    stp2webgl_occurrences * occ = b->occ;
+
+    if (!rep) return;
+
+    // In a tree for each product, the shape of another product is
+    // the start of a component, which gets a tree of its own.
+    if (b->parts && parent != ROSE_NOTFOUND && occ_find_product (b, rep))
+	return;
+
+    unsigned node = occ->reps.size();
+    if (node == b->local_cap)
+    {
+	unsigned cap = b->local_cap? 2 * b->local_cap: 256;
+	StixMtrx * grown = new StixMtrx[cap];
+	for (i=0; i<node; i++) grown[i] = b->locals[i];
+	delete [] b->locals;
+	b->locals = grown;
+	b->local_cap = cap;
+    }
+
+    occ->reps.append(rep);
+    occ->products.append(occ_find_product (b, rep));
+    occ->parents.append(parent);
+    b->locals[node] = local;
+
+    SetOfstp_representation_item * items = rep->items();
+    for (i=0, sz=items->size(); i<sz; i++) {
+	occ->items.append(items->get(i));
+	occ->item_nodes.append(node);
+    }
+
+    // shapes from a part file sit right where this one is
+    const rose_vector * ext = stp2webgl_external_shapes(rep);
+    for (i=0, sz=ext? ext->size(): 0; i<sz; i++)
+	occ_add_node (b, (stp_representation *) (*ext)[i], node, StixMtrx());
+
+    StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
+    if (!rep_mgr) return;
+
+    for (i=0, sz=rep_mgr->child_rels.size(); i<sz; i++)
+    {
+	stp_shape_representation_relationship * rel = rep_mgr->child_rels[i];
+	occ_add_node (b, stix_get_shape_usage_child_rep (rel), node,
+		      stix_get_shape_usage_xform (rel));
+    }
+
+    for (i=0, sz=rep_mgr->child_mapped_items.size(); i<sz; i++)
+    {
+	stp_mapped_item * rel = rep_mgr->child_mapped_items[i];
+	occ_add_node (b, stix_get_shape_usage_child_rep (rel), node,
+		      stix_get_shape_usage_xform (rel));
+    }
+}
+
+
+static void occ_world_fn (void * ctx, unsigned idx)
+{
+    occ_builder * b = (occ_builder *) ctx;
+    stp2webgl_occurrences * occ = b->occ;
+    unsigned i;
+
+    unsigned first = b->roots[idx];
+    unsigned end = (idx+1 < b->roots.size())?
+	b->roots[idx+1]: occ->node_count;
+
+    for (i=first; i<end; i++)
+    {
+	unsigned parent = occ->parents[i];
+	if (parent == ROSE_NOTFOUND)
+	    occ->xforms[i] = b->locals[i];
+	else
+	    occ->xforms[i] = b->locals[i] * occ->xforms[parent];
+    }
+}
+
+
+stp2webgl_occurrences::stp2webgl_occurrences()
+    : xforms(0), node_count(0)
+{
+}
+
+stp2webgl_occurrences::~stp2webgl_occurrences()
+{
+    delete [] xforms;
+}
+
+
+void stp2webgl_occurrences::build (stp2webgl_opts * opts)
+{
+    occ_build (this, opts, 0);
+}
+
+void stp2webgl_occurrences::buildParts (stp2webgl_opts * opts)
+{
+    occ_build (this, opts, 1);
+}
+
+
+static void occ_build (
+    stp2webgl_occurrences * occ,
+    stp2webgl_opts * opts,
+    int parts
+    )
+{
+    unsigned i,j,sz,szz;
+    double start = stats_time();
+    occ_builder b;
+    rose_vector prods;
+
+    b.occ = occ;
+    b.locals = 0;
+    b.local_cap = 0;
+    b.parts = parts;
+
+    // which product each shape belongs to
+    occ_collect_products (&prods, opts->root_prods);
+
+    rose_vector key_reps;
+    rose_vector key_prods;
+    for (i=0, sz=prods.size(); i<sz; i++)
+    {
+	StixMgrAsmProduct * pm = StixMgrAsmProduct::find(
+	    (stp_product_definition *) prods[i]
+	    );
+	for (j=0, szz=pm? pm->shapes.size(): 0; j<szz; j++) {
+	    key_reps.append(pm->shapes[j]);
+	    key_prods.append(prods[i]);
+	}
+    }
+
+    b.key_count = key_reps.size();
+    b.keys = new occ_product_key[b.key_count+1];
+    for (i=0; i<b.key_count; i++) {
+	b.keys[i].rep = (RoseObject *) key_reps[i];
+	b.keys[i].pd = (stp_product_definition *) key_prods[i];
+    }
+    qsort (b.keys, b.key_count, sizeof(occ_product_key), occ_product_cmp);
+
+    // The root placement is usually the identity matrix but some
+    // systems put a standalone AP3D at the top to place the whole
+    // thing in the global space.  Each product tree is in the space
+    // of that product.
+    const StpAsmProductDefVec &roots = opts->root_prods;
+    sz = parts? prods.size(): roots.size();
+    for (i=0; i<sz; i++)
+    {
+	stp_product_definition * pd = parts?
+	    (stp_product_definition *) prods[i]: roots[i];
+
+	StixMgrAsmProduct * pm = StixMgrAsmProduct::find(pd);
+	for (j=0, szz=pm? pm->shapes.size(): 0; j<szz; j++)
+	{
+	    StixMtrx root_placement;
+	    unsigned first = occ->reps.size();
+
+	    occ_add_node (&b, pm->shapes[j], ROSE_NOTFOUND, root_placement);
+	    if (occ->reps.size() > first) {
+		if (parts) occ->products.put(pd, first);
+		b.roots.append(first);
+	    }
+	}
+    }
+
+    unsigned node_count = occ->node_count = occ->reps.size();
+    delete [] occ->xforms;
+    StixMtrx * xforms = occ->xforms = new StixMtrx[node_count+1];
+
+    // Split big root subtrees at their children, which are just as
+    // independent once the root itself is placed.
+    rose_uint_vector big;
+    for (i=0, sz=b.roots.size(); i<sz; i++)
+    {
+	unsigned first = b.roots[i];
+	unsigned end = (i+1 < sz)? b.roots[i+1]: node_count;
+
+	big.append(first);
+	if (end - first < 2 * OCC_PARALLEL_MIN)
+	    continue;
+
+	xforms[first] = b.locals[first];
+	big[big.size()-1] = first+1;
+	for (j=first+2; j<end; j++) {
+	    if (occ->parents[j] == first) big.append(j);
+	}
+    }
+    b.roots.empty();
+    for (i=0, sz=big.size(); i<sz; i++)
+	b.roots.append(big[i]);
+
+    stp2webgl_parallel_for (b.roots.size(), occ_world_fn, &b, opts->threads);
+
+    delete [] b.locals;
+    delete [] b.keys;
+
+    stats_add("occurrence nodes", node_count);
+    stats_add("occurrence items", occ->items.size());
+    stats_add("occurrence seconds", stats_time() - start);
+}
+
+
+stp_product_definition * stp2webgl_occurrences::getProduct (
+    unsigned node
+    ) const
+{
+    while (node != ROSE_NOTFOUND)
+    {
+	if (products[node])
+	    return (stp_product_definition *) products[node];
+	node = parents[node];
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Flattened placements of everything in an assembly, built once and
+// shared by the writers.  The shape tree under each root product is
+// expanded so that a shape used in several places has a node for
+// each one, in the same depth first order as the old recursive
+// writers: a shape, then any shapes from a part file (-extref), then
+// its child relationships, then its mapped items.  Parents always
+// come before their children.
+//
+// Each node has the transform of the shape into world space.  The
+// items of each shape are listed once for every node of that shape,
+// so a writer only needs one pass down the item arrays.
+//
+// A node that starts the shape of a product records the product, so
+// the product path of any node can be found by following the parent
+// links.
+//
+
+class stp2webgl_occurrences {
+public:
+    // shape nodes
+    rose_vector reps;			// stp_representation
+    rose_vector products;		// product starting here, or null
+    rose_uint_vector parents;		// ROSE_NOTFOUND for a root
+    StixMtrx * xforms;			// shape into world space
+    unsigned node_count;
+
+    // representation items, once for each node of their shape
+    rose_vector items;			// stp_representation_item
+    rose_uint_vector item_nodes;	// node holding the item
+
+    stp2webgl_occurrences();
+    ~stp2webgl_occurrences();
+
+    // Expand the shape trees of the root products.  Only the world
+    // transforms are computed in parallel, since threads must not
+    // touch the STEP data.
+    void build (stp2webgl_opts * opts);
+
+    // Same as above, but with a tree for every product under the
+    // roots rather than one for each root.  Each tree is in the space
+    // of its product and stops at the shapes of components, so it
+    // has only the geometry of that product.  The root of each tree
+    // records its product.
+    void buildParts (stp2webgl_opts * opts);
+
+    unsigned size() const { return items.size(); }
+
+    stp_representation_item * item (unsigned i) const {
+	return (stp_representation_item *) items[i];
+    }
+    const StixMtrx &xform (unsigned i) const {
+	return xforms[item_nodes[i]];
+    }
+
+    // nearest product at or above a node, or null
+    stp_product_definition * getProduct (unsigned node) const;
+
+private:
+    stp2webgl_occurrences (const stp2webgl_occurrences &);
+    stp2webgl_occurrences & operator= (const stp2webgl_occurrences &);
+};
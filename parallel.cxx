@@ -0,0 +1,204 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "parallel.h"
+
+// Keep this many jobs in flight per thread before submit() blocks.
+#define MAX_PENDING_PER_THREAD	4
+
+
+unsigned stp2webgl_thread_count (unsigned requested)
+{
+    if (requested) return requested;
+
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw? hw: 1;
+}
+
+
+struct stp2webgl_job {
+    stp2webgl_job_fn fn;
+    void * ctx;
+};
+
+struct stp2webgl_workers_impl {
+    std::mutex lock;
+    std::condition_variable have_work;
+    std::condition_variable have_room;
+    std::condition_variable all_done;
+
+    std::deque<stp2webgl_job> queue;
+    std::vector<std::thread> threads;
+
+    unsigned active;
+    unsigned max_pending;
+    bool shutdown;
+
+    void run();
+};
+
+
+void stp2webgl_workers_impl::run()
+{
+    for (;;)
+    {
+	stp2webgl_job job;
+	{
+	    std::unique_lock<std::mutex> guard(lock);
+	    while (!shutdown && queue.empty())
+		have_work.wait(guard);
+
+	    if (queue.empty())
+		return;
+
+	    job = queue.front();
+	    queue.pop_front();
+	    active++;
+	    have_room.notify_one();
+	}
+
+	job.fn (job.ctx);
+
+	{
+	    std::unique_lock<std::mutex> guard(lock);
+	    active--;
+	    if (!active && queue.empty())
+		all_done.notify_all();
+	}
+    }
+}
+
+
+stp2webgl_workers::stp2webgl_workers (unsigned nthreads)
+{
+    unsigned i;
+
+    nthreads = stp2webgl_thread_count(nthreads);
+
+    impl = new stp2webgl_workers_impl;
+    impl->active = 0;
+    impl->shutdown = false;
+    impl->max_pending = nthreads * MAX_PENDING_PER_THREAD;
+
+    for (i=0; i<nthreads; i++)
+	impl->threads.push_back(
+	    std::thread(&stp2webgl_workers_impl::run, impl)
+	    );
+}
+
+stp2webgl_workers::~stp2webgl_workers()
+{
+    unsigned i;
+    {
+	std::unique_lock<std::mutex> guard(impl->lock);
+	impl->shutdown = true;
+	impl->have_work.notify_all();
+    }
+
+    for (i=0; i<impl->threads.size(); i++)
+	impl->threads[i].join();
+
+    delete impl;
+}
+
+void stp2webgl_workers::submit (stp2webgl_job_fn fn, void * ctx)
+{
+    std::unique_lock<std::mutex> guard(impl->lock);
+    while (impl->queue.size() >= impl->max_pending)
+	impl->have_room.wait(guard);
+
+    stp2webgl_job job;
+    job.fn = fn;
+    job.ctx = ctx;
+    impl->queue.push_back(job);
+    impl->have_work.notify_one();
+}
+
+void stp2webgl_workers::wait()
+{
+    std::unique_lock<std::mutex> guard(impl->lock);
+    while (impl->active || !impl->queue.empty())
+	impl->all_done.wait(guard);
+}
+
+unsigned stp2webgl_workers::size() const
+{
+    return (unsigned) impl->threads.size();
+}
+
+
+
+//======================================================================
+// Parallel loop -- threads pull indices from a shared counter, so
+// uneven amounts of work per index still balance out.
+//
+
+struct parallel_for_ctx {
+    std::atomic<unsigned> next;
+    unsigned count;
+    void (*fn) (void * ctx, unsigned idx);
+    void * ctx;
+};
+
+static void parallel_for_run (parallel_for_ctx * pf)
+{
+    unsigned idx;
+    while ((idx = pf->next++) < pf->count)
+	pf->fn (pf->ctx, idx);
+}
+
+void stp2webgl_parallel_for (
+    unsigned count,
+    void (*fn) (void * ctx, unsigned idx),
+    void * ctx,
+    unsigned nthreads
+    )
+{
+    unsigned i;
+    parallel_for_ctx pf;
+
+    pf.next = 0;
+    pf.count = count;
+    pf.fn = fn;
+    pf.ctx = ctx;
+
+    nthreads = stp2webgl_thread_count(nthreads);
+    if (nthreads > count) nthreads = count;
+
+    // run small loops on the calling thread
+    if (nthreads < 2) {
+	parallel_for_run (&pf);
+	return;
+    }
+
+    std::vector<std::thread> threads;
+    for (i=1; i<nthreads; i++)
+	threads.push_back(std::thread(parallel_for_run, &pf));
+
+    parallel_for_run (&pf);
+
+    for (i=0; i<threads.size(); i++)
+	threads[i].join();
+}
@@ -0,0 +1,67 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Worker threads for the output stages.  The mesher has its own
+// thread pool, these are used to encode and write the results while
+// the main thread keeps collecting meshes, and to read ahead part
+// files while the main thread parses (-extref option).
+//
+// Jobs are plain function pointers with a context argument.  The job
+// owns the context and must release it when done.  Jobs must not
+// touch the STEP data, only the mesh data or files handed to them.
+//
+
+typedef void (*stp2webgl_job_fn) (void * ctx);
+
+class stp2webgl_workers {
+    struct stp2webgl_workers_impl * impl;
+
+public:
+    // zero threads means use one per processor
+    stp2webgl_workers (unsigned nthreads = 0);
+
+    // waits for all submitted jobs to finish
+    ~stp2webgl_workers();
+
+    // Queue a job.  Blocks if too many jobs are already pending so
+    // that finished meshes do not pile up in memory.
+    void submit (stp2webgl_job_fn fn, void * ctx);
+
+    // wait until every submitted job has finished
+    void wait();
+
+    unsigned size() const;
+
+private:
+    stp2webgl_workers (const stp2webgl_workers &);
+    stp2webgl_workers & operator= (const stp2webgl_workers &);
+};
+
+
+// Call fn(ctx,i) for each i in [0,count) spread over the given
+// number of threads, returning when all calls are done.
+//
+extern void stp2webgl_parallel_for (
+    unsigned count,
+    void (*fn) (void * ctx, unsigned idx),
+    void * ctx,
+    unsigned nthreads = 0
+    );
+
+// number of threads to use for a request, zero means all processors
+extern unsigned stp2webgl_thread_count (unsigned requested);
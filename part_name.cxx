@@ -0,0 +1,149 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "stp2webgl.h"
+#include "occurrence.h"
+
+// stp2webgl_part_name() -- name used for the files of a product when
+// splitting an assembly.  This is "part_" and the product name, with
+// whitespace and other non filesystem safe characters changed to
+// underscores.  The caller adds the extension.
+//
+// stp2webgl_part_runs() -- split the items of a table made by
+// buildParts() into a run for each product, and pick a file name for
+// each.  Returns the names, which the caller deletes, with the number
+// of products in count.  The first item of each run is in firsts,
+// followed by the end of the last run.
+//
+
+extern void stp2webgl_part_name (
+    RoseStringObject * name,
+    stp_product_definition * pd
+    );
+extern RoseStringObject * stp2webgl_part_runs (
+    const stp2webgl_occurrences * parts,
+    unsigned * count,
+    rose_uint_vector * firsts
+    );
+
+
+void stp2webgl_part_name (
+    RoseStringObject * name,
+    stp_product_definition * pd
+    )
+{
+    *name = "part";
+
+    stp_product_definition_formation * pdf = pd-> formation();
+    stp_product * p = pdf? pdf-> of_product(): 0;
+
+    char * pname = p? p-> name(): 0;
+    if (!pname || !*pname) pname = (char *) "none";
+	
+    if (!name->is_empty()) *name += "_";
+    *name += pname;
+
+    // change whitespace and other non filesystem safe
+    // characters to underscores
+    //
+    char * c = *name;
+    while (*c) { 
+	if (isspace(*c)) *c = '_'; 
+	if (*c == '?')   *c = '_'; 
+	if (*c == '/')   *c = '_'; 
+	if (*c == '\\')  *c = '_'; 
+	if (*c == ':')   *c = '_'; 
+	if (*c == '"')   *c = '_'; 
+	if (*c == '\'')  *c = '_'; 
+	c++; 
+    }
+}
+
+
+struct part_key {
+    const char * name;
+    unsigned idx;
+};
+
+static int part_cmp (const void * a, const void * b)
+{
+    const part_key * ka = (const part_key *) a;
+    const part_key * kb = (const part_key *) b;
+
+    int cmp = strcmp (ka->name, kb->name);
+    if (cmp) return cmp;
+    if (ka->idx != kb->idx) return (ka->idx < kb->idx)? -1: 1;
+    return 0;
+}
+
+
+RoseStringObject * stp2webgl_part_runs (
+    const stp2webgl_occurrences * parts,
+    unsigned * count,
+    rose_uint_vector * firsts
+    )
+{
+    unsigned i,sz;
+
+    // The trees of a product are next to each other in the table, so
+    // its items are one run of the item array.
+    rose_vector prods;
+    for (i=0, sz=parts->size(); i<sz; i++)
+    {
+	stp_product_definition * pd = parts->getProduct(parts->item_nodes[i]);
+	if (!prods.size() || prods[prods.size()-1] != pd) {
+	    prods.append(pd);
+	    firsts->append(i);
+	}
+    }
+    firsts->append(parts->size());
+
+    // Products may share a name, so all but the first of each name
+    // get the entity id as well.
+    *count = prods.size();
+    RoseStringObject * names = new RoseStringObject[*count+1];
+    part_key * keys = new part_key[*count+1];
+
+    for (i=0; i<*count; i++) {
+	stp2webgl_part_name (names+i, (stp_product_definition *) prods[i]);
+	keys[i].name = names[i];
+	keys[i].idx = i;
+    }
+    qsort (keys, *count, sizeof(part_key), part_cmp);
+
+    rose_uint_vector dups;
+    for (i=1; i<*count; i++) {
+	if (!strcmp (keys[i].name, keys[i-1].name))
+	    dups.append(keys[i].idx);
+    }
+    for (i=0, sz=dups.size(); i<sz; i++) {
+	char id[32];
+	stp_product_definition * pd = (stp_product_definition *) prods[dups[i]];
+	sprintf (id, "_%lu", pd->entity_id());
+	names[dups[i]] += id;
+    }
+    delete [] keys;
+    return names;
+}
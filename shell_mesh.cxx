@@ -0,0 +1,215 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+
+#include <math.h>
+
+#include "shell_mesh.h"
+
+
+void stp2webgl_shell::getBoundingBox (StixMeshBoundingBox * bbox) const
+{
+    unsigned i,sz;
+    for (i=0, sz=getVertexCount(); i<sz; i++)
+	bbox->update(getVertex(i));
+}
+
+
+void stp2webgl_shell::getFacetNormal (double n[3], unsigned i) const
+{
+    const unsigned * f = getFacet(i);
+    const double * a = getVertex(f[0]);
+    const double * b = getVertex(f[1]);
+    const double * c = getVertex(f[2]);
+
+    double u[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] };
+    double v[3] = { c[0]-a[0], c[1]-a[1], c[2]-a[2] };
+
+    n[0] = u[1]*v[2] - u[2]*v[1];
+    n[1] = u[2]*v[0] - u[0]*v[2];
+    n[2] = u[0]*v[1] - u[1]*v[0];
+
+    double len = sqrt (n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    if (len > 0.) {
+	n[0] /= len;  n[1] /= len;  n[2] /= len;
+    }
+}
+
+
+// Normals in the mesher facet set are shared through an index table
+// that may hold entries that no facet uses.  Copy over only the ones
+// that are referenced, remapping the indices as we go.
+//
+static unsigned copy_normal (
+    stp2webgl_shell * shell,
+    rose_uint_vector &remap,
+    const StixMeshFacetSet * fs,
+    unsigned idx
+    )
+{
+    if (idx == ROSE_NOTFOUND) return ROSE_NOTFOUND;
+
+    const double * n = fs->getNormal(idx);
+    if (!n) return ROSE_NOTFOUND;
+
+    while (remap.size() <= idx) remap.append(ROSE_NOTFOUND);
+    if (remap[idx] == ROSE_NOTFOUND)
+    {
+	remap[idx] = shell->getNormalCount();
+	shell->normals.append(n[0]);
+	shell->normals.append(n[1]);
+	shell->normals.append(n[2]);
+    }
+    return remap[idx];
+}
+
+
+stp2webgl_shell * stp2webgl_make_shell (const StixMeshStp * mesh)
+{
+    unsigned i,sz;
+    unsigned j,szz;
+    unsigned k;
+
+    if (!mesh) return 0;
+
+    const StixMeshFacetSet * fs = mesh->getFacetSet();
+    stp2webgl_shell * shell = new stp2webgl_shell;
+    rose_uint_vector remap;
+
+    shell->solid = mesh->getStepSolid();
+    shell->color = stixmesh_get_color (shell->solid);
+
+    for (i=0, sz=fs->getVertexCount(); i<sz; i++)
+    {
+	const double * pt = fs->getVertex(i);
+	shell->verts.append(pt[0]);
+	shell->verts.append(pt[1]);
+	shell->verts.append(pt[2]);
+    }
+
+    // Copy the facets grouped by step face, same as the XML writer
+    for (i=0, sz=mesh->getFaceCount(); i<sz; i++)
+    {
+	const StixMeshStpFace * fi = mesh->getFaceInfo(i);
+	unsigned first = fi->getFirstFacet();
+	shell->area += fi->getArea();
+
+	if (first == ROSE_NOTFOUND)
+	    continue;
+
+	unsigned color = stixmesh_get_color(fi->getFace());
+	if (color == STIXMESH_NULL_COLOR)
+	    color = shell->color;
+
+	shell->face_first.append(shell->getFacetCount());
+	shell->face_count.append(fi->getFacetCount());
+	shell->face_color.append(color);
+	shell->face_ids.append(fi->getFace()? fi->getFace()->entity_id(): 0);
+
+	for (j=0, szz=fi->getFacetCount(); j<szz; j++)
+	{
+	    const StixMeshFacet * f = fs->getFacet(j+first);
+	    for (k=0; k<3; k++)
+		shell->facets.append(f->verts[k]);
+
+	    for (k=0; k<3; k++) {
+// facet_normal_now_computed_in_latest_versions
+#ifdef LATEST_STDEV
+		unsigned nidx = f->normals[k];
+#else
+		unsigned nidx = f->vert_normals[k];
+#endif
+		shell->facet_normals.append(
+		    copy_normal (shell, remap, fs, nidx)
+		    );
+	    }
+	}
+    }
+
+    return shell;
+}
+
+
+// Each side of the box gets its own four corners so that the normals
+// stay flat.  Corners are numbered by bits, x=1 y=2 z=4 for the max
+// side, and each side lists them counterclockwise seen from outside.
+//
+static const unsigned box_sides[6][4] = {
+    { 0, 4, 6, 2 },	// -x
+    { 1, 3, 7, 5 },	// +x
+    { 0, 1, 5, 4 },	// -y
+    { 2, 6, 7, 3 },	// +y
+    { 0, 2, 3, 1 },	// -z
+    { 4, 5, 7, 6 }	// +z
+};
+
+stp2webgl_shell * stp2webgl_make_box_shell (
+    stp_representation_item * solid,
+    const StixMeshBoundingBox * bbox
+    )
+{
+    unsigned i,k;
+
+    if (!bbox || bbox->isEmpty()) return 0;
+
+    stp2webgl_shell * shell = new stp2webgl_shell;
+    shell->solid = solid;
+    shell->color = stixmesh_get_color (solid);
+    shell->fallback = 1;
+
+    double lo[3] = { bbox->minx, bbox->miny, bbox->minz };
+    double hi[3] = { bbox->maxx, bbox->maxy, bbox->maxz };
+    double ext[3] = { hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2] };
+
+    shell->face_first.append(0);
+    shell->face_count.append(12);
+    shell->face_color.append(shell->color);
+    shell->face_ids.append(0);
+
+    for (i=0; i<6; i++)
+    {
+	unsigned base = shell->getVertexCount();
+	unsigned axis = i / 2;
+
+	for (k=0; k<4; k++) {
+	    unsigned c = box_sides[i][k];
+	    shell->verts.append((c & 1)? hi[0]: lo[0]);
+	    shell->verts.append((c & 2)? hi[1]: lo[1]);
+	    shell->verts.append((c & 4)? hi[2]: lo[2]);
+	}
+
+	for (k=0; k<3; k++)
+	    shell->normals.append((k != axis)? 0.: (i & 1)? 1.: -1.);
+
+	shell->facets.append(base);
+	shell->facets.append(base+1);
+	shell->facets.append(base+2);
+	shell->facets.append(base);
+	shell->facets.append(base+2);
+	shell->facets.append(base+3);
+	for (k=0; k<6; k++)
+	    shell->facet_normals.append(i);
+
+	shell->area += ext[(axis+1)%3] * ext[(axis+2)%3];
+    }
+
+    return shell;
+}
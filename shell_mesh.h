@@ -0,0 +1,92 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Indexed copy of the facets for one shell.  The mesher facet sets
+// are read-only, so the output stages that need to re-encode or
+// rearrange the triangles work on this simple flattened form.
+//
+// Facets are stored in STEP face order, and each face group records
+// the range of facets that came from that face along with the color
+// to draw it with (already defaulted to the shell color).
+//
+
+class stp2webgl_shell {
+public:
+    stp_representation_item * solid;
+    unsigned color;
+
+    rose_real_vector verts;		// x y z for each vertex
+    rose_real_vector normals;		// x y z for each normal
+    rose_uint_vector facets;		// three vertex indices per facet
+    rose_uint_vector facet_normals;	// three normal indices per facet
+
+    rose_uint_vector face_first;	// first facet of each face group
+    rose_uint_vector face_count;	// number of facets in the group
+    rose_uint_vector face_color;	// color or STIXMESH_NULL_COLOR
+    rose_uint_vector face_ids;		// entity id of the STEP face
+
+    double area;
+
+    // nonzero for a stand in box when the solid could not be faceted
+    int fallback;
+
+    // nonzero when the solid can not be seen from outside the model
+    int hidden;
+
+    stp2webgl_shell()
+	: solid(0), color(STIXMESH_NULL_COLOR), area(0.),
+	  fallback(0), hidden(0) {}
+
+    unsigned getVertexCount() const	{ return verts.size() / 3; }
+    unsigned getNormalCount() const	{ return normals.size() / 3; }
+    unsigned getFacetCount() const	{ return facets.size() / 3; }
+    unsigned getFaceCount() const	{ return face_first.size(); }
+
+    const double * getVertex (unsigned i) const {
+	return verts._buffer() + 3*i;
+    }
+    const double * getNormal (unsigned i) const {
+	return (i == ROSE_NOTFOUND)? 0: normals._buffer() + 3*i;
+    }
+    const unsigned * getFacet (unsigned i) const {
+	return facets._buffer() + 3*i;
+    }
+    const unsigned * getFacetNormals (unsigned i) const {
+	return facet_normals._buffer() + 3*i;
+    }
+
+    void getBoundingBox (StixMeshBoundingBox * bbox) const;
+
+    // unit normal computed from the facet vertices
+    void getFacetNormal (double n[3], unsigned i) const;
+};
+
+
+extern stp2webgl_shell * stp2webgl_make_shell (const StixMeshStp * mesh);
+
+// Twelve facet box standing in for a solid, or null if the box is empty
+extern stp2webgl_shell * stp2webgl_make_box_shell (
+    stp_representation_item * solid,
+    const StixMeshBoundingBox * bbox
+    );
+
+// Copy of the triangles already in the file for an AP242 tessellated
+// solid, shell, or surface set, or null if the item is not one
+extern stp2webgl_shell * stp2webgl_make_tessellated_shell (
+    stp_representation_item * it
+    );
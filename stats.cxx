@@ -0,0 +1,92 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+
+#include "stats.h"
+
+#define MAX_STATS	128
+
+struct stat_counter {
+    const char * name;
+    double val;
+};
+
+static stat_counter counters[MAX_STATS];
+static unsigned counter_count = 0;
+static std::mutex counter_lock;
+
+
+// Names are expected to be string constants, so we just keep the
+// pointer.  Must be called with the lock held.
+//
+static stat_counter * find_counter (const char * name, int create = 1)
+{
+    unsigned i;
+    for (i=0; i<counter_count; i++) {
+	if (!strcmp (counters[i].name, name))
+	    return &counters[i];
+    }
+
+    if (!create || counter_count == MAX_STATS)
+	return 0;
+
+    counters[counter_count].name = name;
+    counters[counter_count].val = 0.;
+    return &counters[counter_count++];
+}
+
+void stats_add (const char * name, double val)
+{
+    std::lock_guard<std::mutex> guard(counter_lock);
+    stat_counter * c = find_counter(name);
+    if (c) c->val += val;
+}
+
+void stats_max (const char * name, double val)
+{
+    std::lock_guard<std::mutex> guard(counter_lock);
+    stat_counter * c = find_counter(name);
+    if (c && val > c->val) c->val = val;
+}
+
+double stats_get (const char * name)
+{
+    std::lock_guard<std::mutex> guard(counter_lock);
+    stat_counter * c = find_counter(name, 0);
+    return c? c->val: 0.;
+}
+
+void stats_print (FILE * out)
+{
+    unsigned i;
+    std::lock_guard<std::mutex> guard(counter_lock);
+
+    for (i=0; i<counter_count; i++)
+	fprintf (out, "%-32s %.6g\n", counters[i].name, counters[i].val);
+}
+
+double stats_time()
+{
+    return std::chrono::duration<double>(
+	std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
@@ -0,0 +1,31 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Named counters reported by the -stats option.  Any stage can add
+// to a counter, from any thread.  Counters are printed in the order
+// that they were first used.
+//
+
+extern void stats_add (const char * name, double val);
+extern void stats_max (const char * name, double val);
+extern double stats_get (const char * name);
+
+extern void stats_print (FILE * out);
+
+// wall clock seconds, only useful for differences
+extern double stats_time();
@@ -0,0 +1,454 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <string.h>
+#include <atomic>
+
+#include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "occurrence.h"
+#include "bin_buffer.h"
+#include "stl_emit.h"
+#include "parallel.h"
+#include "stats.h"
+
+extern void facet_all_products (stp2webgl_opts * opts);
+extern const stp2webgl_shell * find_fallback_shell (
+    stp_representation_item * solid
+    );
+extern RoseStringObject * stp2webgl_part_runs (
+    const stp2webgl_occurrences * parts,
+    unsigned * count,
+    rose_uint_vector * firsts
+    );
+
+// Facets in one chunk, and chunks given to each thread at a time.
+// Only one round of chunks is held in memory, which keeps ASCII
+// output of a very large model from filling up memory.
+#define STL_CHUNK_FACETS	8192
+#define STL_CHUNKS_PER_THREAD	4
+
+// bytes a part file builds up before writing
+#define STL_PART_FLUSH		(1<<20)
+
+
+// Items in [first,end) of the table that have facets, appended
+static void collect_items (
+    const stp2webgl_occurrences * occs,
+    unsigned first,
+    unsigned end,
+    stp2webgl_stl_item * items,
+    unsigned * count,
+    unsigned long * facets
+    )
+{
+    unsigned i;
+
+    for (i=first; i<end; i++)
+    {
+	stp_representation_item * it = occs->item(i);
+	stp2webgl_stl_item * out = items + *count;
+
+	// In an assembly, some items just place subcomponents.  If
+	// there are solids, we should have previously generated meshes.
+	StixMeshStp * mesh = stixmesh_cache_find (it);
+	out->fs = mesh? mesh->getFacetSet(): 0;
+	out->box = mesh? 0: find_fallback_shell (it);
+	out->xform = &occs->xform(i);
+
+	if (out->fs) out->facets = out->fs->getFacetCount();
+	else if (out->box) out->facets = out->box->getFacetCount();
+	else continue;
+
+	if (!out->facets) continue;
+	*facets += out->facets;
+	(*count)++;
+    }
+}
+
+stp2webgl_stl_item * stp2webgl_stl_items (
+    const stp2webgl_occurrences * occs,
+    unsigned * count,
+    unsigned long * facets
+    )
+{
+    stp2webgl_stl_item * items = new stp2webgl_stl_item[occs->size()+1];
+
+    *count = 0;
+    *facets = 0;
+    collect_items (occs, 0, occs->size(), items, count, facets);
+    return items;
+}
+
+
+struct stl_chunk {
+    unsigned item;		// where the chunk starts
+    unsigned first;
+    unsigned facets;		// may run over several items
+    unsigned long offset;	// facets in the chunks before this one
+    int bad;			// not formatted at the record size
+};
+
+struct stl_round {
+    const stp2webgl_stl_item * items;
+    stp2webgl_stl_fn fn;
+    stl_chunk * chunks;
+    stp2webgl_buffer * bufs;	// one per chunk when streaming, or
+    unsigned char * dst;	// fixed size records written in place
+    unsigned record;
+};
+
+
+// Cut up to max chunks starting at the given item and facet, moving
+// both past the chunks.  Returns the number of chunks.
+static unsigned cut_chunks (
+    stl_chunk * chunks,
+    unsigned max,
+    const stp2webgl_stl_item * items,
+    unsigned count,
+    unsigned * item,
+    unsigned * first,
+    unsigned long * offset
+    )
+{
+    unsigned num = 0;
+    while (num < max && *item < count)
+    {
+	stl_chunk * c = chunks + num++;
+	c->item = *item;
+	c->first = *first;
+	c->facets = 0;
+	c->offset = *offset;
+	c->bad = 0;
+
+	while (*item < count && c->facets < STL_CHUNK_FACETS)
+	{
+	    unsigned take = items[*item].facets - *first;
+	    if (take > STL_CHUNK_FACETS - c->facets)
+		take = STL_CHUNK_FACETS - c->facets;
+
+	    c->facets += take;
+	    *first += take;
+	    if (*first == items[*item].facets) {
+		(*item)++;
+		*first = 0;
+	    }
+	}
+	*offset += c->facets;
+    }
+    return num;
+}
+
+
+static void format_chunk (
+    stl_round * rnd,
+    stl_chunk * c,
+    stp2webgl_buffer * buf
+    )
+{
+    unsigned item = c->item;
+    unsigned first = c->first;
+    unsigned left = c->facets;
+
+    buf->reset();
+    while (left)
+    {
+	const stp2webgl_stl_item * it = rnd->items + item;
+	unsigned num = it->facets - first;
+	if (num > left) num = left;
+
+	rnd->fn (buf, it, first, num);
+	left -= num;
+	first = 0;
+	item++;
+    }
+}
+
+static void format_chunk_fn (void * ctx, unsigned idx)
+{
+    stl_round * rnd = (stl_round *) ctx;
+    format_chunk (rnd, rnd->chunks + idx, rnd->bufs + idx);
+}
+
+static void place_chunk_fn (void * ctx, unsigned idx)
+{
+    stl_round * rnd = (stl_round *) ctx;
+    stl_chunk * c = rnd->chunks + idx;
+    stp2webgl_buffer buf;
+
+    // Formatted in a small buffer that stays in cache, then copied
+    // to its place in the file.  A chunk that does not come out at
+    // the record size would shift everything after it.
+    format_chunk (rnd, c, &buf);
+    if (buf.size() != (size_t) c->facets * rnd->record) {
+	c->bad = 1;
+	return;
+    }
+    memcpy (rnd->dst + (size_t) c->offset * rnd->record,
+	    buf.data(), buf.size());
+}
+
+
+int stp2webgl_emit_stl (
+    stp2webgl_opts * opts,
+    FILE * fd,
+    const stp2webgl_stl_item * items,
+    unsigned count,
+    stp2webgl_stl_fn fn
+    )
+{
+    unsigned i;
+    int err = 0;
+    double start = stats_time();
+
+    unsigned nthreads = stp2webgl_thread_count(opts->threads);
+    unsigned max_chunks = nthreads * STL_CHUNKS_PER_THREAD;
+
+    stl_round rnd;
+    rnd.items = items;
+    rnd.fn = fn;
+    rnd.chunks = new stl_chunk[max_chunks];
+    rnd.bufs = new stp2webgl_buffer[max_chunks];
+    rnd.dst = 0;
+    rnd.record = 0;
+
+    unsigned item = 0;
+    unsigned first = 0;
+    unsigned long offset = 0;
+    while (item < count && !err)
+    {
+	unsigned num = cut_chunks (
+	    rnd.chunks, max_chunks, items, count, &item, &first, &offset
+	    );
+
+	stp2webgl_parallel_for (num, format_chunk_fn, &rnd, nthreads);
+
+	for (i=0; i<num && !err; i++)
+	    err = rnd.bufs[i].write(fd);
+    }
+
+    delete [] rnd.bufs;
+    delete [] rnd.chunks;
+    stats_add("stl emit seconds", stats_time() - start);
+    return err;
+}
+
+
+int stp2webgl_emit_stl_fixed (
+    stp2webgl_opts * opts,
+    unsigned char * dst,
+    unsigned record,
+    const stp2webgl_stl_item * items,
+    unsigned count,
+    stp2webgl_stl_fn fn
+    )
+{
+    unsigned i;
+    double start = stats_time();
+
+    unsigned nthreads = stp2webgl_thread_count(opts->threads);
+    unsigned long total = 0;
+
+    for (i=0; i<count; i++)
+	total += items[i].facets;
+
+    // No need for rounds since nothing is held once a chunk has been
+    // copied, so cut everything up front and let the threads go.
+    unsigned max_chunks = (unsigned)
+	((total + STL_CHUNK_FACETS - 1) / STL_CHUNK_FACETS);
+
+    stl_round rnd;
+    rnd.items = items;
+    rnd.fn = fn;
+    rnd.chunks = new stl_chunk[max_chunks+1];
+    rnd.bufs = 0;
+    rnd.dst = dst;
+    rnd.record = record;
+
+    unsigned item = 0;
+    unsigned first = 0;
+    unsigned long offset = 0;
+    unsigned num = cut_chunks (
+	rnd.chunks, max_chunks, items, count, &item, &first, &offset
+	);
+
+    stp2webgl_parallel_for (num, place_chunk_fn, &rnd, nthreads);
+
+    int err = 0;
+    for (i=0; i<num; i++)
+	if (rnd.chunks[i].bad) err = 1;
+
+    delete [] rnd.chunks;
+    stats_add("stl emit seconds", stats_time() - start);
+    return err;
+}
+
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+// SPLIT OUTPUT -- One STL file for each product, holding just the
+// solids of that product in its own space, so that the components
+// of an assembly can be used separately.  The items and file names
+// are found on the main thread, then each file is written by a
+// worker.  A product with no facets does not get a file.
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+struct stl_part_job {
+    RoseStringObject path;
+    RoseStringObject name;
+    stp2webgl_stl_item * items;
+    unsigned count;
+    unsigned long facets;
+    stp2webgl_stl_fn fn;
+    int binary;
+    std::atomic<unsigned> * failed;
+};
+
+static void write_part_job (void * ctx)
+{
+    stl_part_job * job = (stl_part_job *) ctx;
+    stp2webgl_buffer buf;
+    unsigned i;
+    int err = 0;
+
+    FILE * fd = rose_fopen(job->path, job->binary? "wb": "w");
+    if (!fd) {
+	printf ("Could not open STL file %s\n", (const char *) job->path);
+	(*job->failed)++;
+	delete [] job->items;
+	delete job;
+	return;
+    }
+
+    if (job->binary) {
+	unsigned char header[80];
+	memset (header, 0, 80);
+	strcpy ((char*)header, "binary stl");
+	buf.putBytes (header, 80);
+	buf.putU32 (job->facets);
+    }
+    else {
+	buf.putBytes ("solid ", 6);
+	buf.putBytes (job->name, job->name.size());
+	buf.putBytes ("\n", 1);
+    }
+
+    for (i=0; i<job->count && !err; i++)
+    {
+	job->fn (&buf, job->items + i, 0, job->items[i].facets);
+	if (buf.size() >= STL_PART_FLUSH) {
+	    err = buf.write(fd);
+	    buf.reset();
+	}
+    }
+
+    if (!job->binary) {
+	buf.putBytes ("endsolid ", 9);
+	buf.putBytes (job->name, job->name.size());
+	buf.putBytes ("\n", 1);
+    }
+
+    if (!err) err = buf.write(fd);
+    if (fclose(fd)) err = 1;
+    if (err) {
+	printf ("Could not write STL file %s\n", (const char *) job->path);
+	(*job->failed)++;
+    }
+
+    delete [] job->items;
+    delete job;
+}
+
+
+int stp2webgl_write_stl_parts (
+    stp2webgl_opts * opts,
+    int binary,
+    stp2webgl_stl_fn fn
+    )
+{
+    unsigned i;
+    double start;
+
+    opts->dstdir = opts->dstfile;
+    if (!opts->dstdir)
+	opts->dstdir = "step_data";
+
+    if (!rose_dir_exists (opts->dstdir) &&
+	(rose_mkdir(opts->dstdir) != 0)) {
+	printf ("Cannot create directory %s\n", opts->dstdir);
+	return 2;
+    }
+
+    facet_all_products(opts);
+
+    start = stats_time();
+    stp2webgl_occurrences parts;
+    parts.buildParts(opts);
+
+    unsigned count;
+    rose_uint_vector firsts;
+    RoseStringObject * names = stp2webgl_part_runs (&parts, &count, &firsts);
+
+    unsigned files = 0;
+    std::atomic<unsigned> failed(0);
+    {
+	stp2webgl_workers workers (opts->threads);
+
+	for (i=0; i<count; i++)
+	{
+	    stl_part_job * job = new stl_part_job;
+	    unsigned first = firsts[i];
+	    unsigned end = firsts[i+1];
+
+	    job->items = new stp2webgl_stl_item[end - first + 1];
+	    job->count = 0;
+	    job->facets = 0;
+	    collect_items (&parts, first, end, job->items,
+			   &job->count, &job->facets);
+
+	    if (!job->count) {
+		delete [] job->items;
+		delete job;
+		continue;
+	    }
+
+	    // fresh copies, the strings go to another thread
+	    job->name += names[i];
+	    job->path = opts->dstdir;
+	    job->path += "/";
+	    job->path += names[i];
+	    job->path += ".stl";
+	    job->fn = fn;
+	    job->binary = binary;
+	    job->failed = &failed;
+
+	    workers.submit(write_part_job, job);
+	    files++;
+	}
+    }   // waits for the workers
+
+    delete [] names;
+    stats_add("stl part files", files);
+    stats_add("stl part seconds", stats_time() - start);
+    return failed? 2: 0;
+}
@@ -0,0 +1,82 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Facet output for the STL writers, spread over worker threads.
+//
+// The placed items are looked up on the main thread first, since the
+// workers must not touch the STEP data.  The facets are then cut into
+// chunks of about the same size, each formatted into its own buffer
+// by a worker, and the buffers are written in order.  The result is
+// the same bytes as formatting everything on one thread.
+//
+
+struct stp2webgl_stl_item {
+    const StixMeshFacetSet * fs;	// mesher facets, or
+    const stp2webgl_shell * box;	// timed out solid or file triangles
+    const StixMtrx * xform;		// placement from the table
+    unsigned facets;
+};
+
+// Format facets [first, first+count) of an item into the buffer
+typedef void (*stp2webgl_stl_fn) (
+    stp2webgl_buffer * buf,
+    const stp2webgl_stl_item * item,
+    unsigned first,
+    unsigned count
+    );
+
+// Items of the occurrence table that have facets, with the total
+// number of facets.  The caller deletes the array.
+extern stp2webgl_stl_item * stp2webgl_stl_items (
+    const stp2webgl_occurrences * occs,
+    unsigned * count,
+    unsigned long * facets
+    );
+
+// Format and write all facets of the items.  Returns zero on success.
+extern int stp2webgl_emit_stl (
+    stp2webgl_opts * opts,
+    FILE * fd,
+    const stp2webgl_stl_item * items,
+    unsigned count,
+    stp2webgl_stl_fn fn
+    );
+
+// Same as above for formats with a fixed size record per facet.
+// Each chunk is copied straight to its place in the destination, a
+// mapped file for example, so there is no need to write in order.
+// Returns zero on success, or nonzero if a facet was not formatted
+// at the record size.
+extern int stp2webgl_emit_stl_fixed (
+    stp2webgl_opts * opts,
+    unsigned char * dst,
+    unsigned record,
+    const stp2webgl_stl_item * items,
+    unsigned count,
+    stp2webgl_stl_fn fn
+    );
+
+// Write an STL file for each product into a directory, from -d.
+// Each file has the solids of just that product, in the space of
+// the product, and is named like the component STEP files.  The
+// files are written by worker threads.  Returns zero on success.
+extern int stp2webgl_write_stl_parts (
+    stp2webgl_opts * opts,
+    int binary,
+    stp2webgl_stl_fn fn
+    );
@@ -22,12 +22,24 @@
 #include <stixmesh.h>
 
 #include "stp2webgl.h"
+#include "stats.h"
 
-enum FileFormat { FmtWebXML, FmtTxtSTL, FmtBinSTL };
+enum FileFormat { FmtWebXML, FmtTxtSTL, FmtBinSTL, FmtPLY };
 
 extern int write_webxml (stp2webgl_opts * opts);
 extern int write_ascii_stl (stp2webgl_opts * opts);
 extern int write_binary_stl (stp2webgl_opts * opts);
+extern int write_ply (stp2webgl_opts * opts);
+extern void stp2webgl_find_tessellations (stp2webgl_opts * opts);
+extern RoseDesign * stp2webgl_read_design (
+    stp2webgl_opts * opts,
+    const char * path
+    );
+extern void stp2webgl_load_external (
+    stp2webgl_opts * opts,
+    rose_vector * designs
+    );
+extern void stp2webgl_link_external (stp2webgl_opts * opts);
 
 
 const char * tool_name 	= "Facet STEP for Lightweight Viewing";
@@ -46,6 +58,7 @@ const char * opts_long =
     " -help\t\t - Print this help message. \n"
     " -stl\t\t - Write STL data in ascii text format. \n"
     " -stlbin\t\t - Write STL data in binary format. \n"
+    " -ply\t\t - Write binary PLY with shared vertices and face colors. \n"
     " -webxml\t\t - Write XML for WebGl client (default). \n"
     "\n"
     " -tol <dist>\t - Absolute linearization tolerance.  When linearizing\n"
@@ -69,7 +82,63 @@ const char * opts_long =
     "       \t\t   which should be a product_definition\n"
     "\n"
     " -o <outname>\t - Write output to given file\n"
-    " -d\t\t - Write multiple files (-o is a directory)\n"
+    " -d\t\t - Write multiple files (-o is a directory).  With -stl\n"
+    "\t\t   or -stlbin, write an STL file for each product, and\n"
+    "\t\t   with -ply a PLY file for each product.\n"
+    " -bin\t\t - With -webxml -d, write each shell as a compact binary\n"
+    "\t\t   file with quantized positions and normals.\n"
+    " -compress\t - With -bin, also compress the shell connectivity and\n"
+    "\t\t   vertex data.\n"
+    " -verify\t - With -bin, decode each shell after writing and check\n"
+    "\t\t   it against the original facets.\n"
+    " -reorder\t - With -webxml, reorder the facets of each face for\n"
+    "\t\t   better GPU vertex cache use and renumber vertices in\n"
+    "\t\t   the order they are used.\n"
+    " -normals\t - With -ply, also write a normal for each vertex.\n"
+    " -batch\t\t - With -webxml, gather the faces of each shell by color\n"
+    "\t\t   so that each color is drawn as one group, and list the\n"
+    "\t\t   facets of each STEP face in a table for picking.\n"
+    " -bvh\t\t - With -bin, add a bounding volume hierarchy over the\n"
+    "\t\t   facets of each shell for fast picking in the client.\n"
+    " -meshlets\t - With -webxml, also cut each shell into meshlets of\n"
+    "\t\t   at most 64 vertices and 124 facets, with bounding\n"
+    "\t\t   spheres and normal cones for cluster culling.\n"
+    " -lod <n>\t - With -webxml -d, also facet each shell at n-1 coarser\n"
+    "\t\t   tolerances, each four times the one before, and list\n"
+    "\t\t   the levels and their error in the index file.\n"
+    " -budget <n>\t - With -webxml, pick a tolerance for each solid so\n"
+    "\t\t   that the total is close to n facets.  Large parts get\n"
+    "\t\t   tighter tolerances than small ones.\n"
+    " -deadline <sec> - With -webxml -d, first write everything at a very\n"
+    "\t\t   coarse tolerance, then refine the largest shells until\n"
+    "\t\t   the given number of seconds has passed.  Not with\n"
+    "\t\t   -asmtris.\n"
+    " -maxtris <n>\t - With -webxml, decimate each shell to at most n\n"
+    "\t\t   facets.  Edges of STEP faces are kept.\n"
+    " -asmtris <n>\t - With -webxml, decimate all shells to n facets in\n"
+    "\t\t   total, shared out by the surface area of each shell.\n"
+    " -minpart <frac> - With -webxml, skip solids smaller than this fraction\n"
+    "\t\t   of the whole assembly, and facet solids up to ten\n"
+    "\t\t   times that size coarsely.\n"
+    " -cull\t\t - With -webxml, find solids that can not be seen from\n"
+    "\t\t   outside the assembly.  These are only faceted coarsely\n"
+    "\t\t   and are marked hidden in the index.\n"
+    " -timeout <sec> - Give up on any solid that takes longer than this\n"
+    "\t\t   to facet and write its bounding box instead.\n"
+    " -tiles <n>\t - With -webxml -d, also sort the shell placements into\n"
+    "\t\t   an octree of tiles with at most n in each, described\n"
+    "\t\t   by a tileset.json file for streaming large assemblies.\n"
+    " -chunk\t\t - With -webxml, split shells with more than 65535\n"
+    "\t\t   vertices into chunks that can use 16bit indices.\n"
+    "\n"
+    " -threads <n>\t - Number of threads for writing output.  Default is\n"
+    "\t\t   one per processor.\n"
+    " -extref\t - Read the part files named by document references in\n"
+    "\t\t   the STEP file and place their shapes in the assembly.\n"
+    " -cache\t\t - Save the parsed STEP file next to it in the faster\n"
+    "\t\t   native format, and read that instead on later runs\n"
+    "\t\t   while the STEP file is unchanged.\n"
+    " -stats\t\t - Print sizes and timings when finished.\n"
     "\n" 
     ;
 
@@ -100,6 +169,7 @@ int main(int argc, char ** argv)
     
     stp2webgl_opts opts;
     FileFormat fmt = FmtWebXML;
+    double start = stats_time();
     
     int idx = 1;
 
@@ -121,6 +191,7 @@ int main(int argc, char ** argv)
 	else if (!strcmp(arg, "-stl"))		{ fmt = FmtTxtSTL; }
 	else if (!strcmp(arg, "-stlbin"))	{ fmt = FmtBinSTL; }
 	else if (!strcmp(arg, "-webxml"))	{ fmt = FmtWebXML; }
+	else if (!strcmp(arg, "-ply"))		{ fmt = FmtPLY; }
 
 	else if (!strcmp(arg, "-tol"))
 	{
@@ -131,6 +202,7 @@ int main(int argc, char ** argv)
 		exit (1);
 	    }
   	    opts.mesh.setToleranceAbsolute(tmp);
+	    opts.tolerance = tmp;
 	}
        	
 	else if (!strcmp(arg, "-ftol"))
@@ -142,6 +214,7 @@ int main(int argc, char ** argv)
 		exit (1);
 	    }
 	    opts.mesh.setToleranceFraction(tmp);
+	    opts.tol_fraction = tmp;
 	}
 		
 	else if (!strcmp(arg, "-min"))
@@ -191,6 +264,150 @@ int main(int argc, char ** argv)
 	    opts.do_split = 1;
 	}
 
+	else if (!strcmp(arg, "-bin"))
+	{
+	    opts.do_binary = 1;
+	}
+	else if (!strcmp(arg, "-compress"))
+	{
+	    opts.do_compress = 1;
+	}
+	else if (!strcmp(arg, "-verify"))
+	{
+	    opts.do_verify = 1;
+	}
+	else if (!strcmp(arg, "-reorder"))
+	{
+	    opts.do_reorder = 1;
+	}
+	else if (!strcmp(arg, "-lod"))
+	{
+	    unsigned tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%u", &tmp) != 1) || !tmp) {
+		fprintf (stderr, "option: -lod <levels>\n");
+		exit (1);
+	    }
+	    opts.lod_levels = tmp;
+	}
+	else if (!strcmp(arg, "-budget"))
+	{
+	    unsigned long tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%lu", &tmp) != 1) || !tmp) {
+		fprintf (stderr, "option: -budget <facets>\n");
+		exit (1);
+	    }
+	    opts.budget = tmp;
+	}
+	else if (!strcmp(arg, "-deadline"))
+	{
+	    double tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%lf", &tmp) != 1) || tmp <= 0.) {
+		fprintf (stderr, "option: -deadline <seconds>\n");
+		exit (1);
+	    }
+	    opts.deadline = tmp;
+	}
+	else if (!strcmp(arg, "-maxtris"))
+	{
+	    unsigned tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%u", &tmp) != 1) || !tmp) {
+		fprintf (stderr, "option: -maxtris <facets>\n");
+		exit (1);
+	    }
+	    opts.max_facets = tmp;
+	}
+	else if (!strcmp(arg, "-asmtris"))
+	{
+	    unsigned long tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%lu", &tmp) != 1) || !tmp) {
+		fprintf (stderr, "option: -asmtris <facets>\n");
+		exit (1);
+	    }
+	    opts.asm_facets = tmp;
+	}
+	else if (!strcmp(arg, "-minpart"))
+	{
+	    double tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%lf", &tmp) != 1) ||
+		tmp <= 0. || tmp >= 1.) {
+		fprintf (stderr, "option: -minpart <fraction>\n");
+		exit (1);
+	    }
+	    opts.min_part = tmp;
+	}
+	else if (!strcmp(arg, "-tiles"))
+	{
+	    unsigned tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%u", &tmp) != 1) || !tmp) {
+		fprintf (stderr, "option: -tiles <placements>\n");
+		exit (1);
+	    }
+	    opts.tile_items = tmp;
+	}
+	else if (!strcmp(arg, "-bvh"))
+	{
+	    opts.do_bvh = 1;
+	}
+	else if (!strcmp(arg, "-normals"))
+	{
+	    opts.do_normals = 1;
+	}
+	else if (!strcmp(arg, "-batch"))
+	{
+	    opts.do_batch = 1;
+	}
+	else if (!strcmp(arg, "-meshlets"))
+	{
+	    opts.do_meshlets = 1;
+	}
+	else if (!strcmp(arg, "-cull"))
+	{
+	    opts.do_cull = 1;
+	}
+	else if (!strcmp(arg, "-timeout"))
+	{
+	    double tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%lf", &tmp) != 1) || tmp <= 0.) {
+		fprintf (stderr, "option: -timeout <seconds>\n");
+		exit (1);
+	    }
+	    opts.solid_timeout = tmp;
+	}
+	else if (!strcmp(arg, "-chunk"))
+	{
+	    opts.chunk_verts = 65535;
+	}
+	else if (!strcmp(arg, "-stats"))
+	{
+	    opts.do_stats = 1;
+	}
+	else if (!strcmp(arg, "-cache"))
+	{
+	    opts.do_cache = 1;
+	}
+	else if (!strcmp(arg, "-extref"))
+	{
+	    opts.do_extref = 1;
+	}
+	else if (!strcmp(arg, "-threads"))
+	{
+	    unsigned tmp;
+	    const char * val = NEXT_ARG(idx,argc,argv);
+	    if (!val || (sscanf (val, "%u", &tmp) != 1)) {
+		fprintf (stderr, "option: -threads <num>\n");
+		exit (1);
+	    }
+	    opts.threads = tmp;
+	}
+
 	else if (*arg == '-')
 	{
 	    fprintf (stderr, "unknown option: %s\n", arg);
@@ -218,20 +435,18 @@ int main(int argc, char ** argv)
 
 
     // Read the step file
-    opts.design = ROSE.findDesign(opts.srcfile);
+    opts.design = stp2webgl_read_design(&opts, opts.srcfile);
     if (!opts.design) {
 	printf ("Could not open design %s\n", opts.srcfile);
 	exit (2);
     }
 
-    // prepare for working with assemblies
-    rose_compute_backptrs (opts.design);
-    stix_tag_asms (opts.design);
-    stix_tag_units (opts.design);    
-    stixmesh_resolve_presentation (opts.design);
+    stats_add ("read seconds", stats_time() - start);
 
     // Find the assembly roots to export.  Given as a list of product
-    // definition #IDs or all roots by default.
+    // definition #IDs or all roots by default.  Any given ones are
+    // looked up before the design is prepared, which takes a while
+    // on a large file, so that a bad ID is reported right away.
     //
     unsigned i,sz;
     for (i=0, sz=opts.root_ids.size(); i<sz; i++)
@@ -249,22 +464,59 @@ int main(int argc, char ** argv)
 	opts.root_prods.append(pd);
     }
 
+    // Part files named by the top level file, each in its own design
+    rose_vector designs;
+    designs.append(opts.design);
+    if (opts.do_extref)
+	stp2webgl_load_external(&opts, &designs);
+
+    // Prepare for working with assemblies.  The tagging covers the
+    // whole design, even when only one subassembly was asked for,
+    // so skip what the output does not use.  STL has no color, so
+    // it does not need the presentation resolved.
+    //
+    double prepare = stats_time();
+    for (i=0, sz=designs.size(); i<sz; i++)
+    {
+	RoseDesign * d = (RoseDesign *) designs[i];
+	rose_compute_backptrs (d);
+	stix_tag_asms (d);
+	stix_tag_units (d);    
+	if (fmt != FmtTxtSTL && fmt != FmtBinSTL)
+	    stixmesh_resolve_presentation (d);
+    }
+    stats_add ("prepare seconds", stats_time() - prepare);
+
+    if (opts.do_extref)
+	stp2webgl_link_external(&opts);
+
     // default to all of the assembly roots if none given 
     if (!opts.root_prods.size()) 
 	stix_find_root_products(&opts.root_prods, opts.design);
 
+    // AP242 tessellations that stand in for a B-rep
+    stp2webgl_find_tessellations(&opts);
 
     // Recursively traverse the root assemblies and write out the
     // faceted data.
+    int ret;
+
     switch (fmt) {
     case FmtTxtSTL:
-	return write_ascii_stl(&opts);
+	ret = write_ascii_stl(&opts);
+	break;
 
     case FmtBinSTL:
-	return write_binary_stl(&opts);
+	ret = write_binary_stl(&opts);
+	break;
 
     case FmtWebXML:
-	return write_webxml(&opts);
+	ret = write_webxml(&opts);
+	break;
+
+    case FmtPLY:
+	ret = write_ply(&opts);
+	break;
 
 	//------------------------------
 	// Other lightweight visualization formats can be added here
@@ -278,4 +530,11 @@ int main(int argc, char ** argv)
 	printf ("No support for format %d\n", (int)fmt);
 	return 1;
     }
+
+    // Stats go to stderr since STL may be written to stdout
+    if (opts.do_stats) {
+	stats_add ("total seconds", stats_time() - start);
+	stats_print (stderr);
+    }
+    return ret;
 }
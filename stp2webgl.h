@@ -34,14 +34,91 @@ public:
     const char * dstdir;
 
     int	do_split;
-    
+    int	do_binary;
+    int	do_compress;
+    int	do_verify;
+    int	do_stats;
+    int	do_reorder;
+    int	do_cull;
+    int	do_meshlets;
+    int	do_bvh;
+    int	do_normals;
+    int	do_batch;
+    int	do_cache;
+    int	do_extref;
+
+    // vertex cache size assumed when reordering facets
+    unsigned vertex_cache;
+
+    // largest vertex count for a shell chunk, zero to not split
+    unsigned chunk_verts;
+
+    // worker threads for output stages, zero for one per processor
+    unsigned threads;
+
+    // absolute faceting tolerance if one was given, zero otherwise
+    double tolerance;
+
+    // fractional faceting tolerance if one was given, zero otherwise
+    double tol_fraction;
+
+    // number of detail levels to write for each shell
+    unsigned lod_levels;
+
+    // facet budgets for each shell and for the whole assembly,
+    // zero for no limit
+    unsigned max_facets;
+    unsigned long asm_facets;
+
+    // facet count to aim for by picking a tolerance for each solid,
+    // zero to use the -tol or -ftol tolerance for all of them
+    unsigned long budget;
+
+    // seconds allowed for refining a coarse first pass, zero to
+    // facet once at the requested tolerance
+    double deadline;
+
+    // seconds allowed for faceting one solid, zero for no limit
+    double solid_timeout;
+
+    // smallest solid to facet as a fraction of the whole assembly,
+    // zero to facet everything
+    double min_part;
+
+    // most shell placements in one spatial tile, zero for no tiles
+    unsigned tile_items;
 
     stp2webgl_opts()
 	: design(0),
 	  srcfile(0),
 	  dstfile(0),
 	  dstdir(0),
-	  do_split(0)
+	  do_split(0),
+	  do_binary(0),
+	  do_compress(0),
+	  do_verify(0),
+	  do_stats(0),
+	  do_reorder(0),
+	  do_cull(0),
+	  do_meshlets(0),
+	  do_bvh(0),
+	  do_normals(0),
+	  do_batch(0),
+	  do_cache(0),
+	  do_extref(0),
+	  vertex_cache(16),
+	  chunk_verts(0),
+	  threads(0),
+	  tolerance(0.),
+	  tol_fraction(0.),
+	  lod_levels(1),
+	  max_facets(0),
+	  asm_facets(0),
+	  budget(0),
+	  deadline(0.),
+	  solid_timeout(0.),
+	  min_part(0.),
+	  tile_items(0)
     {
     }
 };
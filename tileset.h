@@ -0,0 +1,37 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// One placement of a shell for the spatial tiles.  Everything the
+// tile writer needs is copied out of the STEP data beforehand, since
+// the tiles are written by worker threads.
+//
+struct stp2webgl_tile_item {
+    double lo[3];		// box of the placed shell, model space
+    double hi[3];
+    double xform[16];		// placement, same order as the index
+    unsigned long shell_id;	// entity id of the solid
+    int hidden;			// not visible from outside
+};
+
+// Write tileset.json and the tile files into the output directory.
+// Returns zero on success, non-zero if any file could not be written.
+extern int write_tileset (
+    stp2webgl_opts * opts,
+    const stp2webgl_tile_item * items,
+    unsigned count
+    );
@@ -29,7 +29,32 @@ OBJECTS = \
 	facet_product$o \
 	write_stl$o \
 	write_stlbin$o \
-	write_webxml$o
+	write_webxml$o \
+	shell_mesh$o \
+	bin_buffer$o \
+	write_shellbin$o \
+	parallel$o \
+	stats$o \
+	mesh_codec$o \
+	mesh_reorder$o \
+	mesh_chunk$o \
+	mesh_decimate$o \
+	mesh_budget$o \
+	brep_bbox$o \
+	mesh_pump$o \
+	mesh_bvh$o \
+	mesh_visibility$o \
+	write_tileset$o \
+	mesh_meshlet$o \
+	occurrence$o \
+	stl_emit$o \
+	mapped_file$o \
+	part_name$o \
+	write_ply$o \
+	mesh_batch$o \
+	mesh_tessellated$o \
+	design_cache$o \
+	external_refs$o
 
 
 #========================================
@@ -0,0 +1,643 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <string.h>
+#include <atomic>
+
+#include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "occurrence.h"
+#include "bin_buffer.h"
+#include "parallel.h"
+#include "stats.h"
+
+// write_ply() -- write the facets as binary little endian PLY.  Unlike
+// STL, each vertex of a placed shell is written once and the facets
+// index into them, and every facet has the color of its STEP face.
+// With -normals, each vertex also has a normal, and a vertex with a
+// different normal on different faces is written once for each.
+//
+// Like the STL writers, this facets everything first and then goes
+// through the placements.  The shells used by the placements are
+// copied and welded once each, then the vertex and face sections are
+// encoded in chunks by the worker threads and written in order.  With
+// -d there is a file for each product instead.
+//
+
+extern void facet_all_products (stp2webgl_opts * opts);
+extern const stp2webgl_shell * find_fallback_shell (
+    stp_representation_item * solid
+    );
+extern RoseStringObject * stp2webgl_part_runs (
+    const stp2webgl_occurrences * parts,
+    unsigned * count,
+    rose_uint_vector * firsts
+    );
+extern int write_ply (stp2webgl_opts * opts);
+
+// Vertices or facets in one chunk, and chunks given to each thread
+// at a time.  Only one round of chunks is held in memory.
+#define PLY_CHUNK_WORK		65536
+#define PLY_CHUNKS_PER_THREAD	4
+
+// for faces without a color
+#define PLY_DEFAULT_COLOR	0xbfbfbf
+
+
+struct ply_shell {
+    const void * key;			// mesh or fallback shell
+    const stp2webgl_shell * shell;
+    stp2webgl_shell * owned;		// copied from the mesh here
+    unsigned * weld;			// output vertex of each corner
+    unsigned * src;			// vertex and normal of each one
+    unsigned vert_count;
+};
+
+struct ply_item {
+    const ply_shell * ps;		// null if nothing to draw
+    const StixMtrx * xform;
+    unsigned base;			// first vertex in the file
+};
+
+struct ply_data {
+    ply_shell * shells;
+    unsigned shell_count;
+    ply_item * items;
+    int normals;
+};
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+// WELDING -- The mesher already shares vertices between the facets
+// of a solid, so the vertex indices are used as they are, dropping
+// any that no facet uses.  With normals, a vertex is split for each
+// normal it has.  Output vertices are in the order of the originals.
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+struct ply_corner {
+    unsigned vert;
+    unsigned norm;
+    unsigned idx;
+};
+
+static int ply_corner_cmp (const void * a, const void * b)
+{
+    const ply_corner * ca = (const ply_corner *) a;
+    const ply_corner * cb = (const ply_corner *) b;
+
+    if (ca->vert != cb->vert) return (ca->vert < cb->vert)? -1: 1;
+    if (ca->norm != cb->norm) return (ca->norm < cb->norm)? -1: 1;
+    if (ca->idx != cb->idx) return (ca->idx < cb->idx)? -1: 1;
+    return 0;
+}
+
+// Called from the worker threads, only touches the mesh data
+static void weld_shell_fn (void * ctx, unsigned idx)
+{
+    ply_data * data = (ply_data *) ctx;
+    ply_shell * ps = data->shells + idx;
+    const stp2webgl_shell * shell = ps->shell;
+    unsigned i;
+
+    unsigned corners = 3 * shell->getFacetCount();
+    ps->weld = new unsigned[corners+1];
+    ps->vert_count = 0;
+
+    if (!data->normals)
+    {
+	unsigned verts = shell->getVertexCount();
+	unsigned * remap = new unsigned[verts+1];
+
+	for (i=0; i<verts; i++) remap[i] = ROSE_NOTFOUND;
+	for (i=0; i<corners; i++) remap[shell->facets[i]] = 0;
+
+	ps->src = new unsigned[2*verts+1];
+	for (i=0; i<verts; i++) {
+	    if (remap[i] == ROSE_NOTFOUND) continue;
+	    ps->src[2*ps->vert_count] = i;
+	    ps->src[2*ps->vert_count+1] = ROSE_NOTFOUND;
+	    remap[i] = ps->vert_count++;
+	}
+
+	for (i=0; i<corners; i++)
+	    ps->weld[i] = remap[shell->facets[i]];
+
+	delete [] remap;
+	return;
+    }
+
+    ply_corner * sorted = new ply_corner[corners+1];
+    for (i=0; i<corners; i++) {
+	sorted[i].vert = shell->facets[i];
+	sorted[i].norm = shell->facet_normals[i];
+	sorted[i].idx = i;
+    }
+    qsort (sorted, corners, sizeof(ply_corner), ply_corner_cmp);
+
+    ps->src = new unsigned[2*corners+1];
+    for (i=0; i<corners; i++)
+    {
+	if (!i || sorted[i].vert != sorted[i-1].vert ||
+	    sorted[i].norm != sorted[i-1].norm)
+	{
+	    ps->src[2*ps->vert_count] = sorted[i].vert;
+	    ps->src[2*ps->vert_count+1] = sorted[i].norm;
+	    ps->vert_count++;
+	}
+	ps->weld[sorted[i].idx] = ps->vert_count-1;
+    }
+    delete [] sorted;
+}
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+// ENCODING -- Items are cut into chunks of about the same work, each
+// encoded into its own buffer by a worker.  The vertices of all the
+// items go first and then the faces, so each file takes two passes.
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+struct ply_chunk {
+    unsigned first;
+    unsigned end;
+    stp2webgl_buffer buf;
+};
+
+struct ply_round {
+    const ply_data * data;
+    ply_chunk * chunks;
+    int faces;
+};
+
+static void put_vertices (
+    stp2webgl_buffer * buf,
+    const ply_item * item,
+    int normals
+    )
+{
+    const ply_shell * ps = item->ps;
+    const stp2webgl_shell * shell = ps->shell;
+    unsigned i;
+    double v[3];
+    double n[3];
+
+    for (i=0; i<ps->vert_count; i++)
+    {
+	stixmesh_transform (v, *item->xform, shell->getVertex(ps->src[2*i]));
+	buf->putF32 (v[0]);
+	buf->putF32 (v[1]);
+	buf->putF32 (v[2]);
+
+	if (!normals) continue;
+
+	const double * dir = shell->getNormal(ps->src[2*i+1]);
+	if (dir) stixmesh_transform_dir (n, *item->xform, dir);
+	else n[0] = n[1] = n[2] = 0.;
+
+	buf->putF32 (n[0]);
+	buf->putF32 (n[1]);
+	buf->putF32 (n[2]);
+    }
+}
+
+static void put_faces (
+    stp2webgl_buffer * buf,
+    const ply_item * item
+    )
+{
+    const ply_shell * ps = item->ps;
+    const stp2webgl_shell * shell = ps->shell;
+    unsigned i,j,k,sz;
+
+    for (i=0, sz=shell->getFaceCount(); i<sz; i++)
+    {
+	unsigned color = shell->face_color[i];
+	if (color == STIXMESH_NULL_COLOR)
+	    color = PLY_DEFAULT_COLOR;
+
+	unsigned first = shell->face_first[i];
+	unsigned end = first + shell->face_count[i];
+
+	for (j=first; j<end; j++)
+	{
+	    buf->putU8 (3);
+	    for (k=0; k<3; k++)
+		buf->putU32 (item->base + ps->weld[3*j+k]);
+
+	    buf->putU8 ((color >> 16) & 0xff);
+	    buf->putU8 ((color >> 8) & 0xff);
+	    buf->putU8 (color & 0xff);
+	}
+    }
+}
+
+static void encode_chunk_fn (void * ctx, unsigned idx)
+{
+    ply_round * rnd = (ply_round *) ctx;
+    ply_chunk * c = rnd->chunks + idx;
+    unsigned i;
+
+    c->buf.reset();
+    for (i=c->first; i<c->end; i++)
+    {
+	const ply_item * item = rnd->data->items + i;
+	if (!item->ps) continue;
+
+	if (rnd->faces) put_faces (&c->buf, item);
+	else put_vertices (&c->buf, item, rnd->data->normals);
+    }
+}
+
+
+// Write one section for the items in [first,end)
+static int write_section (
+    FILE * fd,
+    const ply_data * data,
+    unsigned first,
+    unsigned end,
+    int faces,
+    unsigned nthreads
+    )
+{
+    unsigned i;
+    int err = 0;
+
+    nthreads = stp2webgl_thread_count(nthreads);
+    unsigned max_chunks = nthreads * PLY_CHUNKS_PER_THREAD;
+
+    ply_round rnd;
+    rnd.data = data;
+    rnd.chunks = new ply_chunk[max_chunks];
+    rnd.faces = faces;
+
+    unsigned item = first;
+    while (item < end && !err)
+    {
+	// cut the next round of chunks, whole items in each
+	unsigned num = 0;
+	while (num < max_chunks && item < end)
+	{
+	    ply_chunk * c = rnd.chunks + num++;
+	    unsigned long work = 0;
+
+	    c->first = item;
+	    while (item < end && work < PLY_CHUNK_WORK)
+	    {
+		const ply_shell * ps = data->items[item++].ps;
+		if (!ps) continue;
+		work += faces? ps->shell->getFacetCount(): ps->vert_count;
+	    }
+	    c->end = item;
+	}
+
+	stp2webgl_parallel_for (num, encode_chunk_fn, &rnd, nthreads);
+
+	for (i=0; i<num && !err; i++)
+	    err = rnd.chunks[i].buf.write(fd);
+    }
+
+    delete [] rnd.chunks;
+    return err;
+}
+
+
+// Write a complete file for the items in [first,end).  Returns zero
+// on success.
+static int write_ply_file (
+    FILE * fd,
+    ply_data * data,
+    unsigned first,
+    unsigned end,
+    unsigned nthreads
+    )
+{
+    unsigned i;
+    unsigned long verts = 0;
+    unsigned long facets = 0;
+    char line[100];
+
+    for (i=first; i<end; i++)
+    {
+	ply_item * item = data->items + i;
+	if (!item->ps) continue;
+
+	item->base = (unsigned) verts;
+	verts += item->ps->vert_count;
+	facets += item->ps->shell->getFacetCount();
+    }
+
+    stp2webgl_buffer buf;
+    const char * header =
+	"ply\n"
+	"format binary_little_endian 1.0\n"
+	"comment written by stp2webgl\n";
+    buf.putBytes (header, strlen(header));
+
+    sprintf (line, "element vertex %lu\n", verts);
+    buf.putBytes (line, strlen(line));
+
+    header =
+	"property float x\n"
+	"property float y\n"
+	"property float z\n";
+    buf.putBytes (header, strlen(header));
+
+    if (data->normals) {
+	header =
+	    "property float nx\n"
+	    "property float ny\n"
+	    "property float nz\n";
+	buf.putBytes (header, strlen(header));
+    }
+
+    sprintf (line, "element face %lu\n", facets);
+    buf.putBytes (line, strlen(line));
+
+    header =
+	"property list uchar uint vertex_indices\n"
+	"property uchar red\n"
+	"property uchar green\n"
+	"property uchar blue\n"
+	"end_header\n";
+    buf.putBytes (header, strlen(header));
+
+    if (buf.write(fd)) return 1;
+    if (write_section (fd, data, first, end, 0, nthreads)) return 1;
+    if (write_section (fd, data, first, end, 1, nthreads)) return 1;
+
+    stats_add("ply vertices", verts);
+    stats_add("ply facets", facets);
+    return 0;
+}
+
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+// SHELLS -- The placements of a solid share one copy of its facets.
+// The copies are made on the main thread since they read the face
+// colors from the STEP data.
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+struct ply_key {
+    const void * key;
+    unsigned item;
+};
+
+static int ply_key_cmp (const void * a, const void * b)
+{
+    const ply_key * ka = (const ply_key *) a;
+    const ply_key * kb = (const ply_key *) b;
+
+    if (ka->key != kb->key) return (ka->key < kb->key)? -1: 1;
+    if (ka->item != kb->item) return (ka->item < kb->item)? -1: 1;
+    return 0;
+}
+
+static void find_shells (
+    ply_data * data,
+    const stp2webgl_occurrences * occs,
+    unsigned nthreads
+    )
+{
+    unsigned i,sz;
+    unsigned count = 0;
+
+    sz = occs->size();
+    data->items = new ply_item[sz+1];
+    ply_key * keys = new ply_key[sz+1];
+
+    for (i=0; i<sz; i++)
+    {
+	stp_representation_item * it = occs->item(i);
+
+	// In an assembly, some items just place subcomponents.  If
+	// there are solids, we should have previously generated meshes.
+	const void * key = stixmesh_cache_find (it);
+	if (!key) key = find_fallback_shell (it);
+
+	data->items[i].ps = 0;
+	data->items[i].xform = &occs->xform(i);
+	data->items[i].base = 0;
+
+	if (!key) continue;
+	keys[count].key = key;
+	keys[count].item = i;
+	count++;
+    }
+    qsort (keys, count, sizeof(ply_key), ply_key_cmp);
+
+    data->shells = new ply_shell[count+1];
+    data->shell_count = 0;
+    for (i=0; i<count; i++)
+    {
+	if (!i || keys[i].key != keys[i-1].key)
+	{
+	    ply_shell * ps = data->shells + data->shell_count++;
+	    stp_representation_item * it = occs->item(keys[i].item);
+
+	    ps->key = keys[i].key;
+	    ps->owned = 0;
+	    ps->weld = 0;
+	    ps->src = 0;
+	    ps->vert_count = 0;
+
+	    StixMeshStp * mesh = stixmesh_cache_find (it);
+	    if (mesh) ps->shell = ps->owned = stp2webgl_make_shell (mesh);
+	    else ps->shell = (const stp2webgl_shell *) keys[i].key;
+	}
+
+	ply_shell * ps = data->shells + data->shell_count-1;
+	if (ps->shell->getFacetCount())
+	    data->items[keys[i].item].ps = ps;
+    }
+    delete [] keys;
+
+    stp2webgl_parallel_for (
+	data->shell_count, weld_shell_fn, data, nthreads
+	);
+}
+
+static void free_shells (ply_data * data)
+{
+    unsigned i;
+
+    for (i=0; i<data->shell_count; i++) {
+	delete data->shells[i].owned;
+	delete [] data->shells[i].weld;
+	delete [] data->shells[i].src;
+    }
+    delete [] data->shells;
+    delete [] data->items;
+}
+
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+// SPLIT OUTPUT -- A file for each product, written by the workers.
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+struct ply_part_job {
+    ply_data * data;
+    unsigned first;
+    unsigned end;
+    RoseStringObject path;
+    std::atomic<unsigned> * failed;
+};
+
+static void write_part_job (void * ctx)
+{
+    ply_part_job * job = (ply_part_job *) ctx;
+
+    FILE * fd = rose_fopen(job->path, "wb");
+    if (!fd) {
+	printf ("Could not open PLY file %s\n", (const char *) job->path);
+	(*job->failed)++;
+    }
+    else {
+	// each file on one thread, the workers are the parallelism
+	int err = write_ply_file (fd, job->data, job->first, job->end, 1);
+	if (fclose(fd)) err = 1;
+	if (err) {
+	    printf ("Could not write PLY file %s\n",
+		    (const char *) job->path);
+	    (*job->failed)++;
+	}
+    }
+    delete job;
+}
+
+static int write_ply_parts (stp2webgl_opts * opts)
+{
+    unsigned i,j;
+
+    opts->dstdir = opts->dstfile;
+    if (!opts->dstdir)
+	opts->dstdir = "step_data";
+
+    if (!rose_dir_exists (opts->dstdir) &&
+	(rose_mkdir(opts->dstdir) != 0)) {
+	printf ("Cannot create directory %s\n", opts->dstdir);
+	return 2;
+    }
+
+    facet_all_products(opts);
+
+    stp2webgl_occurrences parts;
+    parts.buildParts(opts);
+
+    ply_data data;
+    data.normals = opts->do_normals;
+    find_shells (&data, &parts, opts->threads);
+
+    unsigned count;
+    rose_uint_vector firsts;
+    RoseStringObject * names = stp2webgl_part_runs (&parts, &count, &firsts);
+    std::atomic<unsigned> failed(0);
+
+    {
+	stp2webgl_workers workers (opts->threads);
+
+	for (i=0; i<count; i++)
+	{
+	    // skip products with nothing to draw
+	    for (j=firsts[i]; j<firsts[i+1]; j++)
+		if (data.items[j].ps) break;
+	    if (j == firsts[i+1]) continue;
+
+	    ply_part_job * job = new ply_part_job;
+	    job->data = &data;
+	    job->first = firsts[i];
+	    job->end = firsts[i+1];
+	    job->failed = &failed;
+
+	    // fresh copy, the string goes to another thread
+	    job->path = opts->dstdir;
+	    job->path += "/";
+	    job->path += names[i];
+	    job->path += ".ply";
+
+	    workers.submit(write_part_job, job);
+	}
+    }   // waits for the workers
+
+    delete [] names;
+    free_shells (&data);
+    return failed? 2: 0;
+}
+
+
+// ======================================================================
+
+int write_ply (stp2webgl_opts * opts)
+{
+    FILE * plyfile = stdout;
+    double start = stats_time();
+    int ret = 0;
+
+    if (opts->do_split) {
+	ret = write_ply_parts (opts);
+	stats_add("ply seconds", stats_time() - start);
+	return ret;
+    }
+
+    if (opts->dstfile)
+    {
+	plyfile = rose_fopen(opts->dstfile, "wb");
+	if (!plyfile) {
+	    printf ("Could not open output file\n");
+	    return 2;
+	}
+    }
+
+    // Recursively facet all of the products in the root assemblies
+    // and attach each resulting mesh to the representation item for
+    // each solid.
+    //
+    facet_all_products(opts);
+
+    stp2webgl_occurrences occs;
+    occs.build(opts);
+
+    ply_data data;
+    data.normals = opts->do_normals;
+    find_shells (&data, &occs, opts->threads);
+
+    if (write_ply_file (plyfile, &data, 0, occs.size(), opts->threads))
+	ret = 2;
+
+    free_shells (&data);
+    if (plyfile != stdout && fclose(plyfile))
+	ret = 2;
+
+    if (ret)
+	printf ("Could not write output file\n");
+
+    stats_add("ply seconds", stats_time() - start);
+    return ret;
+}
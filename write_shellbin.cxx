@@ -0,0 +1,1115 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <math.h>
+
+#include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "bin_buffer.h"
+#include "mesh_codec.h"
+#include "mesh_meshlet.h"
+#include "mesh_bvh.h"
+#include "stats.h"
+
+// write_shell_binary() -- write the facets of a single shell as a
+// compact binary payload for web clients.  Used by the webxml driver
+// in place of the per-shell XML files when the -bin option is given.
+//
+// Vertex positions are quantized to 16 bits on each axis relative to
+// the bounding box of the shell and normals are octahedral encoded
+// into two signed bytes.  If the quantization error would be larger
+// than the faceting tolerance, the positions are written as 32bit
+// float offsets from the box corner instead.  A fractional tolerance
+// (-ftol or the mesher default) is taken against the shell diagonal.
+//
+// All values are little endian.  Each section after the header is
+// padded to a multiple of four bytes so that a client can view it
+// directly as a typed array.
+//
+//   char[4]	"SWGL"
+//   u32	version (1)
+//   u32	flags (see SHELLBIN_ flags below)
+//   u32	entity id of the shell
+//   u32	default color (0xffffffff if none)
+//   u32	vertex count
+//   u32	normal count
+//   u32	facet count
+//   u32	face group count
+//   u32	reserved (0)
+//   f64[3]	origin
+//   f64[3]	scale  -- position = origin + scale * value
+//
+//   vertex count * u16[3]	quantized positions (or f32[3])
+//   normal count * s8[2]	octahedral normals
+//   facet count * idx[3]	vertex indices
+//   facet count * idx[3]	normal indices, max value if no normal
+//   group count * u32[4]	first facet, facet count, color, face id
+//
+// The indices are u16 when the SHELLBIN_SHORT_INDEX flag is set and
+// u32 otherwise.
+//
+// When the SHELLBIN_COMPRESSED flag is set (-compress option), each
+// of the five sections above is instead written as a u32 byte length
+// followed by a stream from mesh_codec.cxx, padded to four bytes.
+// Vertices and normals are stored in the order that the facets first
+// use them, which makes most index codes a single byte.  Positions
+// and normals are delta coded, the indices use the index codec, and
+// "no normal" is coded as the normal count.  Float positions and the
+// group table are stored as-is inside their sections.
+//
+// The SHELLBIN_FALLBACK flag marks a box written in place of a solid
+// that took too long to facet (-timeout option).
+//
+// When the SHELLBIN_MESHLETS flag is set (-meshlets option), a table
+// of meshlets follows, never compressed.  Each meshlet covers a range
+// of facets, see mesh_meshlet.h.  The vertex numbers refer to the
+// vertices as stored, so they follow the compressed vertex order.
+//
+//   u32	meshlet count
+//   u32	vertex list length
+//   count * { u32 first vertex, u32 first facet,
+//		u16 vertex count, u16 facet count,
+//		f32[4] center and radius, f32[4] cone axis and cutoff }
+//   length * idx	vertex list
+//   facet count * u8[3]	meshlet vertex numbers of each facet
+//
+// When the SHELLBIN_BVH flag is set (-bvh option), a bounding volume
+// hierarchy over the facets comes last, for picking, also never
+// compressed.  Nodes are depth first, so the left child of an inner
+// node is the next node.  Boxes are offsets from the origin, like
+// float positions, and are built from the positions as stored.  Each
+// leaf covers a range of slots, and each slot holds a facet number,
+// which the face group table maps to the STEP face.
+//
+//   u32	node count
+//   u32	slot count (same as the facet count)
+//   count * { f32[3] low corner, f32[3] high corner,
+//		u32 first slot or right child, u32 slot count or zero }
+//   slots * u32	facet number
+//
+// The SHELLBIN_BATCHED flag (-batch option) says that the face groups
+// are sorted so that the faces of one color are next to each other.
+// It is only set when that holds for the payload, since the groups
+// of a shell may not cover its facets in order.
+// A client can draw each run of one color with a single call and
+// still use the group table for picking.
+//
+// When a shell was split into chunks (-chunk option), the file holds
+// one payload per chunk behind a small table so a client can find
+// each one.  Every payload has its own box, so the chunks are also
+// quantized more finely than the whole shell would be.
+//
+//   char[4]	"SWGM"
+//   u32	version (1)
+//   u32	chunk count
+//   u32[n]	byte size of each payload
+//   payloads, one after another
+//
+// decode_shell_binary() is the reference decoder for both layouts.
+// The -verify option runs it on every payload and checks the result
+// against the original facets.
+//
+
+#define SHELLBIN_VERSION	1
+
+#define SHELLBIN_FLOAT_POSITIONS	0x01
+#define SHELLBIN_SHORT_INDEX		0x02
+#define SHELLBIN_COMPRESSED		0x04
+#define SHELLBIN_FALLBACK		0x08
+#define SHELLBIN_MESHLETS		0x10
+#define SHELLBIN_BVH			0x20
+#define SHELLBIN_BATCHED		0x40
+
+#define SHELLBIN_QUANT_MAX	65535
+
+// fractional tolerance that the mesher uses if none is given
+#define SHELLBIN_DEFAULT_FRACTION	0.002
+#define SHELLBIN_OCT_MAX	127
+
+extern int write_shell_binary (
+    stp2webgl_opts * opts,
+    stp2webgl_shell * const * chunks,
+    unsigned count,
+    FILE * fd
+    );
+
+extern void encode_shell_binary (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell,
+    stp2webgl_buffer * buf
+    );
+
+extern int decode_shell_binary (
+    const unsigned char * data,
+    size_t sz,
+    stp2webgl_shell * shell
+    );
+
+extern int shell_colors_batched (const stp2webgl_shell * shell);
+
+
+//======================================================================
+// Octahedral normal encoding.  The unit sphere is projected onto an
+// octahedron and unfolded into a square, which is then stored as two
+// signed bytes.  We check the neighboring grid points and keep the
+// one that decodes closest to the original direction.
+//
+
+static double sign_not_zero (double val)
+{
+    return (val < 0.)? -1.: 1.;
+}
+
+static void oct_decode (double n[3], int u, int v)
+{
+    double x = (double) u / SHELLBIN_OCT_MAX;
+    double y = (double) v / SHELLBIN_OCT_MAX;
+    double z = 1. - fabs(x) - fabs(y);
+
+    if (z < 0.) {
+	double tx = (1. - fabs(y)) * sign_not_zero(x);
+	double ty = (1. - fabs(x)) * sign_not_zero(y);
+	x = tx;  y = ty;
+    }
+
+    double len = sqrt (x*x + y*y + z*z);
+    n[0] = x / len;
+    n[1] = y / len;
+    n[2] = z / len;
+}
+
+static int clamp_oct (int val)
+{
+    if (val < -SHELLBIN_OCT_MAX) return -SHELLBIN_OCT_MAX;
+    if (val > SHELLBIN_OCT_MAX) return SHELLBIN_OCT_MAX;
+    return val;
+}
+
+static void oct_encode (int * eu, int * ev, const double n[3])
+{
+    double l1 = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+    if (l1 == 0.) {
+	*eu = *ev = 0;
+	return;
+    }
+
+    double u = n[0] / l1;
+    double v = n[1] / l1;
+
+    if (n[2] < 0.) {
+	double tu = (1. - fabs(v)) * sign_not_zero(u);
+	double tv = (1. - fabs(u)) * sign_not_zero(v);
+	u = tu;  v = tv;
+    }
+
+    int base_u = (int) floor (u * SHELLBIN_OCT_MAX);
+    int base_v = (int) floor (v * SHELLBIN_OCT_MAX);
+    double best = -2.;
+    unsigned i,j;
+
+    *eu = clamp_oct(base_u);
+    *ev = clamp_oct(base_v);
+
+    for (i=0; i<2; i++) {
+	for (j=0; j<2; j++) {
+	    double d[3];
+	    int cu = clamp_oct(base_u + i);
+	    int cv = clamp_oct(base_v + j);
+
+	    oct_decode (d, cu, cv);
+	    double dot = d[0]*n[0] + d[1]*n[1] + d[2]*n[2];
+	    if (dot > best) {
+		best = dot;
+		*eu = cu;
+		*ev = cv;
+	    }
+	}
+    }
+}
+
+
+//======================================================================
+// Position quantization.  Returns the largest distance between an
+// original vertex and its dequantized value.
+//
+
+static unsigned quantize (double val, double origin, double scale)
+{
+    if (scale == 0.) return 0;
+
+    double q = floor ((val - origin) / scale + 0.5);
+    if (q < 0.) return 0;
+    if (q > SHELLBIN_QUANT_MAX) return SHELLBIN_QUANT_MAX;
+    return (unsigned) q;
+}
+
+static double quantize_error (
+    const stp2webgl_shell * shell,
+    const double origin[3],
+    const double scale[3]
+    )
+{
+    unsigned i,sz,k;
+    double maxerr = 0.;
+
+    for (i=0, sz=shell->getVertexCount(); i<sz; i++)
+    {
+	const double * pt = shell->getVertex(i);
+	double err = 0.;
+	for (k=0; k<3; k++) {
+	    double q = origin[k] + scale[k] * quantize (pt[k], origin[k], scale[k]);
+	    err += (q - pt[k]) * (q - pt[k]);
+	}
+	if (err > maxerr) maxerr = err;
+    }
+    return sqrt(maxerr);
+}
+
+
+// The faceting tolerance as a distance.  The mesher takes a fractional
+// tolerance against each curve and surface, none of which is bigger
+// than the shell, so like the error given in the index for detail
+// levels, use the fraction of the shell diagonal.  Small faces are
+// faceted more tightly than that, but their deviation is still within
+// this bound for the shell as a whole.
+static double position_tolerance (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell
+    )
+{
+    StixMeshBoundingBox bbox;
+
+    if (opts->tolerance > 0.)
+	return opts->tolerance;
+
+    double frac = opts->tol_fraction;
+    if (frac <= 0.) frac = SHELLBIN_DEFAULT_FRACTION;
+
+    shell->getBoundingBox(&bbox);
+    return frac * bbox.diagonal();
+}
+
+
+static void put_index (stp2webgl_buffer * buf, unsigned idx, int short_index)
+{
+    if (short_index)
+	buf->putU16 ((idx == ROSE_NOTFOUND)? 0xffff: idx);
+    else
+	buf->putU32 (idx);
+}
+
+static unsigned get_index (stp2webgl_reader * rd, int short_index)
+{
+    if (short_index) {
+	unsigned idx = rd->getU16();
+	return (idx == 0xffff)? ROSE_NOTFOUND: idx;
+    }
+    return (unsigned) rd->getU32();
+}
+
+
+// Append a compressed section as a byte length and the data
+static void put_section (stp2webgl_buffer * buf, const stp2webgl_buffer * sec)
+{
+    buf->putU32 (sec->size());
+    buf->putBytes (sec->data(), sec->size());
+    buf->align(4);
+}
+
+
+// Meshlet table, with the vertices renumbered if a remap is given
+static void put_meshlets (
+    stp2webgl_buffer * buf,
+    const stp2webgl_meshlets * ml,
+    const unsigned * vremap,
+    int short_index
+    )
+{
+    unsigned i,k;
+
+    buf->putU32 (ml->count);
+    buf->putU32 (ml->vert_count);
+    for (i=0; i<ml->count; i++)
+    {
+	const stp2webgl_meshlet * m = ml->meshlets + i;
+	buf->putU32 (m->vert_first);
+	buf->putU32 (m->tri_first);
+	buf->putU16 (m->vert_count);
+	buf->putU16 (m->tri_count);
+	for (k=0; k<3; k++) buf->putF32 (m->center[k]);
+	buf->putF32 (m->radius);
+	for (k=0; k<3; k++) buf->putF32 (m->cone_axis[k]);
+	buf->putF32 (m->cone_cutoff);
+    }
+
+    for (i=0; i<ml->vert_count; i++) {
+	unsigned v = ml->verts[i];
+	put_index (buf, vremap? vremap[v]: v, short_index);
+    }
+    buf->align(4);
+
+    buf->putBytes (ml->tris, ml->tri_count*3);
+    buf->align(4);
+}
+
+
+// Picking tree over the facets, built from the positions the way a
+// client will decode them.  The boxes are padded a little for float
+// rounding on the client.
+static void put_bvh (
+    stp2webgl_opts * opts,
+    stp2webgl_buffer * buf,
+    const stp2webgl_shell * shell,
+    unsigned flags,
+    const double origin[3],
+    const double scale[3]
+    )
+{
+    unsigned i,j,k;
+    unsigned fcount = shell->getFacetCount();
+    double start = stats_time();
+    StixMeshBoundingBox bbox;
+
+    float * tris = new float[9*fcount];
+    unsigned * ids = new unsigned[fcount];
+
+    for (i=0; i<fcount; i++)
+    {
+	const unsigned * f = shell->getFacet(i);
+	for (j=0; j<3; j++) {
+	    const double * pt = shell->getVertex(f[j]);
+	    for (k=0; k<3; k++) {
+		if (flags & SHELLBIN_FLOAT_POSITIONS)
+		    tris[9*i+3*j+k] = (float) (pt[k] - origin[k]);
+		else
+		    tris[9*i+3*j+k] = (float) (
+			scale[k] * quantize (pt[k], origin[k], scale[k])
+			);
+	    }
+	}
+	ids[i] = i;
+    }
+
+    stp2webgl_bvh bvh;
+    bvh.build (tris, ids, fcount, opts->threads);
+
+    shell->getBoundingBox(&bbox);
+    float pad = (float) (bbox.diagonal() * 1e-6);
+
+    buf->putU32 (bvh.node_count);
+    buf->putU32 (bvh.tri_count);
+    for (i=0; i<bvh.node_count; i++)
+    {
+	const stp2webgl_bvh_node * n = bvh.nodes + i;
+	for (k=0; k<3; k++) buf->putF32 (n->lo[k] - pad);
+	for (k=0; k<3; k++) buf->putF32 (n->hi[k] + pad);
+	buf->putU32 (n->first);
+	buf->putU32 (n->count);
+    }
+
+    for (i=0; i<bvh.tri_count; i++)
+	buf->putU32 (bvh.ids[i]);
+
+    stats_add ("bvh facets", fcount);
+    stats_add ("bvh nodes", bvh.node_count);
+    stats_add ("bvh seconds", stats_time() - start);
+}
+
+
+static void encode_compressed (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell,
+    stp2webgl_buffer * buf,
+    unsigned flags,
+    const double origin[3],
+    const double scale[3],
+    const stp2webgl_meshlets * ml
+    )
+{
+    unsigned i,k;
+    unsigned vcount = shell->getVertexCount();
+    unsigned ncount = shell->getNormalCount();
+    unsigned fcount = shell->getFacetCount();
+    unsigned gcount = shell->getFaceCount();
+
+    unsigned * vorder = new unsigned[vcount+1];
+    unsigned * vremap = new unsigned[vcount+1];
+    unsigned * norder = new unsigned[ncount+1];
+    unsigned * nremap = new unsigned[ncount+1];
+    unsigned * idx = new unsigned[fcount*3+1];
+    int * vals = new int[(vcount > ncount? vcount: ncount)*3+1];
+
+    stp2webgl_buffer sec;
+
+    codec_first_use_order (
+	shell->facets._buffer(), fcount*3, vcount, vorder, vremap
+	);
+    codec_first_use_order (
+	shell->facet_normals._buffer(), fcount*3, ncount, norder, nremap
+	);
+
+    // positions
+    for (i=0; i<vcount; i++)
+    {
+	const double * pt = shell->getVertex(vorder[i]);
+	for (k=0; k<3; k++) {
+	    if (flags & SHELLBIN_FLOAT_POSITIONS)
+		sec.putF32 (pt[k] - origin[k]);
+	    else
+		vals[i*3+k] = quantize (pt[k], origin[k], scale[k]);
+	}
+    }
+    if (!(flags & SHELLBIN_FLOAT_POSITIONS))
+	codec_encode_deltas (&sec, vals, vcount, 3);
+    put_section (buf, &sec);
+
+    // normals
+    sec.reset();
+    for (i=0; i<ncount; i++)
+	oct_encode (&vals[i*2], &vals[i*2+1], shell->getNormal(norder[i]));
+    codec_encode_deltas (&sec, vals, ncount, 2);
+    put_section (buf, &sec);
+
+    // vertex indices
+    sec.reset();
+    for (i=0; i<fcount*3; i++)
+	idx[i] = vremap[shell->facets.get(i)];
+    codec_encode_indices (&sec, idx, fcount*3);
+    put_section (buf, &sec);
+
+    // normal indices
+    sec.reset();
+    for (i=0; i<fcount*3; i++) {
+	unsigned n = shell->facet_normals.get(i);
+	idx[i] = (n == ROSE_NOTFOUND)? ncount: nremap[n];
+    }
+    codec_encode_indices (&sec, idx, fcount*3);
+    put_section (buf, &sec);
+
+    // face groups
+    sec.reset();
+    for (i=0; i<gcount; i++)
+    {
+	sec.putU32 (shell->face_first.get(i));
+	sec.putU32 (shell->face_count.get(i));
+	sec.putU32 (shell->face_color.get(i));
+	sec.putU32 (shell->face_ids.get(i));
+    }
+    put_section (buf, &sec);
+
+    if (flags & SHELLBIN_MESHLETS)
+	put_meshlets (buf, ml, vremap, (flags & SHELLBIN_SHORT_INDEX) != 0);
+
+    if (flags & SHELLBIN_BVH)
+	put_bvh (opts, buf, shell, flags, origin, scale);
+
+    delete [] vorder;
+    delete [] vremap;
+    delete [] norder;
+    delete [] nremap;
+    delete [] idx;
+    delete [] vals;
+}
+
+
+void encode_shell_binary (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell,
+    stp2webgl_buffer * buf
+    )
+{
+    unsigned i,sz,k;
+    unsigned flags = 0;
+    StixMeshBoundingBox bbox;
+    double origin[3] = { 0., 0., 0. };
+    double scale[3] = { 0., 0., 0. };
+
+    unsigned vcount = shell->getVertexCount();
+    unsigned ncount = shell->getNormalCount();
+    unsigned fcount = shell->getFacetCount();
+    unsigned gcount = shell->getFaceCount();
+
+    if (vcount)
+    {
+	shell->getBoundingBox(&bbox);
+	origin[0] = bbox.minx;
+	origin[1] = bbox.miny;
+	origin[2] = bbox.minz;
+	scale[0] = (bbox.maxx - bbox.minx) / SHELLBIN_QUANT_MAX;
+	scale[1] = (bbox.maxy - bbox.miny) / SHELLBIN_QUANT_MAX;
+	scale[2] = (bbox.maxz - bbox.minz) / SHELLBIN_QUANT_MAX;
+    }
+
+    // Keep within the faceting tolerance.  Sixteen bits is usually
+    // plenty, but a very large shell with a very tight tolerance may
+    // need full floats.
+    if (vcount &&
+	quantize_error (shell, origin, scale) > position_tolerance (opts, shell))
+    {
+	stats_add ("float fallback shells", 1);
+	flags |= SHELLBIN_FLOAT_POSITIONS;
+	scale[0] = scale[1] = scale[2] = 1.;
+    }
+
+    // Leave the largest value free as the "no normal" marker
+    if (vcount <= 0xffff && ncount < 0xffff)
+	flags |= SHELLBIN_SHORT_INDEX;
+
+    if (opts->do_compress)
+	flags |= SHELLBIN_COMPRESSED;
+
+    if (shell->fallback)
+	flags |= SHELLBIN_FALLBACK;
+
+    stp2webgl_meshlets ml;
+    if (opts->do_meshlets && fcount)
+    {
+	ml.build (shell);
+	flags |= SHELLBIN_MESHLETS;
+	stats_add ("meshlets", ml.count);
+	stats_add ("meshlet vertex refs", ml.vert_count);
+    }
+
+    if (opts->do_bvh && fcount)
+	flags |= SHELLBIN_BVH;
+
+    // only if the groups really came out in color runs
+    if (opts->do_batch && shell_colors_batched (shell))
+	flags |= SHELLBIN_BATCHED;
+
+    int short_index = (flags & SHELLBIN_SHORT_INDEX) != 0;
+
+    buf->putBytes ("SWGL", 4);
+    buf->putU32 (SHELLBIN_VERSION);
+    buf->putU32 (flags);
+    buf->putU32 (shell->solid? shell->solid->entity_id(): 0);
+    buf->putU32 (shell->color);
+    buf->putU32 (vcount);
+    buf->putU32 (ncount);
+    buf->putU32 (fcount);
+    buf->putU32 (gcount);
+    buf->putU32 (0);
+    for (k=0; k<3; k++) buf->putF64 (origin[k]);
+    for (k=0; k<3; k++) buf->putF64 (scale[k]);
+
+    if (flags & SHELLBIN_COMPRESSED) {
+	encode_compressed (opts, shell, buf, flags, origin, scale, &ml);
+	return;
+    }
+
+    for (i=0; i<vcount; i++)
+    {
+	const double * pt = shell->getVertex(i);
+	for (k=0; k<3; k++) {
+	    if (flags & SHELLBIN_FLOAT_POSITIONS)
+		buf->putF32 (pt[k] - origin[k]);
+	    else
+		buf->putU16 (quantize (pt[k], origin[k], scale[k]));
+	}
+    }
+    buf->align(4);
+
+    for (i=0; i<ncount; i++)
+    {
+	int u, v;
+	oct_encode (&u, &v, shell->getNormal(i));
+	buf->putU8 ((unsigned char)(signed char) u);
+	buf->putU8 ((unsigned char)(signed char) v);
+    }
+    buf->align(4);
+
+    for (i=0, sz=fcount*3; i<sz; i++)
+	put_index (buf, shell->facets.get(i), short_index);
+    buf->align(4);
+
+    for (i=0, sz=fcount*3; i<sz; i++)
+	put_index (buf, shell->facet_normals.get(i), short_index);
+    buf->align(4);
+
+    for (i=0; i<gcount; i++)
+    {
+	buf->putU32 (shell->face_first.get(i));
+	buf->putU32 (shell->face_count.get(i));
+	buf->putU32 (shell->face_color.get(i));
+	buf->putU32 (shell->face_ids.get(i));
+    }
+
+    if (flags & SHELLBIN_MESHLETS)
+	put_meshlets (buf, &ml, 0, short_index);
+
+    if (flags & SHELLBIN_BVH)
+	put_bvh (opts, buf, shell, flags, origin, scale);
+}
+
+
+
+//======================================================================
+// Reference decoder -- fills in an empty shell from a payload.  The
+// STEP solid is not available, so shell->solid is left null.
+// Returns zero on success.
+//
+
+static int get_section (stp2webgl_reader * rd, stp2webgl_reader * sec)
+{
+    size_t sz = rd->getU32();
+    const unsigned char * data = rd->getBytes(sz);
+    rd->align(4);
+
+    *sec = stp2webgl_reader (data, data? sz: 0);
+    return rd->error();
+}
+
+static void add_vertex (
+    stp2webgl_shell * shell,
+    unsigned flags,
+    const double origin[3],
+    const double scale[3],
+    double vals[3]
+    )
+{
+    unsigned k;
+    for (k=0; k<3; k++) {
+	if (flags & SHELLBIN_FLOAT_POSITIONS)
+	    shell->verts.append(origin[k] + vals[k]);
+	else
+	    shell->verts.append(origin[k] + scale[k] * vals[k]);
+    }
+}
+
+static void add_normal (stp2webgl_shell * shell, int u, int v)
+{
+    double n[3];
+    oct_decode (n, u, v);
+    shell->normals.append(n[0]);
+    shell->normals.append(n[1]);
+    shell->normals.append(n[2]);
+}
+
+static void add_group (stp2webgl_shell * shell, stp2webgl_reader * rd)
+{
+    shell->face_first.append(rd->getU32());
+    shell->face_count.append(rd->getU32());
+    shell->face_color.append(rd->getU32());
+    shell->face_ids.append(rd->getU32());
+}
+
+
+// Check the meshlet table against the shell.  The meshlets are not
+// kept, since the shell has no place for them.
+static int check_meshlets (
+    stp2webgl_reader * rd,
+    unsigned vcount,
+    unsigned fcount,
+    int short_index
+    )
+{
+    unsigned i,j;
+    int err = 0;
+
+    unsigned count = rd->getU32();
+    unsigned refs = rd->getU32();
+    unsigned next_tri = 0;
+    unsigned next_vert = 0;
+    unsigned * sizes = new unsigned[fcount+1];
+
+    if (count > fcount || refs > fcount*3) {
+	delete [] sizes;
+	return 1;
+    }
+
+    // the meshlets must cover the facets in order
+    for (i=0; i<count; i++)
+    {
+	unsigned vfirst = rd->getU32();
+	unsigned tfirst = rd->getU32();
+	unsigned vnum = rd->getU16();
+	unsigned tnum = rd->getU16();
+	rd->getBytes(32);
+
+	if (vfirst != next_vert || tfirst != next_tri || !tnum ||
+	    vnum > 256 || tnum > fcount - next_tri)
+	    err = 1;
+	for (j=0; !err && j<tnum; j++)
+	    sizes[tfirst + j] = vnum;
+
+	next_vert += vnum;
+	next_tri += tnum;
+    }
+    if (next_tri != fcount || next_vert != refs)
+	err = 1;
+
+    for (i=0; i<refs; i++) {
+	if (get_index (rd, short_index) >= vcount) err = 1;
+    }
+    rd->align(4);
+
+    const unsigned char * tris = rd->getBytes(fcount*3);
+    rd->align(4);
+    for (i=0; tris && !err && i<fcount*3; i++) {
+	if (tris[i] >= sizes[i/3]) err = 1;
+    }
+
+    delete [] sizes;
+    return err | rd->error();
+}
+
+
+// Check the structure of the picking tree
+static int check_bvh (stp2webgl_reader * rd, unsigned fcount)
+{
+    unsigned i;
+    int err = 0;
+
+    unsigned count = rd->getU32();
+    unsigned slots = rd->getU32();
+    if (slots != fcount || count > 2*fcount || (fcount && !count))
+	return 1;
+
+    for (i=0; i<count; i++)
+    {
+	rd->getBytes(24);
+	unsigned first = rd->getU32();
+	unsigned num = rd->getU32();
+
+	if (num) {
+	    if (first > slots || num > slots - first) err = 1;
+	}
+	else if (first <= i+1 || first >= count)
+	    err = 1;
+    }
+
+    for (i=0; i<slots; i++) {
+	if (rd->getU32() >= fcount) err = 1;
+    }
+    return err | rd->error();
+}
+
+
+static int decode_compressed (
+    stp2webgl_reader * rd,
+    stp2webgl_shell * shell,
+    unsigned flags,
+    unsigned vcount,
+    unsigned ncount,
+    unsigned fcount,
+    unsigned gcount,
+    const double origin[3],
+    const double scale[3]
+    )
+{
+    unsigned i, k;
+    int err = 0;
+    stp2webgl_reader sec (0, 0);
+
+    int * vals = new int[(vcount > ncount? vcount: ncount)*3+1];
+    unsigned * idx = new unsigned[fcount*3+1];
+
+    // positions
+    err |= get_section (rd, &sec);
+    if (flags & SHELLBIN_FLOAT_POSITIONS) {
+	for (i=0; i<vcount; i++) {
+	    double pt[3];
+	    for (k=0; k<3; k++) pt[k] = sec.getF32();
+	    add_vertex (shell, flags, origin, scale, pt);
+	}
+    }
+    else {
+	err |= codec_decode_deltas (&sec, vals, vcount, 3);
+	for (i=0; i<vcount; i++) {
+	    double pt[3];
+	    for (k=0; k<3; k++) pt[k] = vals[i*3+k];
+	    add_vertex (shell, flags, origin, scale, pt);
+	}
+    }
+    err |= sec.error();
+
+    // normals
+    err |= get_section (rd, &sec);
+    err |= codec_decode_deltas (&sec, vals, ncount, 2);
+    for (i=0; i<ncount; i++)
+	add_normal (shell, vals[i*2], vals[i*2+1]);
+
+    // vertex indices
+    err |= get_section (rd, &sec);
+    err |= codec_decode_indices (&sec, idx, fcount*3);
+    for (i=0; i<fcount*3 && !err; i++) {
+	if (idx[i] >= vcount) err = 1;
+	shell->facets.append(idx[i]);
+    }
+
+    // normal indices
+    err |= get_section (rd, &sec);
+    err |= codec_decode_indices (&sec, idx, fcount*3);
+    for (i=0; i<fcount*3 && !err; i++) {
+	if (idx[i] > ncount) err = 1;
+	shell->facet_normals.append(
+	    (idx[i] == ncount)? ROSE_NOTFOUND: idx[i]
+	    );
+    }
+
+    // face groups
+    err |= get_section (rd, &sec);
+    for (i=0; i<gcount; i++)
+	add_group (shell, &sec);
+    err |= sec.error();
+
+    if (!err && (flags & SHELLBIN_MESHLETS))
+	err |= check_meshlets (
+	    rd, vcount, fcount, (flags & SHELLBIN_SHORT_INDEX) != 0
+	    );
+
+    if (!err && (flags & SHELLBIN_BVH))
+	err |= check_bvh (rd, fcount);
+
+    delete [] vals;
+    delete [] idx;
+    return err;
+}
+
+
+int decode_shell_binary (
+    const unsigned char * data,
+    size_t sz,
+    stp2webgl_shell * shell
+    )
+{
+    unsigned i,k;
+    stp2webgl_reader rd (data, sz);
+    double origin[3];
+    double scale[3];
+
+    const unsigned char * magic = rd.getBytes(4);
+    if (!magic || memcmp (magic, "SWGL", 4))
+	return 1;
+
+    if (rd.getU32() != SHELLBIN_VERSION)
+	return 1;
+
+    unsigned flags = rd.getU32();
+    rd.getU32();	// entity id
+    shell->color = rd.getU32();
+    shell->fallback = (flags & SHELLBIN_FALLBACK) != 0;
+
+    unsigned vcount = rd.getU32();
+    unsigned ncount = rd.getU32();
+    unsigned fcount = rd.getU32();
+    unsigned gcount = rd.getU32();
+    rd.getU32();
+
+    for (k=0; k<3; k++) origin[k] = rd.getF64();
+    for (k=0; k<3; k++) scale[k] = rd.getF64();
+
+    if (rd.error())
+	return 1;
+
+    if (flags & SHELLBIN_COMPRESSED) {
+	return decode_compressed (
+	    &rd, shell, flags, vcount, ncount, fcount, gcount, origin, scale
+	    );
+    }
+
+    int short_index = (flags & SHELLBIN_SHORT_INDEX) != 0;
+
+    for (i=0; i<vcount; i++)
+    {
+	double pt[3];
+	for (k=0; k<3; k++) {
+	    if (flags & SHELLBIN_FLOAT_POSITIONS)
+		pt[k] = rd.getF32();
+	    else
+		pt[k] = rd.getU16();
+	}
+	add_vertex (shell, flags, origin, scale, pt);
+    }
+    rd.align(4);
+
+    for (i=0; i<ncount; i++)
+    {
+	int u = (signed char) rd.getU8();
+	int v = (signed char) rd.getU8();
+	add_normal (shell, u, v);
+    }
+    rd.align(4);
+
+    for (i=0; i<fcount*3; i++)
+	shell->facets.append(get_index (&rd, short_index));
+    rd.align(4);
+
+    for (i=0; i<fcount*3; i++)
+	shell->facet_normals.append(get_index (&rd, short_index));
+    rd.align(4);
+
+    for (i=0; i<gcount; i++)
+	add_group (shell, &rd);
+
+    if (!rd.error() && (flags & SHELLBIN_MESHLETS) &&
+	check_meshlets (&rd, vcount, fcount, short_index))
+	return 1;
+
+    if (!rd.error() && (flags & SHELLBIN_BVH))
+	return check_bvh (&rd, fcount);
+
+    return rd.error();
+}
+
+
+
+//======================================================================
+// Round trip check -- decode the payload and compare each facet
+// corner with the original.  The vertex order may differ, so compare
+// positions through the facets rather than the vertex tables.
+// Returns the number of problems found.
+//
+
+// normals within about two degrees of the original
+#define VERIFY_NORMAL_DOT	0.9994
+
+static unsigned verify_shell_binary (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell,
+    const stp2webgl_buffer * buf
+    )
+{
+    unsigned i,k;
+    unsigned bad = 0;
+    stp2webgl_shell out;
+    StixMeshBoundingBox bbox;
+
+    if (decode_shell_binary (buf->data(), buf->size(), &out))
+	return 1;
+
+    if (out.getVertexCount() != shell->getVertexCount() ||
+	out.getNormalCount() != shell->getNormalCount() ||
+	out.getFacetCount() != shell->getFacetCount() ||
+	out.getFaceCount() != shell->getFaceCount())
+	return 1;
+
+    for (i=0; i<shell->getFaceCount(); i++)
+    {
+	if (out.face_first[i] != shell->face_first.get(i) ||
+	    out.face_count[i] != shell->face_count.get(i) ||
+	    out.face_color[i] != shell->face_color.get(i) ||
+	    out.face_ids[i] != shell->face_ids.get(i))
+	    bad++;
+    }
+
+    // Allow the quantization step on each axis, or the tolerance as
+    // the encoder measured it if the positions were written as floats.
+    shell->getBoundingBox(&bbox);
+    double step[3];
+    step[0] = (bbox.maxx - bbox.minx) / SHELLBIN_QUANT_MAX;
+    step[1] = (bbox.maxy - bbox.miny) / SHELLBIN_QUANT_MAX;
+    step[2] = (bbox.maxz - bbox.minz) / SHELLBIN_QUANT_MAX;
+
+    double maxerr = 0.5 * sqrt (step[0]*step[0] + step[1]*step[1] +
+				step[2]*step[2]);
+    double tol = position_tolerance (opts, shell);
+    if (tol > maxerr) maxerr = tol;
+    maxerr += bbox.diagonal() * 1e-6;
+
+    for (i=0; i<shell->getFacetCount()*3; i++)
+    {
+	const double * a = shell->getVertex(shell->facets.get(i));
+	const double * b = out.getVertex(out.facets[i]);
+	double d = 0.;
+	for (k=0; k<3; k++) d += (a[k]-b[k]) * (a[k]-b[k]);
+	if (sqrt(d) > maxerr) bad++;
+
+	const double * na = shell->getNormal(shell->facet_normals.get(i));
+	const double * nb = out.getNormal(out.facet_normals[i]);
+	if (!na || !nb) {
+	    if (na != nb) bad++;
+	    continue;
+	}
+
+	double len = sqrt (na[0]*na[0] + na[1]*na[1] + na[2]*na[2]);
+	double dot = (na[0]*nb[0] + na[1]*nb[1] + na[2]*nb[2]);
+	if (len > 0. && dot < VERIFY_NORMAL_DOT * len) bad++;
+    }
+
+    return bad;
+}
+
+
+static void encode_checked (
+    stp2webgl_opts * opts,
+    const stp2webgl_shell * shell,
+    stp2webgl_buffer * buf
+    )
+{
+    double start = stats_time();
+
+    encode_shell_binary (opts, shell, buf);
+
+    stats_add ("encode seconds", stats_time() - start);
+    stats_add ("encode input bytes",
+	       shell->getVertexCount() * 12. +
+	       shell->getNormalCount() * 12. +
+	       shell->getFacetCount() * 24.);
+    stats_add ("encode output bytes", buf->size());
+
+    if (opts->do_verify)
+    {
+	unsigned bad = verify_shell_binary (opts, shell, buf);
+	stats_add ("verified shells", 1);
+	if (bad) {
+	    printf ("Shell #%lu: round trip check failed (%u problems)\n",
+		    shell->solid? shell->solid->entity_id(): 0, bad);
+	    stats_add ("verify failures", 1);
+	}
+    }
+}
+
+
+int write_shell_binary (
+    stp2webgl_opts * opts,
+    stp2webgl_shell * const * chunks,
+    unsigned count,
+    FILE * fd
+    )
+{
+    unsigned i;
+    stp2webgl_buffer buf;
+
+    if (count == 1) {
+	encode_checked (opts, chunks[0], &buf);
+	return buf.write(fd);
+    }
+
+    stp2webgl_buffer * payloads = new stp2webgl_buffer[count];
+    for (i=0; i<count; i++)
+	encode_checked (opts, chunks[i], &payloads[i]);
+
+    buf.putBytes ("SWGM", 4);
+    buf.putU32 (SHELLBIN_VERSION);
+    buf.putU32 (count);
+    for (i=0; i<count; i++)
+	buf.putU32 (payloads[i].size());
+
+    int ret = buf.write(fd);
+    for (i=0; i<count && !ret; i++)
+	ret = payloads[i].write(fd);
+
+    stats_add ("encode output bytes", buf.size());
+
+    delete [] payloads;
+    return ret;
+}
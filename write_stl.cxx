@@ -22,20 +22,27 @@
 #include <stixmesh.h>
 
 #include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "occurrence.h"
+#include "bin_buffer.h"
+#include "stl_emit.h"
 
 // write_stl() -- write a single STL file for a STEP model.  This
 // facets everything in one pass, and then work on the cached data.
-// It then recursively walks down through any assemblies, applying
-// transforms to the facet data and writing ASCII STL.
+// It then goes through every placement in the assembly, applying
+// transforms to the facet data and writing ASCII STL.  The facets
+// are formatted by worker threads, see stl_emit.h.  With -d there is
+// a file for each product instead.
 //
 
 extern void facet_all_products (stp2webgl_opts * opts);
 extern int write_ascii_stl (stp2webgl_opts * opts);
 
-static void print_mesh_for_product (
-    FILE * stlfile,
-    stp_product_definition * pd,
-    StixMtrx &starting_placement
+static void print_facets (
+    stp2webgl_buffer * buf,
+    const stp2webgl_stl_item * item,
+    unsigned first,
+    unsigned count
     );
 
 // ======================================================================
@@ -43,13 +50,13 @@ static void print_mesh_for_product (
 extern int write_ascii_stl (stp2webgl_opts * opts)
 {    
     FILE * stlfile = stdout;
-    unsigned i,sz;
+    unsigned count;
+    unsigned long facets;
+    int ret = 0;
     
+    // one file for each product
     if (opts->do_split)
-    {
-	printf ("Only single STL file output currently implemented\n");
-	return 2;
-    }
+	return stp2webgl_write_stl_parts (opts, 0, print_facets);
     
     if (opts->dstfile)
     {
@@ -72,50 +79,73 @@ extern int write_ascii_stl (stp2webgl_opts * opts)
     fputs ("\n", stlfile);
 
     // Now print the mesh details along with placement info
-    for (i=0, sz=opts->root_prods.size(); i<sz; i++)
-    {
-	// The root placement is usually the identity matrix but some
-	// systems put a standalone AP3D at the top to place the whole
-	// thing in the global space.
-	StixMtrx root_placement; 
+    stp2webgl_occurrences occs;
+    occs.build(opts);
 
-	print_mesh_for_product (stlfile, opts->root_prods[i], root_placement);
+    stp2webgl_stl_item * items = stp2webgl_stl_items(&occs, &count, &facets);
+    if (stp2webgl_emit_stl(opts, stlfile, items, count, print_facets)) {
+	printf ("Could not write output file\n");
+	ret = 2;
     }
+    delete [] items;
 
     fputs ("endsolid ", stlfile);
     if (opts-> dstfile) fputs (opts-> dstfile, stlfile);
     fputs ("\n", stlfile);
 
-    return 0;
+    // the last of the output only goes out on the close
+    if (stlfile != stdout) {
+	if ((ferror(stlfile) | fclose(stlfile)) && !ret) {
+	    printf ("Could not write output file\n");
+	    ret = 2;
+	}
+    }
+    else if (fflush(stlfile) && !ret) {
+	printf ("Could not write output file\n");
+	ret = 2;
+    }
+
+    return ret;
 }
 
 
 
 //------------------------------------------------------------
 //------------------------------------------------------------
-// PRINT THE FACET INFORMATION -- This follows the shape information
-// attached to a single product or assembly and prints it to the STL
-// file.  This is adapted from the stixmesh facet assembly sample.
-//
-// Since the shapes are in a tree that parallels the product tree, we
-// look for attached next_assembly_usage_occurrences (NAUO) that tell
-// us when we are moving into the shape of another product.
+// PRINT THE FACET INFORMATION -- This prints the facets of each
+// placed item to the STL file, moved into place by the transform
+// from the occurrence table.  This is adapted from the stixmesh facet
+// assembly sample.
 //------------------------------------------------------------
 //------------------------------------------------------------
 
 
 
+static void print_vertex (stp2webgl_buffer * buf, const double v[3])
+{
+    char line[100];
+    sprintf (line, "        vertex %.15g %.15g %.15g\n", v[0], v[1], v[2]);
+    buf->putBytes (line, strlen(line));
+}
+
+static void print_normal (stp2webgl_buffer * buf, const double n[3])
+{
+    char line[100];
+    sprintf (line, "facet normal %.15g %.15g %.15g\n", n[0], n[1], n[2]);
+    buf->putBytes (line, strlen(line));
+    buf->putBytes ("    outer loop\n", 15);
+}
+
 static void print_triangle (
-    FILE * stlfile,
+    stp2webgl_buffer * buf,
     const StixMeshFacetSet * fs,
-    StixMtrx &xform,
+    const StixMtrx &xform,
     unsigned facet_num
     )
 {
     double v[3];
     double n[3];
     const StixMeshFacet * f = fs-> getFacet(facet_num);
-    const char * vertexfmt = "        vertex %.15g %.15g %.15g\n";
 
     if (!f) return;
 
@@ -130,113 +160,61 @@ static void print_triangle (
 #else
     stixmesh_transform_dir (n, xform, fs-> getNormal(f-> facet_normal));
 #endif
-    fprintf(stlfile, "facet normal %.15g %.15g %.15g\n", n[0], n[1], n[2]);
-    
-    fputs("    outer loop\n", stlfile);
+    print_normal (buf, n);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[0]));
-    fprintf(stlfile, vertexfmt, v[0], v[1], v[2]);
+    print_vertex (buf, v);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[1]));
-    fprintf(stlfile, vertexfmt, v[0], v[1], v[2]);
+    print_vertex (buf, v);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[2]));
-    fprintf(stlfile, vertexfmt, v[0], v[1], v[2]);
-    fputs("    endloop\n", stlfile);
-    fputs("endfacet\n", stlfile);
+    print_vertex (buf, v);
+    buf->putBytes ("    endloop\nendfacet\n", 21);
 }
 
 
-
-
-static void print_mesh_for_shape (
-    FILE * stlfile,
-    stp_representation * rep,
-    StixMtrx &rep_xform
+// Same as above for a shell that did not come from the mesher, a box
+// for a solid that could not be faceted in time or tessellated
+// triangles from the file.
+static void print_shell_triangle (
+    stp2webgl_buffer * buf,
+    const stp2webgl_shell * shell,
+    const StixMtrx &xform,
+    unsigned facet_num
     )
 {
-    unsigned i, sz;
-    unsigned j, szz;
-
-    if (!rep) return;
-    
-    // Does the rep have any meshed items?  In an assembly, some reps
-    // just contain placements for transforming components. If there
-    // are solids, we should have previously generated meshes.
-    //
-    SetOfstp_representation_item * items = rep->items();
-    for (i=0, sz=items->size(); i<sz; i++) 
-    {
-	stp_representation_item  * it = items->get(i);
-	StixMeshStp * mesh = stixmesh_cache_find (it);
-	if (!mesh) continue;
-
-	const StixMeshFacetSet * fs = mesh-> getFacetSet();
-
-	for (j=0, szz=fs->getFacetCount(); j< szz; j++) {
-	    print_triangle (stlfile, fs, rep_xform, j);
-	}
-    }
-
-
-    // Go through all of the child shapes which can be attached by a
-    // shape_reprepresentation_relationship or a mapped_item.  If the
-    // relation has a NAUO associated with it, then it is the start of
-    // a different product, otherwise it is still part of the shape of
-    // this one.
-    //
-    StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
-    if (!rep_mgr) return;
-
-    for (i=0, sz=rep_mgr->child_rels.size(); i<sz; i++) 
-    {
-	stp_shape_representation_relationship * rel = rep_mgr->child_rels[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
-
-	// Move to location in enclosing asm
-	StixMtrx child_xform = stix_get_shape_usage_xform (rel);
-	child_xform = child_xform * rep_xform;
-
-	print_mesh_for_shape (stlfile, child, child_xform);
-    }
-
-
-    for (i=0, sz=rep_mgr->child_mapped_items.size(); i<sz; i++) 
-    {
-	stp_mapped_item * rel = rep_mgr->child_mapped_items[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
+    double v[3];
+    double n[3];
+    unsigned k;
+    const unsigned * f = shell-> getFacet(facet_num);
 
-	// Move to location in enclosing asm
-	StixMtrx child_xform = stix_get_shape_usage_xform (rel);
-	child_xform = child_xform * rep_xform;
+    shell->getFacetNormal(n, facet_num);
+    stixmesh_transform_dir (n, xform, n); 
+    print_normal (buf, n);
 
-	print_mesh_for_shape (stlfile, child, child_xform);
+    for (k=0; k<3; k++) {
+	stixmesh_transform (v, xform, shell-> getVertex(f[k]));
+	print_vertex (buf, v);
     }
+    buf->putBytes ("    endloop\nendfacet\n", 21);
 }
 
 
-static void print_mesh_for_product (
-    FILE * stlfile,
-    stp_product_definition * pd,
-    StixMtrx &starting_placement
-    ) 
+// Called from the worker threads, only touches the mesh data
+static void print_facets (
+    stp2webgl_buffer * buf,
+    const stp2webgl_stl_item * item,
+    unsigned first,
+    unsigned count
+    )
 {
-    // Print the shape tree for each shape associated with a product,
-    // and then follow the shape tree downward.  At each level we
-    // check the shape relationship for a link to product relations
-    // because shape side because there can be relationships there
-    // that are not linked to products.
-    //
-    unsigned i, sz;
-    StixMgrAsmProduct * pm = StixMgrAsmProduct::find(pd);
-    if (!pm) return;
+    unsigned j;
 
-    for (i=0, sz=pm->shapes.size(); i<sz; i++) 
-    {
-	stp_shape_representation * rep = pm->shapes[i];
-	print_mesh_for_shape (stlfile, rep, starting_placement);
+    for (j=first; j<first+count; j++) {
+	if (item->fs)
+	    print_triangle (buf, item->fs, *item->xform, j);
+	else
+	    print_shell_triangle (buf, item->box, *item->xform, j);
     }
 }
-
-
-
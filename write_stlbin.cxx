@@ -22,27 +22,35 @@
 #include <stixmesh.h>
 
 #include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "occurrence.h"
+#include "bin_buffer.h"
+#include "stl_emit.h"
+#include "mapped_file.h"
 
 
 // write_binary_stl() -- write a single STL file for a STEP model.
 // This facets everything in one pass, and then work on the cached
-// data.  It then recursively walks down through any assemblies,
-// applying transforms to the facet data and writing Binary STL.
+// data.  It then goes through every placement in the assembly,
+// applying transforms to the facet data and writing Binary STL.  The
+// facets are formatted by worker threads, see stl_emit.h.  With -d
+// there is a file for each product instead.
 //
 
 extern void facet_all_products (stp2webgl_opts * opts);
 extern int write_binary_stl (stp2webgl_opts * opts);
 
-static void write_float (FILE * file, double val);
-static void write_unsigned (FILE * file, unsigned val);
+// 80 byte comment and facet count, then 50 bytes for each facet
+#define STL_HEADER_SIZE		84
+#define STL_RECORD_SIZE		50
 
-static unsigned count_mesh_for_product (
-    stp_product_definition * pd
-    ) ;
-static void print_mesh_for_product (
-    FILE * stlfile,
-    stp_product_definition * pd,
-    StixMtrx &starting_placement
+static void put_unsigned (unsigned char * dst, unsigned val);
+
+static void print_facets (
+    stp2webgl_buffer * buf,
+    const stp2webgl_stl_item * item,
+    unsigned first,
+    unsigned count
     );
 
 // ======================================================================
@@ -51,15 +59,14 @@ static void print_mesh_for_product (
 extern int write_binary_stl (stp2webgl_opts * opts)
 {    
     FILE * stlfile = stdout;
-    unsigned i,sz;
-    unsigned count = 0;
+    unsigned count;
+    unsigned long facets;
     
+    // one file for each product
     if (opts->do_split)
-    {
-	printf ("Only single STL file output currently implemented\n");
-	return 2;
-    }
+	return stp2webgl_write_stl_parts (opts, 1, print_facets);
     
+    // Check the output file before the faceting rather than after
     if (opts->dstfile)
     {
 	stlfile = rose_fopen(opts->dstfile, "wb");
@@ -67,6 +74,7 @@ extern int write_binary_stl (stp2webgl_opts * opts)
 	    printf ("Could not open output file\n");
 	    return 2;
 	}
+	fclose (stlfile);
     }
 
     // Recursively facet all of the products in the root assemblies
@@ -75,126 +83,104 @@ extern int write_binary_stl (stp2webgl_opts * opts)
     //
     facet_all_products(opts);
 
-    // Now print the mesh details along with placement info
-    for (i=0, sz=opts->root_prods.size(); i<sz; i++)
-    {
-	count += count_mesh_for_product (opts->root_prods[i]);
-    }
-
-    unsigned char buf[80];
+    stp2webgl_occurrences occs;
+    occs.build(opts);
 
-    memset (buf, 0, 80);
-    strcpy ((char*)buf, "binary stl");
-    fwrite (buf, sizeof (unsigned char), 80, stlfile);
-    write_unsigned(stlfile, count);
-    
-    // Now print the mesh details along with placement info
-    for (i=0, sz=opts->root_prods.size(); i<sz; i++)
-    {
-	// The root placement is usually the identity matrix but some
-	// systems put a standalone AP3D at the top to place the whole
-	// thing in the global space.
-	StixMtrx root_placement; 
+    // Binary STL needs an upfront count, which comes with the items
+    stp2webgl_stl_item * items = stp2webgl_stl_items(&occs, &count, &facets);
 
-	print_mesh_for_product (stlfile, opts->root_prods[i], root_placement);
-    }
+    unsigned char header[STL_HEADER_SIZE];
 
-    fclose(stlfile);
-    return 0;
-}
+    memset (header, 0, STL_HEADER_SIZE);
+    strcpy ((char*)header, "binary stl");
+    put_unsigned(header+80, (unsigned) facets);
 
-
-
-//------------------------------------------------------------
-//------------------------------------------------------------
-// COUNT FACETS -- Binary STL needs an upfront count, which we
-// need to compute ahead of time.
-//
-
-unsigned count_mesh_for_shape (
-    stp_representation * rep
-    )
-{
-    unsigned i, sz;
-    unsigned count = 0;
-
-    if (!rep) return count;
-    
-    // Count any local meshes
-    SetOfstp_representation_item * items = rep->items();
-    for (i=0, sz=items->size(); i<sz; i++) 
+    // Every facet is the same size, so the whole file can be laid
+    // out in place when writing to a file.  Falls back to streaming
+    // for stdout or if the file can not be mapped.
+    //
+    if (opts->dstfile)
     {
-	stp_representation_item  * it = items->get(i);
-	StixMeshStp * mesh = stixmesh_cache_find (it);
-	if (!mesh) continue;
-
-	count +=  mesh-> getFacetSet()->getFacetCount();
-    }
-
-    // Count all of the child shapes 
-    StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
-    if (!rep_mgr) return count;
+	stp2webgl_mapped_file map;
+	size_t sz = STL_HEADER_SIZE + (size_t) facets * STL_RECORD_SIZE;
+
+	if (!map.create(opts->dstfile, sz))
+	{
+	    int ret = 0;
+
+	    memcpy (map.data(), header, STL_HEADER_SIZE);
+	    if (stp2webgl_emit_stl_fixed(
+		    opts, map.data() + STL_HEADER_SIZE, STL_RECORD_SIZE,
+		    items, count, print_facets
+		    ) || map.close())
+	    {
+		printf ("Could not write output file\n");
+		ret = 2;
+	    }
+
+	    delete [] items;
+	    return ret;
+	}
 
-    for (i=0, sz=rep_mgr->child_rels.size(); i<sz; i++) 
-    {
-	stp_shape_representation_relationship * rel = rep_mgr->child_rels[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
-	count += count_mesh_for_shape (child);
+	stlfile = rose_fopen(opts->dstfile, "wb");
+	if (!stlfile) {
+	    printf ("Could not open output file\n");
+	    delete [] items;
+	    return 2;
+	}
     }
 
-    for (i=0, sz=rep_mgr->child_mapped_items.size(); i<sz; i++) 
-    {
-	stp_mapped_item * rel = rep_mgr->child_mapped_items[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
-	count += count_mesh_for_shape (child);
+    int ret = 0;
+    fwrite (header, sizeof (unsigned char), STL_HEADER_SIZE, stlfile);
+    
+    // Now print the mesh details along with placement info
+    if (stp2webgl_emit_stl(opts, stlfile, items, count, print_facets)) {
+	printf ("Could not write output file\n");
+	ret = 2;
     }
-    return count;
-}
-
-
-unsigned count_mesh_for_product (
-    stp_product_definition * pd
-    ) 
-{
-    unsigned i, sz;
-    unsigned count = 0;
-    StixMgrAsmProduct * pm = StixMgrAsmProduct::find(pd);
-    if (!pm) return count;
+    delete [] items;
 
-    for (i=0, sz=pm->shapes.size(); i<sz; i++) 
-    {
-	stp_shape_representation * rep = pm->shapes[i];
-	count += count_mesh_for_shape (rep);
-    }
-    return count;
+    if (stlfile != stdout) fclose(stlfile);
+    return ret;
 }
 
 
 
-
 //------------------------------------------------------------
 //------------------------------------------------------------
-// PRINT THE FACET INFORMATION -- This follows the shape information
-// attached to a single product or assembly and prints it to the STL
-// file.  This is adapted from the stixmesh facet assembly sample.
-//
-// Since the shapes are in a tree that parallels the product tree, we
-// look for attached next_assembly_usage_occurrences (NAUO) that tell
-// us when we are moving into the shape of another product.
+// PRINT THE FACET INFORMATION -- This prints the facets of each
+// placed item to the STL file, moved into place by the transform
+// from the occurrence table.  This is adapted from the stixmesh facet
+// assembly sample.  The buffer writes little endian 32bit floats.
 //------------------------------------------------------------
 //------------------------------------------------------------
 
+static const unsigned char zero_record[STL_RECORD_SIZE] = { 0 };
+
+static void put_vec (stp2webgl_buffer * buf, const double v[3])
+{
+    buf->putF32 (v[0]);
+    buf->putF32 (v[1]);
+    buf->putF32 (v[2]);
+}
+
 static void print_triangle (
-    FILE * stlfile,
+    stp2webgl_buffer * buf,
     const StixMeshFacetSet * fs,
-    StixMtrx &xform,
+    const StixMtrx &xform,
     unsigned facet_num
     )
 {
     double v[3];
     double n[3];
     const StixMeshFacet * f = fs-> getFacet(facet_num);
-    if (!f) return;
+
+    // Keep a record for a missing facet so that the file matches
+    // the count in the header.
+    if (!f) {
+	buf->putBytes (zero_record, STL_RECORD_SIZE);
+	return;
+    }
 
     // The components of the triangle verticies and vertex normals are
     // given by an index into internal tables.  Apply the transform so
@@ -207,167 +193,74 @@ static void print_triangle (
 #else
     stixmesh_transform_dir (n, xform, fs-> getNormal(f-> facet_normal));
 #endif
-    write_float(stlfile, n[0]);
-    write_float(stlfile, n[1]);
-    write_float(stlfile, n[2]);
+    put_vec (buf, n);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[0]));
-    write_float(stlfile, v[0]);
-    write_float(stlfile, v[1]);
-    write_float(stlfile, v[2]);
+    put_vec (buf, v);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[1]));
-    write_float(stlfile, v[0]);
-    write_float(stlfile, v[1]);
-    write_float(stlfile, v[2]);
+    put_vec (buf, v);
 
     stixmesh_transform (v, xform, fs-> getVertex(f-> verts[2]));
-    write_float(stlfile, v[0]);
-    write_float(stlfile, v[1]);
-    write_float(stlfile, v[2]);
+    put_vec (buf, v);
 
-    putc(0, stlfile);	// 16bit zero
-    putc(0, stlfile);
+    buf->putU16 (0);	// 16bit zero
 }
 
 
-static void print_mesh_for_shape (
-    FILE * stlfile,
-    stp_representation * rep,
-    StixMtrx &rep_xform
+// Same as above for a shell that did not come from the mesher, a box
+// for a solid that could not be faceted in time or tessellated
+// triangles from the file.
+static void print_shell_triangle (
+    stp2webgl_buffer * buf,
+    const stp2webgl_shell * shell,
+    const StixMtrx &xform,
+    unsigned facet_num
     )
 {
-    unsigned i, sz;
-    unsigned j, szz;
-
-    if (!rep) return;
-    
-    // Does the rep have any meshed items?  In an assembly, some reps
-    // just contain placements for transforming components. If there
-    // are solids, we should have previously generated meshes.
-    //
-    SetOfstp_representation_item * items = rep->items();
-    for (i=0, sz=items->size(); i<sz; i++) 
-    {
-	stp_representation_item  * it = items->get(i);
-	StixMeshStp * mesh = stixmesh_cache_find (it);
-	if (!mesh) continue;
-
-	const StixMeshFacetSet * fs = mesh-> getFacetSet();
-
-	for (j=0, szz=fs->getFacetCount(); j< szz; j++) {
-	    print_triangle (stlfile, fs, rep_xform, j);
-	}
-    }
-
-
-    // Go through all of the child shapes which can be attached by a
-    // shape_reprepresentation_relationship or a mapped_item.  If the
-    // relation has a NAUO associated with it, then it is the start of
-    // a different product, otherwise it is still part of the shape of
-    // this one.
-    //
-    StixMgrAsmShapeRep * rep_mgr = StixMgrAsmShapeRep::find(rep);
-    if (!rep_mgr) return;
-
-    for (i=0, sz=rep_mgr->child_rels.size(); i<sz; i++) 
-    {
-	stp_shape_representation_relationship * rel = rep_mgr->child_rels[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
+    double v[3];
+    double n[3];
+    unsigned k;
+    const unsigned * f = shell-> getFacet(facet_num);
 
-	// Move to location in enclosing asm
-	StixMtrx child_xform = stix_get_shape_usage_xform (rel);
-	child_xform = child_xform * rep_xform;
+    shell->getFacetNormal(n, facet_num);
+    stixmesh_transform_dir (n, xform, n); 
+    put_vec (buf, n);
 
-	print_mesh_for_shape (stlfile, child, child_xform);
+    for (k=0; k<3; k++) {
+	stixmesh_transform (v, xform, shell-> getVertex(f[k]));
+	put_vec (buf, v);
     }
 
-
-    for (i=0, sz=rep_mgr->child_mapped_items.size(); i<sz; i++) 
-    {
-	stp_mapped_item * rel = rep_mgr->child_mapped_items[i];
-	stp_representation * child = stix_get_shape_usage_child_rep (rel);
-
-	// Move to location in enclosing asm
-	StixMtrx child_xform = stix_get_shape_usage_xform (rel);
-	child_xform = child_xform * rep_xform;
-
-	print_mesh_for_shape (stlfile, child, child_xform);
-    }
+    buf->putU16 (0);	// 16bit zero
 }
 
 
-static void print_mesh_for_product (
-    FILE * stlfile,
-    stp_product_definition * pd,
-    StixMtrx &starting_placement
-    ) 
+// Called from the worker threads, only touches the mesh data
+static void print_facets (
+    stp2webgl_buffer * buf,
+    const stp2webgl_stl_item * item,
+    unsigned first,
+    unsigned count
+    )
 {
-    // Print the shape tree for each shape associated with a product,
-    // and then follow the shape tree downward.  At each level we
-    // check the shape relationship for a link to product relations
-    // because shape side because there can be relationships there
-    // that are not linked to products.
-    //
-    unsigned i, sz;
-    StixMgrAsmProduct * pm = StixMgrAsmProduct::find(pd);
-    if (!pm) return;
+    unsigned j;
 
-    for (i=0, sz=pm->shapes.size(); i<sz; i++) 
-    {
-	stp_shape_representation * rep = pm->shapes[i];
-	print_mesh_for_shape (stlfile, rep, starting_placement);
+    for (j=first; j<first+count; j++) {
+	if (item->fs)
+	    print_triangle (buf, item->fs, *item->xform, j);
+	else
+	    print_shell_triangle (buf, item->box, *item->xform, j);
     }
 }
 
 
 
-//------------------------------------------------------------
-//------------------------------------------------------------
-// Binary utilities -- Binary STL uses little endian 32bit float, and
-// little endan 32bit unsigned integer. This matches the common intel
-// usage for windows, mac and linux.  We swap big endian if working on
-// aix, sparc, hpux or ppc macs.
-//------------------------------------------------------------
-//------------------------------------------------------------
-
-#if defined(_AIX) || defined(__sparc) || defined(__hpux)
-#define BIG_ENDIAN
-#endif
-
-#ifdef __APPLE__
-#if defined (__ppc__) || defined(__ppc64__)
-#define BIG_ENDIAN
-#endif
-#endif
-
-static void write_float (FILE * file, double val)
-{    
-    union {
-	float 		float_elem;	/* assume 32bit float */
-	unsigned char  	words[4];
-    } olbuf;
-
-    olbuf.float_elem = (float) val;
-
-#ifdef BIG_ENDIAN
-    putc (olbuf.words[3], file);
-    putc (olbuf.words[2], file);
-    putc (olbuf.words[1], file);
-    putc (olbuf.words[0], file);
-#else
-    putc (olbuf.words[0], file);
-    putc (olbuf.words[1], file);
-    putc (olbuf.words[2], file);
-    putc (olbuf.words[3], file);
-#endif
-}
-
-static void write_unsigned (FILE * file, unsigned val)
+static void put_unsigned (unsigned char * dst, unsigned val)
 {    
     // shifts work properly regardless of endian-ness
-    putc (val & 0xff, file);
-    putc ((val >> 8) & 0xff, file);
-    putc ((val >> 16) & 0xff, file);
-    putc ((val >> 24) & 0xff, file);
+    dst[0] = val & 0xff;
+    dst[1] = (val >> 8) & 0xff;
+    dst[2] = (val >> 16) & 0xff;
+    dst[3] = (val >> 24) & 0xff;
 }
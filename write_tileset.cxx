@@ -0,0 +1,402 @@
+/* $RCSfile: $
+ * $Revision: $ $Date: $
+ *
+ * Copyright (c) 1991-2015 by STEP Tools Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stp_schema.h>
+#include <stix.h>
+#include <stixmesh.h>
+#include <math.h>
+#include <float.h>
+#include <atomic>
+
+#include "stp2webgl.h"
+#include "tileset.h"
+#include "parallel.h"
+#include "stats.h"
+
+// write_tileset() -- organize the shell placements of an assembly
+// into an octree of tiles so that a client can stream in only what
+// is near the camera.  Used by the webxml driver for the -tiles
+// option.  The layout follows the 3D Tiles tileset, but the tile
+// contents are small XML files that refer to the shell files rather
+// than carrying geometry of their own.
+//
+// The tree is a loose octree.  A tile is split into octants when it
+// holds more than the -tiles limit, and each placement moves down
+// into the octant that holds all of it.  Placements that straddle a
+// split stay in the parent, so tiles refine by adding their children
+// to what is already shown ("refine": "ADD").  The bounding box of a
+// tile covers its own placements and all of its children.  The
+// geometric error of a tile is the size of the largest placement
+// below it, which is what goes missing if the children are not drawn.
+//
+// tileset.json
+//
+//   { "asset": { "version": "1.0", "generator": "stp2webgl" },
+//     "geometricError": <root error>,
+//     "root": <tile> }
+//
+//   <tile> = { "boundingVolume": { "box": [ center, x half axis,
+//                                           y half axis, z half axis ] },
+//              "geometricError": <error>,
+//              "refine": "ADD",
+//              "content": { "uri": "tile_<n>.xml" },
+//              "children": [ <tile>, ... ] }
+//
+// tile_<n>.xml
+//
+//   <tile id="n" bbox="...">
+//     <instance shell="id123" href="shell_id123.xml" bbox="..."
+//               xform="16 numbers, same as the index child elements"
+//               [hidden="1"]/>
+//   </tile>
+//
+// The tile files are written by worker threads, one tile at a time.
+//
+
+#define TILE_MAX_DEPTH	12
+
+
+struct tile_node {
+    double lo[3];		// octree cell
+    double hi[3];
+    double blo[3];		// box around the contents and children
+    double bhi[3];
+    double largest;		// biggest placement here and below
+    double error;		// biggest placement below
+    unsigned depth;
+    rose_uint_vector items;
+    rose_uint_vector children;
+
+    tile_node() : largest(0.), error(0.), depth(0) {}
+};
+
+struct tile_tree {
+    stp2webgl_opts * opts;
+    const stp2webgl_tile_item * items;
+    rose_vector nodes;
+    unsigned max_items;
+    unsigned max_depth;
+    std::atomic<unsigned> failed;	// tile files not written
+
+    tile_node * node (unsigned i) const { return (tile_node *) nodes[i]; }
+};
+
+
+static double item_size (const stp2webgl_tile_item * it)
+{
+    double dx = it->hi[0] - it->lo[0];
+    double dy = it->hi[1] - it->lo[1];
+    double dz = it->hi[2] - it->lo[2];
+    return sqrt (dx*dx + dy*dy + dz*dz);
+}
+
+// Octant of the cell that holds all of the item, or eight if none
+static unsigned item_octant (
+    const tile_node * n,
+    const stp2webgl_tile_item * it
+    )
+{
+    unsigned k;
+    unsigned oct = 0;
+
+    for (k=0; k<3; k++)
+    {
+	double mid = (n->lo[k] + n->hi[k]) / 2.;
+	if (it->lo[k] >= mid) oct |= 1 << k;
+	else if (it->hi[k] > mid) return 8;
+    }
+    return oct;
+}
+
+static void split_tile (tile_tree * tree, unsigned idx)
+{
+    unsigned i,k,sz;
+    tile_node * n = tree->node(idx);
+
+    if (n->items.size() <= tree->max_items || n->depth >= TILE_MAX_DEPTH)
+	return;
+
+    unsigned child_idx[8];
+    rose_uint_vector keep;
+
+    for (k=0; k<8; k++) child_idx[k] = ROSE_NOTFOUND;
+
+    for (i=0, sz=n->items.size(); i<sz; i++)
+    {
+	unsigned item = n->items[i];
+	unsigned oct = item_octant (n, tree->items + item);
+	if (oct == 8) {
+	    keep.append(item);
+	    continue;
+	}
+
+	if (child_idx[oct] == ROSE_NOTFOUND)
+	{
+	    tile_node * c = new tile_node;
+	    c->depth = n->depth + 1;
+	    for (k=0; k<3; k++) {
+		double mid = (n->lo[k] + n->hi[k]) / 2.;
+		c->lo[k] = (oct & (1 << k))? mid: n->lo[k];
+		c->hi[k] = (oct & (1 << k))? n->hi[k]: mid;
+	    }
+	    child_idx[oct] = tree->nodes.size();
+	    tree->nodes.append(c);
+	    n->children.append(child_idx[oct]);
+	}
+	tree->node(child_idx[oct])->items.append(item);
+    }
+
+    n->items.empty();
+    for (i=0, sz=keep.size(); i<sz; i++)
+	n->items.append(keep[i]);
+
+    if (n->depth + 1 > tree->max_depth)
+	tree->max_depth = n->depth + 1;
+
+    for (k=0; k<8; k++) {
+	if (child_idx[k] != ROSE_NOTFOUND)
+	    split_tile (tree, child_idx[k]);
+    }
+}
+
+
+// Boxes and errors from the leaves up.  Children always come after
+// their parent in the node list.
+static void finish_tiles (tile_tree * tree)
+{
+    unsigned i,j,k,sz;
+
+    for (i=tree->nodes.size(); i>0; i--)
+    {
+	tile_node * n = tree->node(i-1);
+
+	for (k=0; k<3; k++) {
+	    n->blo[k] = DBL_MAX;
+	    n->bhi[k] = -DBL_MAX;
+	}
+
+	for (j=0, sz=n->items.size(); j<sz; j++)
+	{
+	    const stp2webgl_tile_item * it = tree->items + n->items[j];
+	    for (k=0; k<3; k++) {
+		if (it->lo[k] < n->blo[k]) n->blo[k] = it->lo[k];
+		if (it->hi[k] > n->bhi[k]) n->bhi[k] = it->hi[k];
+	    }
+	    if (item_size (it) > n->largest) n->largest = item_size (it);
+	}
+
+	for (j=0, sz=n->children.size(); j<sz; j++)
+	{
+	    tile_node * c = tree->node(n->children[j]);
+	    for (k=0; k<3; k++) {
+		if (c->blo[k] < n->blo[k]) n->blo[k] = c->blo[k];
+		if (c->bhi[k] > n->bhi[k]) n->bhi[k] = c->bhi[k];
+	    }
+	    if (c->largest > n->error) n->error = c->largest;
+	    if (c->largest > n->largest) n->largest = c->largest;
+	}
+    }
+}
+
+
+
+//======================================================================
+// Tile files, written from worker threads
+//
+
+static void print_box (FILE * fd, const double lo[3], const double hi[3])
+{
+    fprintf (fd, " bbox=\"%.15g %.15g %.15g %.15g %.15g %.15g\"",
+	     lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+}
+
+static void write_tile_fn (void * ctx, unsigned idx)
+{
+    tile_tree * tree = (tile_tree *) ctx;
+    tile_node * n = tree->node(idx);
+    unsigned i,k,sz;
+
+    if (!n->items.size()) return;
+
+    char fname[100];
+    sprintf (fname, "tile_%u.xml", idx);
+
+    RoseStringObject path = tree->opts->dstdir;
+    path.cat("/");
+    path.cat(fname);
+
+    FILE * fd = rose_fopen(path, "w");
+    if (!fd) {
+	printf ("Could not open tile file %s\n", (const char *) path);
+	tree->failed++;
+	return;
+    }
+
+    fputs ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", fd);
+    fprintf (fd, "<tile id=\"%u\"", idx);
+    print_box (fd, n->blo, n->bhi);
+    fputs (">\n", fd);
+
+    for (i=0, sz=n->items.size(); i<sz; i++)
+    {
+	const stp2webgl_tile_item * it = tree->items + n->items[i];
+
+	fprintf (fd, "<instance shell=\"id%lu\" href=\"shell_id%lu.%s\"",
+		 it->shell_id, it->shell_id,
+		 tree->opts->do_binary? "bin": "xml");
+	print_box (fd, it->lo, it->hi);
+
+	fputs (" xform=\"", fd);
+	for (k=0; k<16; k++)
+	    fprintf (fd, k? " %.15g": "%.15g", it->xform[k]);
+	fputs ("\"", fd);
+
+	if (it->hidden)
+	    fputs (" hidden=\"1\"", fd);
+	fputs ("/>\n", fd);
+    }
+
+    fputs ("</tile>\n", fd);
+    if (ferror (fd) | fclose (fd)) {
+	printf ("Could not write tile file %s\n", (const char *) path);
+	tree->failed++;
+    }
+}
+
+
+//======================================================================
+// Tileset index
+//
+
+static void print_json_tile (FILE * fd, tile_tree * tree, unsigned idx, unsigned indent)
+{
+    unsigned i,k,sz;
+    tile_node * n = tree->node(idx);
+
+    double ctr[3], half[3];
+    for (k=0; k<3; k++) {
+	ctr[k] = (n->blo[k] + n->bhi[k]) / 2.;
+	half[k] = (n->bhi[k] - n->blo[k]) / 2.;
+    }
+
+    fprintf (fd, "%*s{ \"boundingVolume\": { \"box\": [ "
+	     "%.15g, %.15g, %.15g, %.15g, 0, 0, 0, %.15g, 0, 0, 0, %.15g ] },\n",
+	     indent, "", ctr[0], ctr[1], ctr[2], half[0], half[1], half[2]);
+    fprintf (fd, "%*s  \"geometricError\": %.15g,\n", indent, "", n->error);
+    fprintf (fd, "%*s  \"refine\": \"ADD\"", indent, "");
+
+    if (n->items.size())
+	fprintf (fd, ",\n%*s  \"content\": { \"uri\": \"tile_%u.xml\" }",
+		 indent, "", idx);
+
+    if (n->children.size())
+    {
+	fprintf (fd, ",\n%*s  \"children\": [\n", indent, "");
+	for (i=0, sz=n->children.size(); i<sz; i++) {
+	    if (i) fputs (",\n", fd);
+	    print_json_tile (fd, tree, n->children[i], indent + 4);
+	}
+	fprintf (fd, "\n%*s  ]", indent, "");
+    }
+    fprintf (fd, " }");
+}
+
+
+int write_tileset (
+    stp2webgl_opts * opts,
+    const stp2webgl_tile_item * items,
+    unsigned count
+    )
+{
+    unsigned i,k;
+    double start = stats_time();
+    tile_tree tree;
+
+    tree.opts = opts;
+    tree.items = items;
+    tree.max_items = opts->tile_items;
+    tree.max_depth = 0;
+    tree.failed = 0;
+
+    // root cell is a cube around everything
+    tile_node * root = new tile_node;
+    for (k=0; k<3; k++) {
+	root->lo[k] = DBL_MAX;
+	root->hi[k] = -DBL_MAX;
+    }
+    for (i=0; i<count; i++) {
+	root->items.append(i);
+	for (k=0; k<3; k++) {
+	    if (items[i].lo[k] < root->lo[k]) root->lo[k] = items[i].lo[k];
+	    if (items[i].hi[k] > root->hi[k]) root->hi[k] = items[i].hi[k];
+	}
+    }
+
+    double side = 0.;
+    for (k=0; k<3; k++)
+	if (count && root->hi[k] - root->lo[k] > side)
+	    side = root->hi[k] - root->lo[k];
+
+    for (k=0; k<3; k++) {
+	if (!count) root->lo[k] = 0.;
+	root->hi[k] = root->lo[k] + side;
+    }
+
+    tree.nodes.append(root);
+    split_tile (&tree, 0);
+    finish_tiles (&tree);
+
+    stp2webgl_parallel_for (tree.nodes.size(), write_tile_fn, &tree,
+			    opts->threads);
+
+    int ret = 0;
+    if (tree.failed) {
+	stats_add("tile write failures", tree.failed);
+	ret = 1;
+    }
+
+    RoseStringObject path = opts->dstdir;
+    path.cat("/tileset.json");
+
+    FILE * fd = rose_fopen(path, "w");
+    if (!fd) {
+	printf ("Could not open tileset file %s\n", (const char *) path);
+	ret = 1;
+    }
+    else {
+	fputs ("{ \"asset\": { \"version\": \"1.0\","
+	       " \"generator\": \"stp2webgl\" },\n", fd);
+	fprintf (fd, "  \"geometricError\": %.15g,\n", root->largest);
+	fputs ("  \"root\":\n", fd);
+	print_json_tile (fd, &tree, 0, 4);
+	fputs ("\n}\n", fd);
+	if (ferror (fd) | fclose (fd)) {
+	    printf ("Could not write tileset file %s\n", (const char *) path);
+	    ret = 1;
+	}
+    }
+
+    stats_add("tiles", tree.nodes.size());
+    stats_max("tile depth", tree.max_depth);
+    stats_add("tile seconds", stats_time() - start);
+
+    for (i=0; i<tree.nodes.size(); i++)
+	delete tree.node(i);
+
+    return ret;
+}
@@ -23,8 +23,47 @@
 
 #include <RoseXMLWriter.h>
 #include <ctype.h>
+#include <math.h>
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #include "stp2webgl.h"
+#include "shell_mesh.h"
+#include "mesh_pump.h"
+#include "mesh_bvh.h"
+#include "mesh_meshlet.h"
+#include "tileset.h"
+#include "occurrence.h"
+#include "parallel.h"
+#include "stats.h"
+
+// Each coarser level allows this many times the deviation of the
+// one before.  Detail levels need a known tolerance, so use this
+// fraction when none was given.
+#define LOD_FACTOR		4.
+#define LOD_DEFAULT_FRACTION	0.002
+#define LOD_MAX_LEVELS		8
+
+// The -budget option samples each solid at these two tolerances
+#define BUDGET_COARSE_FRACTION	0.04
+#define BUDGET_FINE_FRACTION	0.02
+
+// First pass tolerance for the -deadline option
+#define DEADLINE_COARSE_FRACTION	0.1
+
+// The -cull option facets at this tolerance and casts a grid of rays
+// this many cells across from each of this many directions.
+#define CULL_COARSE_FRACTION	0.05
+#define CULL_GRID		256
+#define CULL_DIRECTIONS		64
+
+// The -minpart option facets solids up to this many times the
+// smallest size at this tolerance.
+#define SMALL_PART_COARSEN	10.
+#define SMALL_PART_FRACTION	0.05
 
 // transfor moved into stix in latest version
 #ifndef LATEST_STDEV
@@ -43,9 +82,122 @@
 // released.  This is a more complex arrangement than just facetting
 // everything in one batch, but it may be more memory efficient.
 //
+// With the -lod option, the solids are faceted again at coarser
+// tolerances once the first pass is done.  Each level is written
+// next to the full detail shell file and listed in the index with
+// the largest deviation from the true surface, in model units, that
+// the client can project to the screen to pick a level.
+//
+// With the -budget option, everything is faceted twice at coarse
+// tolerances before the real pass to pick a tolerance for each solid
+// that brings the total facet count close to the budget.
+//
+// With the -deadline option, everything is first faceted at a very
+// coarse tolerance and the index is finished, so the output is
+// complete early on.  Then the shells are faceted again at the
+// requested tolerance, largest first, and each finer shell file is
+// moved over the coarse one.  Solids not started by the deadline, or
+// not done by then, are left coarse.
+//
+// With the -cull option, everything is first faceted at a coarse
+// tolerance and placed in the assembly, and rays are cast at it from
+// all around to find solids that can not be seen from outside.  Those
+// keep their coarse shells, marked hidden in the index so a client
+// can skip them until needed, and are left out of any later passes.
+//
+// With the -minpart option, the boundary of each solid is measured
+// before anything is faceted and placed in the assembly.  Solids that
+// are tiny compared to the whole assembly everywhere they are used
+// are skipped, and ones that are merely small are faceted coarsely.
+//
+// With the -timeout option, a solid that takes too long to facet is
+// given up and its bounding box is written in its place, marked with
+// a fallback attribute in the index and the shell.
+//
+// With the -meshlets option, the facets of each shell are also cut
+// into small clusters with a bounding sphere and normal cone for
+// cluster culling, listed after the facets or in the binary shell.
+//
+// Once the shells are written, a bounds element is added for every
+// product and shape with its box, bounding sphere, and the total
+// facets and vertices of everything under it, for culling and load
+// budgets on whole subassemblies.
+//
+// AP242 tessellated solids, shells, and surface sets already have
+// their triangles, which are copied into a shell and written at full
+// detail without going to the mesher.  They are not faceted again
+// for coarser levels or refined after a deadline, and a B-rep that
+// has a tessellation in the model is left out.
+//
+// With the -tiles option, every placement of every shell is also
+// sorted into an octree of tiles, described by a tileset.json file
+// named by a tileset element in the index, so a client can stream in
+// just the parts of a large assembly that are in view.
+//
 
 
 extern int write_webxml (stp2webgl_opts * opts);
+extern int write_shell_binary (
+    stp2webgl_opts * opts,
+    stp2webgl_shell * const * chunks,
+    unsigned count,
+    FILE * fd
+    );
+extern void reorder_shell_facets (stp2webgl_shell * shell, unsigned cache_size);
+extern unsigned batch_shell_colors (stp2webgl_shell * shell);
+extern unsigned count_color_runs (const stp2webgl_shell * shell);
+extern unsigned shell_cache_misses (
+    const stp2webgl_shell * shell,
+    unsigned cache_size
+    );
+extern stp2webgl_shell ** split_shell_chunks (
+    const stp2webgl_shell * shell,
+    unsigned max_verts,
+    unsigned * count
+    );
+extern unsigned decimate_shell (
+    stp2webgl_shell * shell,
+    unsigned target,
+    double * max_err
+    );
+extern void decimate_budgets (
+    stp2webgl_shell * const * shells,
+    unsigned count,
+    unsigned long budget,
+    unsigned * targets
+    );
+extern int stp2webgl_solid_bbox (
+    stp_representation_item * solid,
+    StixMeshBoundingBox * bbox
+    );
+extern double budget_fractions (
+    unsigned count,
+    const double * coarse_facets,
+    const double * fine_facets,
+    const double * sizes,
+    double coarse_frac,
+    double fine_frac,
+    unsigned long budget,
+    double * fracs
+    );
+extern void find_visible_ids (
+    const stp2webgl_bvh * bvh,
+    const StixMeshBoundingBox * bbox,
+    unsigned directions,
+    unsigned grid,
+    unsigned id_count,
+    unsigned char * visible,
+    unsigned nthreads
+    );
+extern void stp2webgl_part_name (
+    RoseStringObject * name,
+    stp_product_definition * pd
+    );
+extern int stp2webgl_is_tessellated (stp_representation_item * it);
+extern int stp2webgl_has_tessellation (stp_representation_item * it);
+extern const rose_vector * stp2webgl_external_shapes (
+    stp_representation * rep
+    );
 
 
 //======================================================================
@@ -103,13 +255,17 @@ static void append_refatt (
     }
 }
 
-static FILE * open_dir_file(const char * dir, const char * fname)
+static FILE * open_dir_file(
+    const char * dir,
+    const char * fname,
+    const char * mode = "w"
+    )
 {
     RoseStringObject path = dir;
     path.cat("/");
     path.cat(fname);
 
-    return fopen(path, "w");
+    return rose_fopen(path, mode);
 }
 
 
@@ -499,7 +655,9 @@ void append_shell_refs(
     for (i=0, sz=items->size(); i<sz; i++)
     {
 	stp_representation_item * it = items->get(i);
-	if (!StixMeshStpBuilder::isShell(rep, it))
+	if (!stp2webgl_is_tessellated(it) &&
+	    (!StixMeshStpBuilder::isShell(rep, it) ||
+	     stp2webgl_has_tessellation(it)))
 	    continue;
 
 	if (!count) xml->beginAttribute ("shell");
@@ -511,22 +669,17 @@ void append_shell_refs(
 }
 
 
-static void append_asm_child(
-    stp2webgl_opts * opts,
+static void append_child(
     RoseXMLWriter * xml,
-    RoseObject * rel
+    stp_representation * child,
+    const StixMtrx &xform
     )
 {
-    StixMgrAsmRelation * mgr = StixMgrAsmRelation::find(rel);
-    if (!mgr) return;
-
-    stp_representation * child = mgr->child;
+    unsigned i,j;
 
     xml->beginElement("child");
     append_refatt (xml, "ref", child);
 
-    unsigned i,j;
-    StixMtrx xform = stix_get_transform(mgr);
     xml->beginAttribute ("xform");
     for (i=0; i<4; i++) {
 	for (j=0; j<4; j++) {
@@ -538,11 +691,212 @@ static void append_asm_child(
     xml->endElement("child");
 }
 
+static void append_asm_child(
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    RoseObject * rel
+    )
+{
+    StixMgrAsmRelation * mgr = StixMgrAsmRelation::find(rel);
+    if (!mgr) return;
+
+    append_child (xml, mgr->child, stix_get_transform(mgr));
+}
+
+
+//======================================================================
+// Solids found while writing the shape structure.  They are faceted
+// once the structure is written, and again for any coarser detail
+// levels, so the list also keeps any tolerance picked for each one.
+//
+
+struct solid_key {
+    RoseObject * item;
+    unsigned idx;
+};
+
+struct solid_list {
+    rose_vector reps;
+    rose_vector items;
+    rose_real_vector fracs;	// fractional tolerance, zero for default
+    rose_real_vector sizes;	// shell diagonal from the last pass
+    rose_uint_vector hidden;	// nonzero if not seen from outside
+    rose_uint_vector small;	// nonzero if too small to facet
+    rose_uint_vector tessellated;	// nonzero if the file has the facets
+    rose_vector hidden_shells;	// coarse shell to write for those
+    rose_vector boxes;		// StixMeshBoundingBox of the written shell
+    rose_uint_vector facets;	// facets and vertices of the written shell
+    rose_uint_vector vertices;
+
+    // faces, and color runs before and after batching, of the full
+    // detail shell last written, three for each solid.  Filled in by
+    // the workers, so only summed once they are done.
+    rose_uint_vector batch;
+    std::atomic<unsigned> failed;	// shell files not written
+
+    // products and shapes written to the index, for append_bounds()
+    rose_vector products;
+    rose_vector shapes;
+
+    // each placement of a solid in the assembly, from the occurrence
+    // table, see find_all_occurrences()
+    stp2webgl_occurrences occs;
+    rose_uint_vector occ_solids;
+    rose_uint_vector occ_items;	// position in the table
+    int have_occs;
+
+    double pass_frac;		// tolerance for every solid in a pass
+    solid_key * sorted;		// items by address for find_solid()
+
+    solid_list() : failed(0), have_occs(0), pass_frac(0.), sorted(0) {}
+    ~solid_list();
+
+    unsigned size() const { return items.size(); }
+
+    stp_representation * rep (unsigned i) const {
+	return (stp_representation *) reps[i];
+    }
+    stp_representation_item * item (unsigned i) const {
+	return (stp_representation_item *) items[i];
+    }
+    const StixMtrx &occ_xform (unsigned i) const {
+	return occs.xform(occ_items[i]);
+    }
+};
+
+solid_list::~solid_list()
+{
+    unsigned i,sz;
+    for (i=0, sz=hidden_shells.size(); i<sz; i++)
+	delete (stp2webgl_shell *) hidden_shells[i];
+    for (i=0, sz=boxes.size(); i<sz; i++)
+	delete (StixMeshBoundingBox *) boxes[i];
+    delete [] sorted;
+}
+
+static void add_solid(
+    solid_list * solids,
+    stp_representation * rep,
+    stp_representation_item * ri,
+    int tessellated
+    )
+{
+    solids->reps.append(rep);
+    solids->items.append(ri);
+    solids->fracs.append(0.);
+    solids->sizes.append(0.);
+    solids->hidden.append(0);
+    solids->small.append(0);
+    solids->tessellated.append(tessellated);
+    solids->hidden_shells.append(0);
+    solids->boxes.append(0);
+    solids->facets.append(0);
+    solids->vertices.append(0);
+    solids->batch.append(0);
+    solids->batch.append(0);
+    solids->batch.append(0);
+}
+
+static int solid_key_cmp (const void * a, const void * b)
+{
+    const solid_key * ka = (const solid_key *) a;
+    const solid_key * kb = (const solid_key *) b;
+
+    if (ka->item != kb->item) return (ka->item < kb->item)? -1: 1;
+    if (ka->idx != kb->idx) return (ka->idx < kb->idx)? -1: 1;
+    return 0;
+}
+
+// Keys for a list of objects, sorted by address for find_key()
+static solid_key * sort_keys(const rose_vector &objs)
+{
+    unsigned i,sz;
+    solid_key * keys = new solid_key[objs.size()+1];
+
+    for (i=0, sz=objs.size(); i<sz; i++) {
+	keys[i].item = (RoseObject *) objs[i];
+	keys[i].idx = i;
+    }
+    qsort (keys, objs.size(), sizeof(solid_key), solid_key_cmp);
+    return keys;
+}
+
+// Position of an object in the sorted keys, or ROSE_NOTFOUND
+static unsigned find_key(
+    const solid_key * keys,
+    unsigned count,
+    RoseObject * item
+    )
+{
+    unsigned lo = 0;
+    unsigned hi = count;
+
+    while (lo < hi)
+    {
+	unsigned mid = (lo + hi) / 2;
+	if (keys[mid].item < item) lo = mid+1;
+	else hi = mid;
+    }
+
+    if (lo < count && keys[lo].item == item)
+	return keys[lo].idx;
+
+    return ROSE_NOTFOUND;
+}
+
+static void index_solids(solid_list * solids)
+{
+    delete [] solids->sorted;
+    solids->sorted = sort_keys(solids->items);
+}
+
+// Position of a solid in the list, or ROSE_NOTFOUND
+static unsigned find_solid(const solid_list * solids, RoseObject * item)
+{
+    return find_key(solids->sorted, solids->size(), item);
+}
+
+
+// Solids that are not faceted again after the first passes, and
+// tessellated ones that are never faceted at all
+static int solid_skipped(const solid_list * solids, unsigned idx)
+{
+    return solids->hidden[idx] || solids->small[idx] ||
+	solids->tessellated[idx];
+}
+
+
+// Record every placement of the solids, from the occurrence table
+// shared with the STL writers, so a solid used in several places is
+// listed once for each.
+//
+static void find_all_occurrences(
+    stp2webgl_opts * opts,
+    solid_list * solids
+    )
+{
+    unsigned i,sz;
+
+    if (solids->have_occs) return;
+    solids->have_occs = 1;
+
+    solids->occs.build(opts);
+    for (i=0, sz=solids->occs.size(); i<sz; i++)
+    {
+	unsigned idx = find_solid(solids, solids->occs.item(i));
+	if (idx == ROSE_NOTFOUND) continue;
+
+	solids->occ_solids.append(idx);
+	solids->occ_items.append(i);
+    }
+}
+
+
 
 void queue_shapes(
     stp2webgl_opts * opts,
     RoseXMLWriter * xml,
-    StixMeshStpAsyncMaker * mesher,
+    solid_list * solids,
     stp_representation * rep
     )
 {
@@ -554,6 +908,8 @@ void queue_shapes(
     StixMgrAsmShapeRep * mgr = StixMgrAsmShapeRep::find(rep);
     if (!mgr) return;
 
+    solids->shapes.append(rep);
+
     // Write facets by default, unless we have a list of reps.  In the
     // latter case only write facets if a rep is in the list.
     
@@ -590,6 +946,11 @@ void queue_shapes(
 	append_shell_refs(xml, rep);
 
     append_annotation_refs(xml, rep);
+
+    // shapes from a part file are placed right where this one is
+    const rose_vector * ext = stp2webgl_external_shapes(rep);
+    for (j=0, sz=ext? ext->size(): 0; j<sz; j++)
+	append_child(xml, (stp_representation *) (*ext)[j], StixMtrx());
     
     for (j=0, sz=mgr->child_rels.size(); j<sz; j++) 
 	append_asm_child(opts, xml, mgr->child_rels[j]);
@@ -599,18 +960,21 @@ void queue_shapes(
 
     xml->endElement("shape");
 
+    for (j=0, sz=ext? ext->size(): 0; j<sz; j++)
+	queue_shapes(opts, xml, solids, (stp_representation *) (*ext)[j]);
+
     for (j=0, sz=mgr->child_rels.size(); j<sz; j++) {
 	StixMgrAsmRelation * rm = StixMgrAsmRelation::find(
 	    mgr->child_rels[j]
 	    );
-	if (rm) queue_shapes(opts, xml, mesher, rm->child);
+	if (rm) queue_shapes(opts, xml, solids, rm->child);
     }
 
     for (j=0, sz=mgr->child_mapped_items.size(); j<sz; j++) {
 	StixMgrAsmRelation * rm = StixMgrAsmRelation::find(
 	    mgr->child_mapped_items[j]
 	    );
-	if (rm) queue_shapes(opts, xml, mesher, rm->child);
+	if (rm) queue_shapes(opts, xml, solids, rm->child);
     }
 
     
@@ -622,8 +986,11 @@ void queue_shapes(
 	for (unsigned i=0; i<sz; i++) {
 	    stp_representation_item * ri = items->get(i);
 
-	    if (StixMeshStpBuilder::canMake(rep, ri))
-		mesher->startMesh(rep, ri, &opts->mesh);
+	    if (stp2webgl_is_tessellated(ri))
+		add_solid(solids, rep, ri, 1);
+	    else if (StixMeshStpBuilder::canMake(rep, ri) &&
+		     !stp2webgl_has_tessellation(ri))
+		add_solid(solids, rep, ri, 0);
 	}    
 
 	append_annotations(opts, xml, rep);
@@ -637,29 +1004,25 @@ void queue_shapes(
 //
 static void append_facet(
     RoseXMLWriter * xml,
-    const StixMeshFacetSet * fs,
+    const stp2webgl_shell * shell,
     unsigned fidx,
     int write_normal
     )
 {
-    const StixMeshFacet * f = fs->getFacet(fidx);
-    if (!f) return;
+    const unsigned * verts = shell->getFacet(fidx);
+    const unsigned * norms = shell->getFacetNormals(fidx);
     
     xml->beginElement("f");		
     xml->beginAttribute("v");
-    append_integer(xml, f->verts[0]);    xml->text(" ");
-    append_integer(xml, f->verts[1]);    xml->text(" ");
-    append_integer(xml, f->verts[2]);
+    append_integer(xml, verts[0]);    xml->text(" ");
+    append_integer(xml, verts[1]);    xml->text(" ");
+    append_integer(xml, verts[2]);
     xml->endAttribute();    
 
     if (write_normal) {
-// facet_normal_now_computed_in_latest_versions
-#ifdef LATEST_STDEV
 	double fnorm[3];
-	fs->getFacetNormal(fnorm, fidx);
-#else
-	const double * fnorm = fs-> getNormal(f-> facet_normal);
-#endif
+	shell->getFacetNormal(fnorm, fidx);
+
 	xml->beginAttribute("fn");
 	append_double(xml, fnorm[0]);    xml->text(" ");
 	append_double(xml, fnorm[1]);    xml->text(" ");
@@ -668,12 +1031,7 @@ static void append_facet(
     }
     
     for (unsigned j=0; j<3; j++) {
-// facet_normal_now_computed_in_latest_versions
-#ifdef LATEST_STDEV
-	const double * normal = fs->getNormal(f->normals[j]);
-#else
-	const double * normal = fs->getNormal(f->vert_normals[j]);
-#endif
+	const double * normal = shell->getNormal(norms[j]);
 	if (normal)
 	{
 	    xml->beginElement("n");
@@ -689,27 +1047,97 @@ static void append_facet(
 }
 
 
-void append_shell_facets(
+static void append_bbox(
+    RoseXMLWriter * xml,
+    const StixMeshBoundingBox * bbox
+    )
+{
+    xml->beginAttribute("bbox");
+    append_double(xml, bbox->minx);    xml->text(" ");
+    append_double(xml, bbox->miny);    xml->text(" ");
+    append_double(xml, bbox->minz);    xml->text(" ");
+    append_double(xml, bbox->maxx);    xml->text(" ");
+    append_double(xml, bbox->maxy);    xml->text(" ");
+    append_double(xml, bbox->maxz);
+    xml->endAttribute();
+}
+
+
+// Meshlets follow the facets, each with the range of facets that it
+// covers, the shell vertices it uses, and the position in that list
+// of each facet corner.
+//
+static void append_meshlets(
+    RoseXMLWriter * xml,
+    const stp2webgl_shell * shell
+    )
+{
+    unsigned i,j,k;
+    stp2webgl_meshlets ml;
+
+    ml.build(shell);
+    stats_add("meshlets", ml.count);
+    stats_add("meshlet vertex refs", ml.vert_count);
+
+    xml->beginElement("meshlets");
+    for (i=0; i<ml.count; i++)
+    {
+	const stp2webgl_meshlet * m = ml.meshlets + i;
+
+	xml->beginElement("meshlet");
+	xml->beginAttribute("f");
+	append_integer(xml, m->tri_first);  xml->text(" ");
+	append_integer(xml, m->tri_count);
+	xml->endAttribute();
+
+	xml->beginAttribute("v");
+	for (j=0; j<m->vert_count; j++) {
+	    if (j) xml->text(" ");
+	    append_integer(xml, ml.verts[m->vert_first + j]);
+	}
+	xml->endAttribute();
+
+	xml->beginAttribute("t");
+	for (j=0; j<m->tri_count*3; j++) {
+	    if (j) xml->text(" ");
+	    append_integer(xml, ml.tris[m->tri_first*3 + j]);
+	}
+	xml->endAttribute();
+
+	xml->beginAttribute("sphere");
+	for (k=0; k<3; k++) {
+	    append_double(xml, m->center[k]);  xml->text(" ");
+	}
+	append_double(xml, m->radius);
+	xml->endAttribute();
+
+	xml->beginAttribute("cone");
+	for (k=0; k<3; k++) {
+	    append_double(xml, m->cone_axis[k]);  xml->text(" ");
+	}
+	append_double(xml, m->cone_cutoff);
+	xml->endAttribute();
+	xml->endElement("meshlet");
+    }
+    xml->endElement("meshlets");
+}
+
+
+static void append_shell_body(
     RoseXMLWriter * xml,
-    const StixMeshStp * shell
+    const stp2webgl_shell * shell,
+    int meshlets,
+    int batch
     )
 {
     int WRITE_NORMAL = 0;
     unsigned i,sz;
     unsigned j,szz; 
-    const StixMeshFacetSet * facets = shell->getFacetSet();
-    
-    xml->beginElement("shell");
-    append_refatt(xml, "id", shell->getStepSolid());
-
-    unsigned dflt_color = stixmesh_get_color (shell->getStepSolid());
-    if (dflt_color != STIXMESH_NULL_COLOR) 
-	append_color(xml, dflt_color);
     
     xml->beginElement("verts");
-    for (i=0, sz=facets->getVertexCount(); i<sz; i++)
+    for (i=0, sz=shell->getVertexCount(); i<sz; i++)
     {
-	const double * pt = facets->getVertex(i);
+	const double * pt = shell->getVertex(i);
 	xml->beginElement("v");
 	xml->beginAttribute("p");
 	append_double(xml, pt[0]);    xml->text(" ");
@@ -721,189 +1149,1450 @@ void append_shell_facets(
     xml->endElement("verts");
 
 
-    // The facet set has all of the facets for the shell.  Break it up
-    // into groups by step face.
+    // The shell facets are already grouped by step face, with the
+    // face color defaulted to the shell color.  Always tag the face
+    // with a color, unless everything is null.  When batching, the
+    // faces were sorted by color and each run of one color is a
+    // single group.
    
     for (i=0, sz=shell->getFaceCount(); i<sz; i++)
     {
-	const StixMeshStpFace * fi = shell->getFaceInfo(i);
-	unsigned first = fi->getFirstFacet();
-	unsigned color = stixmesh_get_color(fi->getFace());
-	if (first == ROSE_NOTFOUND)
-	    continue;
-	
-	xml->beginElement("facets");
+	unsigned first = shell->face_first.get(i);
+	unsigned color = shell->face_color.get(i);
+	unsigned count = shell->face_count.get(i);
+
+	while (batch && i+1 < sz && shell->face_color.get(i+1) == color)
+	    count += shell->face_count.get(++i);
 
-	// Always tag the face with a color, unless everything is null. 
-	if (color == STIXMESH_NULL_COLOR)
-	    color = dflt_color;
+	xml->beginElement("facets");
 
 	if (color != STIXMESH_NULL_COLOR) 
 	    append_color(xml, color);
 
-	for (j=0, szz=fi->getFacetCount(); j<szz; j++) {
-	    append_facet(xml, facets, j+first, WRITE_NORMAL);
+	for (j=0, szz=count; j<szz; j++) {
+	    append_facet(xml, shell, j+first, WRITE_NORMAL);
 	}
 	xml->endElement("facets");
     }
-    
-    xml->endElement("shell");
+
+    // The merged groups lose the STEP faces, so list the range of
+    // facets for each one to pick with.
+    if (batch && shell->getFaceCount())
+    {
+	xml->beginElement("faces");
+	for (i=0, sz=shell->getFaceCount(); i<sz; i++)
+	{
+	    xml->beginElement("face");
+	    if (shell->face_ids.get(i)) {
+		char buff[20];
+		sprintf (buff, "id%u", shell->face_ids.get(i));
+		xml->addAttribute("ref", buff);
+	    }
+	    xml->beginAttribute("f");
+	    append_integer(xml, shell->face_first.get(i));  xml->text(" ");
+	    append_integer(xml, shell->face_count.get(i));
+	    xml->endAttribute();
+	    xml->endElement("face");
+	}
+	xml->endElement("faces");
+    }
+
+    if (meshlets && shell->getFacetCount())
+	append_meshlets(xml, shell);
 }
 
 
-static void export_shell(
-    stp2webgl_opts * opts,
+// A shell that was split for 16bit indices holds one chunk element
+// per piece, each with its own vertices, facets and bounding box.
+//
+void append_shell_facets(
     RoseXMLWriter * xml,
-    const StixMeshStp * shell
+    stp2webgl_shell * const * chunks,
+    unsigned count,
+    int meshlets,
+    int batch
     )
 {
-    if (!shell) return;
+    unsigned i;
+    const stp2webgl_shell * shell = chunks[0];
 
-    if (!opts->do_split) {
-	append_shell_facets(xml, shell);
-    }
-    else
-    {
-	unsigned i,sz;
-	StixMeshBoundingBox bbox;
-	const StixMeshFacetSet * facets = shell->getFacetSet();
+    xml->beginElement("shell");
+    append_refatt(xml, "id", shell->solid);
 
-	// compute the bounding box for the shell
-	for (i=0, sz=facets->getVertexCount(); i<sz; i++)
-	{
-	    const double * pt = facets->getVertex(i);
-	    bbox.update(pt);
-	}
+    if (shell->color != STIXMESH_NULL_COLOR) 
+	append_color(xml, shell->color);
 
-	char fname[100];
-	sprintf (fname, "shell_id%lu.xml", shell->getStepSolid()->entity_id());
+    if (shell->fallback)
+	xml->addAttribute("fallback", "bbox");
 
-	xml->beginElement("shell");
-	append_refatt(xml, "id", shell->getStepSolid());
+    if (shell->hidden)
+	xml->addAttribute("hidden", "1");
 
-	xml->beginAttribute("size");
-	append_integer(xml, facets->getFacetCount());
-	xml->endAttribute();
-	
-	xml->beginAttribute("bbox");
-	append_double(xml, bbox.minx);    xml->text(" ");
-	append_double(xml, bbox.miny);    xml->text(" ");
-	append_double(xml, bbox.minz);    xml->text(" ");
-	append_double(xml, bbox.maxx);    xml->text(" ");
-	append_double(xml, bbox.maxy);    xml->text(" ");
-	append_double(xml, bbox.maxz);
-	xml->endAttribute();
+    if (count == 1) {
+	append_shell_body(xml, shell, meshlets, batch);
+    }
+    else {
+	for (i=0; i<count; i++)
+	{
+	    StixMeshBoundingBox bbox;
+	    chunks[i]->getBoundingBox(&bbox);
 
-	// append the area 
-	double area = 0.;
-	for (i=0, sz=shell->getFaceCount(); i<sz; i++) {
-	    const StixMeshStpFace * face = shell->getFaceInfo(i);
-	    area += face->getArea();
+	    xml->beginElement("chunk");
+	    append_bbox(xml, &bbox);
+	    append_shell_body(xml, chunks[i], meshlets, batch);
+	    xml->endElement("chunk");
 	}
-	xml->beginAttribute("a");
-	append_double (xml, area);
-	xml->endAttribute();    
+    }
+    
+    xml->endElement("shell");
+}
 
-	xml->addAttribute("href", fname);
-	xml->endElement("shell");
 
-	/* Write the shell in its own XML file */
-	FILE * fd = open_dir_file(opts->dstdir, fname);
-	RoseOutputFile xmlfile (fd, fname);
-	RoseXMLWriter shell_xml(&xmlfile);
-	shell_xml.escape_dots = ROSE_FALSE;
-	shell_xml.writeHeader();
+// Apply any optional rearrangement to the copy of the mesher facets.
+// Called from the worker threads for binary shells, so only touches
+// the mesh data.  Takes over the shell and returns the chunks to
+// write, which is just the shell itself unless it had to be split.
+// The batching counts go in the solid slot if given one.
+//
+static stp2webgl_shell ** prepare_shell(
+    stp2webgl_opts * opts,
+    stp2webgl_shell * shell,
+    unsigned * count,
+    unsigned * batch
+    )
+{
+    unsigned i;
+    stp2webgl_shell ** chunks = 0;
 
-	append_shell_facets(&shell_xml, shell);
+    if (opts->chunk_verts)
+	chunks = split_shell_chunks(shell, opts->chunk_verts, count);
 
-	shell_xml.close();
-	xmlfile.flush();
-	fclose(fd);
+    if (chunks) {
+	stats_add("chunked shells", 1);
+	stats_add("shell chunks", *count);
+	delete shell;
+    }
+    else {
+	chunks = new stp2webgl_shell * [1];
+	chunks[0] = shell;
+	*count = 1;
     }
-}
 
+    // After chunking, which orders the faces by position, so that
+    // each chunk has its colors together.
+    if (opts->do_batch)
+    {
+	unsigned faces = 0, before = 0, after = 0;
+	for (i=0; i<*count; i++) {
+	    faces += chunks[i]->getFaceCount();
+	    before += count_color_runs(chunks[i]);
+	    after += batch_shell_colors(chunks[i]);
+	}
 
+	if (batch) {
+	    batch[0] = faces;
+	    batch[1] = before;
+	    batch[2] = after;
+	}
+    }
 
+    for (i=0; opts->do_reorder && i<*count; i++)
+    {
+	shell = chunks[i];
+	unsigned tris = shell->getFacetCount();
+	double start = stats_time();
 
-//======================================================================
-// Write STEP Product Structure
-//
+	stats_add("reorder facets", tris);
+	stats_add("reorder cache misses before",
+		  shell_cache_misses(shell, opts->vertex_cache));
 
-static const char * get_product_name(stp_next_assembly_usage_occurrence* nauo)
-{
-    stp_product_definition * pd = stix_get_related_pdef(nauo);
-    stp_product_definition_formation * pdf = pd? pd->formation(): 0;
-    stp_product * prod = pdf? pdf->of_product(): 0;
+	reorder_shell_facets(shell, opts->vertex_cache);
 
-    return prod? prod->name(): 0;
+	stats_add("reorder cache misses after",
+		  shell_cache_misses(shell, opts->vertex_cache));
+	stats_add("reorder seconds", stats_time() - start);
+    }
+
+    return chunks;
 }
 
-int nauo_product_cmp(const void* a, const void* b)
+static void release_shell(stp2webgl_shell ** chunks, unsigned count)
 {
-    const char * name_a = get_product_name(
-	*(stp_next_assembly_usage_occurrence**) a
-	);
-
-    const char * name_b = get_product_name(
-	*(stp_next_assembly_usage_occurrence**) b
-	);
+    unsigned i;
+    for (i=0; i<count; i++)
+	delete chunks[i];
+    delete [] chunks;
+}
 
-    if (name_a == name_b) return 0;
-    if (!name_a) return +1;
-    if (!name_b) return -1;
 
-    return strcmp(name_a, name_b);
+// Binary shells are encoded and written by worker threads while the
+// main thread goes on collecting meshes.  The job only sees a copy of
+// the facets, so the mesh can be released right away.
+//
+struct shell_job {
+    stp2webgl_opts * opts;
+    stp2webgl_shell * shell;
+    RoseStringObject path;
+    RoseStringObject replace;	// move path over this when done
+    unsigned * batch;		// slot for the batching counts, or null
+    std::atomic<unsigned> * failed;	// count of shell files not written
+};
+
+
+// Move a finished file over an older one in one step, so that a
+// reader sees either the old file or the new one.  Returns zero on
+// success.
+//
+static int replace_file(const char * tmp, const char * path)
+{
+#ifdef _WIN32
+    return MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING)? 0: 1;
+#else
+    return rename(tmp, path);
+#endif
 }
 
-static void append_stplink (
-    stp2webgl_opts * opts,
-    RoseXMLWriter * xml,
-    stp_product_definition * pd
+// Finish a shell file after it has been written and closed.  A new
+// file only moves over the older one if it was written completely,
+// otherwise it is removed and the older one stays.  Returns zero on
+// success.
+//
+static int finish_shell_file(
+    int err,
+    const char * path,
+    const char * replace
     )
 {
-    // write reference to a component stepfile.  Only used when
-    // splitting a large assembly into a a collection of part files
-    // and when a file exists for this particular product.
-    // 
-    if (!opts->do_split) return;
+    if (err) {
+	printf ("Could not write shell file %s\n", path);
+	if (replace) remove(path);
+	return 1;
+    }
 
-    RoseStringObject name ("part");
+    if (replace && replace_file(path, replace)) {
+	printf ("Could not replace shell file %s\n", replace);
+	remove(path);
+	return 1;
+    }
+    return 0;
+}
+
+static void write_shell_job (void * ctx)
+{
+    shell_job * job = (shell_job *) ctx;
+    FILE * fd = rose_fopen(job->path, "wb");
+    unsigned count;
 
-    stp_product_definition_formation * pdf = pd-> formation();
-    stp_product * p = pdf? pdf-> of_product(): 0;
+    stp2webgl_shell ** chunks =
+	prepare_shell(job->opts, job->shell, &count, job->batch);
 
-    char * pname = p? p-> name(): 0;
-    if (!pname || !*pname) pname = (char *) "none";
-	
-    if (!name.is_empty()) name += "_";
-    name += pname;
-
-    // change whitespace and other non filesystem safe
-    // characters to underscores
-    //
-    char * c = name;
-    while (*c) { 
-	if (isspace(*c)) *c = '_'; 
-	if (*c == '?')   *c = '_'; 
-	if (*c == '/')   *c = '_'; 
-	if (*c == '\\')  *c = '_'; 
-	if (*c == ':')   *c = '_'; 
-	if (*c == '"')   *c = '_'; 
-	if (*c == '\'')  *c = '_'; 
-	c++; 
+    if (!fd) {
+	printf ("Could not open shell file %s\n", (const char *) job->path);
+	(*job->failed)++;
     }
+    else {
+	int err = write_shell_binary(job->opts, chunks, count, fd);
+	if (fclose(fd)) err = 1;
 
-    if (pd-> design()-> fileExtension()) {
-	name += ".";
-	name += pd-> design()-> fileExtension();
+	if (finish_shell_file(err, job->path, job->replace.is_empty()?
+			      0: (const char *) job->replace))
+	    (*job->failed)++;
     }
 
-    RoseStringObject path = opts->dstdir;
-    path += "/";
-    path += name;
+    release_shell(chunks, count);
+    delete job;
+}
 
-    // expects the component files to be present already.  Do not
-    // generate link if not there.
+
+//======================================================================
+// Detail levels -- level zero is the full detail shell
+//
+
+static double lod_scale(unsigned level)
+{
+    double scale = 1.;
+    while (level--) scale *= LOD_FACTOR;
+    return scale;
+}
+
+// Faceting options for one solid at a detail level.  A tolerance
+// picked for the solid wins over the command line ones.
+static void solid_mesh_options(
+    stp2webgl_opts * opts,
+    const solid_list * solids,
+    unsigned idx,
+    unsigned level,
+    StixMeshOptions * mo
+    )
+{
+    double frac = solids->fracs[idx];
+    if (solids->pass_frac > 0.)
+	frac = solids->pass_frac;
+
+    *mo = opts->mesh;
+    if (frac > 0.)
+	mo->setToleranceFraction(frac * lod_scale(level));
+    else if (!level)
+	return;
+    else if (opts->tolerance > 0.)
+	mo->setToleranceAbsolute(opts->tolerance * lod_scale(level));
+    else
+	mo->setToleranceFraction(opts->tol_fraction * lod_scale(level));
+}
+
+// A fractional tolerance is relative to each curve or surface, none
+// of which is bigger than the whole shell.
+static double lod_error(
+    stp2webgl_opts * opts,
+    const solid_list * solids,
+    const stp2webgl_shell * shell,
+    const StixMeshBoundingBox * bbox,
+    unsigned level
+    )
+{
+    unsigned idx = find_solid(solids, shell->solid);
+    double frac = opts->tol_fraction;
+
+    if (idx != ROSE_NOTFOUND && solids->fracs[idx] > 0.)
+	frac = solids->fracs[idx];
+    else if (opts->tolerance > 0.)
+	return opts->tolerance * lod_scale(level);
+
+    return frac * lod_scale(level) * bbox->diagonal();
+}
+
+
+// Every solid goes to the mesher through here, with the options for
+// that solid.  The options must stay around until the pass is done,
+// so the caller releases the returned array after the last result.
+//
+static StixMeshOptions * start_solid_meshes(
+    stp2webgl_opts * opts,
+    stp2webgl_mesh_pump * pump,
+    const solid_list * solids,
+    unsigned level
+    )
+{
+    unsigned i,sz;
+    StixMeshOptions * mo = new StixMeshOptions[solids->size()+1];
+
+    for (i=0, sz=solids->size(); i<sz; i++)
+    {
+	if (solid_skipped(solids, i)) continue;
+
+	solid_mesh_options(opts, solids, i, level, &mo[i]);
+	pump->add(solids->rep(i), solids->item(i), &mo[i]);
+    }
+    return mo;
+}
+
+
+// Box written in place of a solid that took too long to facet, or
+// null if the solid has no usable bounds.
+//
+static stp2webgl_shell * fallback_shell(stp_representation_item * solid)
+{
+    StixMeshBoundingBox bbox;
+
+    if (!stp2webgl_solid_bbox(solid, &bbox)) {
+	stats_add("timed out solids dropped", 1);
+	return 0;
+    }
+    return stp2webgl_make_box_shell(solid, &bbox);
+}
+
+
+// Write one shell to its own file.  When replacing an older shell
+// file, the new one is written under a temporary name and then moved
+// into place.  Files that could not be written are counted in failed.
+//
+static void write_shell_file(
+    stp2webgl_opts * opts,
+    stp2webgl_workers * workers,
+    stp2webgl_shell * shell,
+    const char * fname,
+    int replace,
+    unsigned * batch,
+    std::atomic<unsigned> * failed
+    )
+{
+    stp2webgl_shell ** chunks;
+    unsigned count;
+
+    RoseStringObject path = opts->dstdir;
+    path.cat("/");
+    path.cat(fname);
+
+    RoseStringObject tmp = path;
+    if (replace) tmp.cat(".tmp");
+
+    if (opts->do_binary)
+    {
+	/* Let a worker thread encode and write the shell as a
+	 * compact binary file. */
+	shell_job * job = new shell_job;
+	job->opts = opts;
+	job->shell = shell;
+	job->path = tmp;
+	if (replace) job->replace = path;
+	job->batch = batch;
+	job->failed = failed;
+
+	workers->submit(write_shell_job, job);
+	return;
+    }
+
+    /* Write the shell in its own XML file */
+    FILE * fd = rose_fopen(tmp, "w");
+    if (!fd) {
+	printf ("Could not open shell file %s\n", (const char *) tmp);
+	(*failed)++;
+	delete shell;
+	return;
+    }
+
+    RoseOutputFile xmlfile (fd, fname);
+    RoseXMLWriter shell_xml(&xmlfile);
+    shell_xml.escape_dots = ROSE_FALSE;
+    shell_xml.writeHeader();
+
+    chunks = prepare_shell(opts, shell, &count, batch);
+    append_shell_facets(&shell_xml, chunks, count,
+			opts->do_meshlets, opts->do_batch);
+
+    shell_xml.close();
+    xmlfile.flush();
+    int err = ferror(fd) | fclose(fd);
+    release_shell(chunks, count);
+
+    if (finish_shell_file(err, tmp, replace? (const char *) path: 0))
+	(*failed)++;
+}
+
+
+static void shell_file_name(
+    stp2webgl_opts * opts,
+    char * fname,
+    const stp2webgl_shell * shell,
+    unsigned level
+    )
+{
+    if (!level)
+	sprintf (fname, "shell_id%lu.%s", shell->solid->entity_id(),
+		 opts->do_binary? "bin": "xml");
+    else
+	sprintf (fname, "shell_id%lu_lod%u.%s", shell->solid->entity_id(),
+		 level, opts->do_binary? "bin": "xml");
+}
+
+
+// Slot for the batching counts of a solid.  Only the full detail
+// shell is counted, the coarser levels are extra copies.
+static unsigned * solid_batch(
+    solid_list * solids,
+    const stp2webgl_shell * shell,
+    unsigned level
+    )
+{
+    unsigned idx = find_solid(solids, shell->solid);
+    if (level || idx == ROSE_NOTFOUND) return 0;
+    return solids->batch._buffer() + 3*idx;
+}
+
+static void export_shell(
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    stp2webgl_workers * workers,
+    solid_list * solids,
+    stp2webgl_shell * shell,
+    unsigned level
+    )
+{
+    stp2webgl_shell ** chunks;
+    unsigned count;
+    unsigned * batch = solid_batch(solids, shell, level);
+
+    if (!opts->do_split) {
+	chunks = prepare_shell(opts, shell, &count, batch);
+	append_shell_facets(xml, chunks, count,
+			    opts->do_meshlets, opts->do_batch);
+	release_shell(chunks, count);
+    }
+    else
+    {
+	StixMeshBoundingBox bbox;
+
+	// compute the bounding box for the shell
+	shell->getBoundingBox(&bbox);
+
+	char fname[100];
+	shell_file_name(opts, fname, shell, level);
+
+	// coarser levels refer back to the full detail shell
+	const char * elem = level? "lod": "shell";
+	xml->beginElement(elem);
+
+	if (!level)
+	    append_refatt(xml, "id", shell->solid);
+	else {
+	    append_refatt(xml, "shell", shell->solid);
+	    xml->beginAttribute("level");
+	    append_integer(xml, level);
+	    xml->endAttribute();
+	}
+
+	xml->beginAttribute("size");
+	append_integer(xml, shell->getFacetCount());
+	xml->endAttribute();
+	
+	append_bbox(xml, &bbox);
+
+	// append the area 
+	if (!level) {
+	    xml->beginAttribute("a");
+	    append_double (xml, shell->area);
+	    xml->endAttribute();    
+	}
+
+	if (opts->lod_levels > 1) {
+	    xml->beginAttribute("error");
+	    append_double (xml, lod_error(opts, solids, shell, &bbox, level));
+	    xml->endAttribute();    
+
+	    // the stats keep the name pointer, so no formatted names
+	    static const char * lod_stats[LOD_MAX_LEVELS] = {
+		"lod0 facets", "lod1 facets", "lod2 facets", "lod3 facets",
+		"lod4 facets", "lod5 facets", "lod6 facets", "lod7 facets"
+	    };
+	    stats_add(lod_stats[level], shell->getFacetCount());
+	}
+
+	if (shell->fallback)
+	    xml->addAttribute("fallback", "bbox");
+
+	if (shell->hidden)
+	    xml->addAttribute("hidden", "1");
+
+	// the file may be replaced with a finer one later on
+	else if (opts->deadline > 0. && !shell->fallback) {
+	    unsigned idx = find_solid(solids, shell->solid);
+	    if (idx == ROSE_NOTFOUND || !solids->tessellated[idx])
+		xml->addAttribute("refine", "1");
+	}
+
+	xml->addAttribute("href", fname);
+	xml->endElement(elem);
+
+	write_shell_file(opts, workers, shell, fname, 0, batch,
+			 &solids->failed);
+    }
+}
+
+
+
+
+//======================================================================
+// Decimation -- reduce shells to the -maxtris and -asmtris budgets
+// before they are written.
+//
+
+static void decimate_to(
+    stp2webgl_opts * opts,
+    stp2webgl_shell * shell,
+    unsigned target
+    )
+{
+    if (opts->max_facets && opts->max_facets < target)
+	target = opts->max_facets;
+
+    if (shell->getFacetCount() <= target)
+	return;
+
+    double start = stats_time();
+    double err;
+
+    stats_add("decimate facets before", shell->getFacetCount());
+    decimate_shell(shell, target, &err);
+    stats_add("decimate facets after", shell->getFacetCount());
+    stats_add("decimate seconds", stats_time() - start);
+    stats_max("decimate max error", err);
+}
+
+struct decimate_batch {
+    stp2webgl_opts * opts;
+    stp2webgl_shell ** shells;
+    unsigned * targets;
+};
+
+static void decimate_batch_fn (void * ctx, unsigned idx)
+{
+    decimate_batch * batch = (decimate_batch *) ctx;
+    decimate_to(batch->opts, batch->shells[idx], batch->targets[idx]);
+}
+
+
+// Write one shell from a faceting pass, or hold it for the assembly
+// budget.  Also notes the size of the solid for later passes.
+//
+static void collect_shell(
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    stp2webgl_workers * workers,
+    solid_list * solids,
+    stp2webgl_shell * shell,
+    unsigned level,
+    rose_vector * held
+    )
+{
+    if (!shell) return;
+
+    unsigned idx = find_solid(solids, shell->solid);
+    if (idx != ROSE_NOTFOUND) {
+	StixMeshBoundingBox bbox;
+	shell->getBoundingBox(&bbox);
+	solids->sizes[idx] = bbox.isEmpty()? 0.: bbox.diagonal();
+
+	if (!level && !bbox.isEmpty() && !solids->boxes[idx])
+	    solids->boxes[idx] = new StixMeshBoundingBox(bbox);
+	if (!level) {
+	    solids->facets[idx] = shell->getFacetCount();
+	    solids->vertices[idx] = shell->getVertexCount();
+	}
+    }
+
+    if (opts->budget && !level)
+	stats_add("budget facets", shell->getFacetCount());
+
+    if (opts->asm_facets) {
+	held->append(shell);
+	return;
+    }
+
+    if (opts->max_facets)
+	decimate_to(opts, shell, opts->max_facets);
+
+    export_shell(opts, xml, workers, solids, shell, level);
+}
+
+
+// Collect the meshes of one faceting pass and write them.  With an
+// assembly budget, all of the shells from the pass are needed to
+// divide it up, so they are held until the pass is done and then
+// decimated in parallel.
+//
+static void export_pass(
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    stp2webgl_mesh_pump * pump,
+    stp2webgl_workers * workers,
+    solid_list * solids,
+    unsigned level
+    )
+{
+    unsigned i,sz;
+    StixMeshStp * mesh;
+    stp_representation_item * lost;
+    rose_vector held;
+
+    // Solids given up in an earlier pass are not tried again, but
+    // the full detail level still needs a box for them.  Hidden ones
+    // already have their coarse shell.  Tessellated ones are copied
+    // from the file.
+    for (i=0, sz=solids->size(); !level && i<sz; i++)
+    {
+	if (solids->hidden_shells[i]) {
+	    collect_shell(opts, xml, workers, solids,
+			  (stp2webgl_shell *) solids->hidden_shells[i],
+			  level, &held);
+	    solids->hidden_shells[i] = 0;
+	}
+	else if (solids->tessellated[i] && !solids->small[i]) {
+	    stp2webgl_shell * shell =
+		stp2webgl_make_tessellated_shell(solids->item(i));
+	    if (shell)
+		stats_add("tessellated facets", shell->getFacetCount());
+	    collect_shell(opts, xml, workers, solids, shell, level, &held);
+	}
+	else if (pump->isAbandoned(solids->item(i)))
+	    collect_shell(opts, xml, workers, solids,
+			  fallback_shell(solids->item(i)), level, &held);
+    }
+
+    StixMeshOptions * mo = start_solid_meshes(opts, pump, solids, level);
+
+    while ((mesh = pump->next(&lost)) != 0 || lost)
+    {
+	stp2webgl_shell * shell;
+	if (mesh) {
+	    shell = stp2webgl_make_shell(mesh);
+	    delete mesh;
+	}
+	else
+	    shell = fallback_shell(lost);
+
+	collect_shell(opts, xml, workers, solids, shell, level, &held);
+    }
+
+    delete [] mo;
+    if (!held.size())
+	return;
+
+    decimate_batch batch;
+    batch.opts = opts;
+    batch.shells = (stp2webgl_shell **) held._buffer();
+    batch.targets = new unsigned[held.size()];
+
+    decimate_budgets(batch.shells, held.size(), opts->asm_facets,
+		     batch.targets);
+
+    stp2webgl_parallel_for(held.size(), decimate_batch_fn, &batch,
+			   opts->threads);
+
+    for (i=0, sz=held.size(); i<sz; i++)
+	export_shell(opts, xml, workers, solids, batch.shells[i], level);
+
+    delete [] batch.targets;
+}
+
+
+
+
+//======================================================================
+// Deadline -- after the coarse pass, facet the solids again at the
+// requested tolerance, largest first, and move each finer shell file
+// over the coarse one.  Only a few solids are given to the mesher at
+// a time, so that nothing new is started after the deadline.  At the
+// deadline we stop waiting, and solids still with the mesher are left
+// behind like timed out ones and stay coarse.
+//
+
+static int solid_size_cmp (const void * a, const void * b)
+{
+    const double * sa = *(const double **) a;
+    const double * sb = *(const double **) b;
+
+    if (*sa != *sb) return (*sa > *sb)? -1: 1;
+    return (sa < sb)? -1: (sa > sb)? 1: 0;
+}
+
+static void refine_shells(
+    stp2webgl_opts * opts,
+    stp2webgl_mesh_pump * pump,
+    stp2webgl_workers * workers,
+    solid_list * solids,
+    double deadline
+    )
+{
+    unsigned i;
+    unsigned count = solids->size();
+    unsigned next = 0;
+    unsigned refined = 0;
+    unsigned eligible = 0;
+    unsigned limit = stp2webgl_thread_count(0);
+    StixMeshStp * mesh;
+    stp_representation_item * lost;
+
+    // largest first, by way of pointers into the size table
+    const double ** order = new const double * [count+1];
+    for (i=0; i<count; i++)
+	order[i] = solids->sizes._buffer() + i;
+    qsort (order, count, sizeof(const double *), solid_size_cmp);
+
+    // solids that were timed out in the coarse pass have no shell
+    for (i=0; i<count; i++) {
+	if (solid_skipped(solids, i)) continue;
+	if (pump->isAbandoned(solids->item(i))) continue;
+	eligible++;
+    }
+
+    StixMeshOptions * mo = new StixMeshOptions[count+1];
+
+    while (next < count || pump->pending())
+    {
+	while (next < count && pump->pending() < limit &&
+	       stats_time() < deadline)
+	{
+	    unsigned idx = order[next++] - solids->sizes._buffer();
+	    if (solid_skipped(solids, idx)) continue;
+
+	    solid_mesh_options(opts, solids, idx, 0, &mo[idx]);
+	    pump->add(solids->rep(idx), solids->item(idx), &mo[idx]);
+	}
+
+	// a solid that times out keeps its coarse shell
+	mesh = pump->next(&lost, deadline);
+	if (lost) continue;
+	if (!mesh) break;
+
+	stp2webgl_shell * shell = stp2webgl_make_shell(mesh);
+	delete mesh;
+
+	if (opts->max_facets)
+	    decimate_to(opts, shell, opts->max_facets);
+
+	char fname[100];
+	shell_file_name(opts, fname, shell, 0);
+	write_shell_file(opts, workers, shell, fname, 1,
+			 solid_batch(solids, shell, 0), &solids->failed);
+	refined++;
+    }
+
+    // past the deadline, do not wait on the rest
+    if (pump->pending())
+	pump->abandonAll();
+
+    stats_add("deadline refined shells", refined);
+    stats_add("deadline coarse shells", eligible - refined);
+
+    // the mesher may still be using options for abandoned solids
+    delete [] order;
+    if (!pump->abandonedCount())
+	delete [] mo;
+}
+
+
+
+
+//======================================================================
+// Triangle budget -- facet everything twice at coarse tolerances to
+// see how each solid responds, then pick a tolerance for each one.
+//
+
+static void measure_pass(
+    stp2webgl_opts * opts,
+    stp2webgl_mesh_pump * pump,
+    const solid_list * solids,
+    double frac,
+    double * counts,
+    double * sizes
+    )
+{
+    unsigned i,sz;
+    StixMeshStp * mesh;
+    stp_representation_item * lost;
+    StixMeshOptions mo = opts->mesh;
+
+    mo.setToleranceFraction(frac);
+
+    for (i=0, sz=solids->size(); i<sz; i++) {
+	counts[i] = 0.;
+	if (sizes) sizes[i] = 0.;
+	if (!solid_skipped(solids, i))
+	    pump->add(solids->rep(i), solids->item(i), &mo);
+    }
+
+    // solids that time out count as empty
+    while ((mesh = pump->next(&lost)) != 0 || lost)
+    {
+	if (!mesh) continue;
+
+	unsigned idx = find_solid(solids, mesh->getStepSolid());
+	const StixMeshFacetSet * fs = mesh->getFacetSet();
+
+	if (idx != ROSE_NOTFOUND)
+	{
+	    counts[idx] = fs->getFacetCount();
+
+	    if (sizes)
+	    {
+		// sizes in meters, so solids in different units compare
+		StixMeshBoundingBox bbox;
+		for (i=0, sz=fs->getVertexCount(); i<sz; i++)
+		    bbox.update(fs->getVertex(i));
+
+		double scale = 1.;
+		StixUnit unit = stix_get_context_length_unit(solids->rep(idx));
+		if (unit != stixunit_unknown)
+		    scale = stix_get_converted_measure(1., unit, stixunit_m);
+
+		sizes[idx] = bbox.isEmpty()? 0.: bbox.diagonal() * scale;
+	    }
+	}
+	delete mesh;
+    }
+}
+
+static void plan_budget(
+    stp2webgl_opts * opts,
+    stp2webgl_mesh_pump * pump,
+    solid_list * solids
+    )
+{
+    unsigned i,sz;
+    unsigned count = solids->size();
+    double * coarse = new double[count+1];
+    double * fine = new double[count+1];
+    double * sizes = new double[count+1];
+    double * fracs = new double[count+1];
+    double start = stats_time();
+
+    measure_pass(opts, pump, solids, BUDGET_COARSE_FRACTION, coarse, sizes);
+    measure_pass(opts, pump, solids, BUDGET_FINE_FRACTION, fine, 0);
+
+    double est = budget_fractions(
+	count, coarse, fine, sizes,
+	BUDGET_COARSE_FRACTION, BUDGET_FINE_FRACTION,
+	opts->budget, fracs
+	);
+
+    for (i=0, sz=count; i<sz; i++)
+	solids->fracs[i] = fracs[i];
+
+    stats_add("budget target", opts->budget);
+    stats_add("budget estimate", est);
+    stats_add("budget planning seconds", stats_time() - start);
+
+    delete [] coarse;
+    delete [] fine;
+    delete [] sizes;
+    delete [] fracs;
+}
+
+
+
+
+//======================================================================
+// Small parts -- measure every placement of each solid from its
+// boundary, before anything is faceted, and compare it to the size
+// of the whole assembly.  A solid is only as small as its largest
+// placement.
+//
+
+static void xform_bbox(
+    StixMeshBoundingBox * out,
+    const StixMtrx &xform,
+    const StixMeshBoundingBox * in
+    )
+{
+    unsigned c;
+    for (c=0; c<8; c++)
+    {
+	double pt[3], xpt[3];
+	pt[0] = (c & 1)? in->maxx: in->minx;
+	pt[1] = (c & 2)? in->maxy: in->miny;
+	pt[2] = (c & 4)? in->maxz: in->minz;
+
+	stixmesh_transform(xpt, xform, pt);
+	out->update(xpt);
+    }
+}
+
+static void find_small_solids(
+    stp2webgl_opts * opts,
+    solid_list * solids
+    )
+{
+    unsigned i,sz;
+    unsigned count = solids->size();
+    unsigned skipped = 0;
+    unsigned coarse = 0;
+    double start = stats_time();
+
+    StixMeshBoundingBox * local = new StixMeshBoundingBox[count+1];
+    double * sizes = new double[count+1];
+    StixMeshBoundingBox world;
+
+    for (i=0; i<count; i++) {
+	stp2webgl_solid_bbox(solids->item(i), &local[i]);
+	sizes[i] = 0.;
+    }
+
+    find_all_occurrences(opts, solids);
+    for (i=0, sz=solids->occ_solids.size(); i<sz; i++)
+    {
+	unsigned idx = solids->occ_solids[i];
+	StixMeshBoundingBox placed;
+	if (local[idx].isEmpty()) continue;
+
+	xform_bbox(&placed, solids->occ_xform(i), &local[idx]);
+	double lo[3] = { placed.minx, placed.miny, placed.minz };
+	double hi[3] = { placed.maxx, placed.maxy, placed.maxz };
+	world.update(lo);
+	world.update(hi);
+
+	if (placed.diagonal() > sizes[idx])
+	    sizes[idx] = placed.diagonal();
+    }
+
+    // Solids that could not be measured or placed are left alone
+    double smallest = world.isEmpty()? 0.: world.diagonal() * opts->min_part;
+    for (i=0; i<count; i++)
+    {
+	if (sizes[i] <= 0.) continue;
+
+	if (sizes[i] < smallest) {
+	    solids->small[i] = 1;
+	    skipped++;
+	}
+	else if (sizes[i] < smallest * SMALL_PART_COARSEN &&
+		 solids->fracs[i] <= 0.) {
+	    solids->fracs[i] = SMALL_PART_FRACTION;
+	    coarse++;
+	}
+    }
+
+    stats_add("small solids skipped", skipped);
+    stats_add("small solids coarsened", coarse);
+    stats_add("small part seconds", stats_time() - start);
+
+    delete [] local;
+    delete [] sizes;
+}
+
+
+
+
+//======================================================================
+// Hidden solids -- facet everything coarsely, place the shells in the
+// assembly and cast rays at them from all around.  Solids that no
+// ray reaches keep their coarse shells and are not faceted again.
+//
+
+static void cull_hidden(
+    stp2webgl_opts * opts,
+    stp2webgl_mesh_pump * pump,
+    solid_list * solids
+    )
+{
+    unsigned i,j,k,sz;
+    unsigned count = solids->size();
+    StixMeshStp * mesh;
+    stp_representation_item * lost;
+    StixMeshOptions mo = opts->mesh;
+    double start = stats_time();
+
+    stp2webgl_shell ** shells = new stp2webgl_shell * [count+1];
+    for (i=0; i<count; i++) shells[i] = 0;
+
+    // tessellated solids take part with the triangles from the file
+    mo.setToleranceFraction(CULL_COARSE_FRACTION);
+    for (i=0; i<count; i++) {
+	if (solids->tessellated[i] && !solids->small[i])
+	    shells[i] = stp2webgl_make_tessellated_shell(solids->item(i));
+	else if (!solid_skipped(solids, i))
+	    pump->add(solids->rep(i), solids->item(i), &mo);
+    }
+
+    // A box from a solid that timed out is bigger than the solid, so
+    // it can not be used to hide anything.  Those stay visible.
+    while ((mesh = pump->next(&lost)) != 0 || lost)
+    {
+	if (!mesh) continue;
+
+	unsigned idx = find_solid(solids, mesh->getStepSolid());
+	if (idx != ROSE_NOTFOUND && !shells[idx])
+	    shells[idx] = stp2webgl_make_shell(mesh);
+	delete mesh;
+    }
+
+    find_all_occurrences(opts, solids);
+
+    // every placed facet in model space, tagged with its solid
+    unsigned long total = 0;
+    for (i=0, sz=solids->occ_solids.size(); i<sz; i++) {
+	stp2webgl_shell * shell = shells[solids->occ_solids[i]];
+	if (shell) total += shell->getFacetCount();
+    }
+
+    float * tris = new float[9*total+1];
+    unsigned * ids = new unsigned[total+1];
+    unsigned char * visible = new unsigned char[count+1];
+    unsigned char * placed = new unsigned char[count+1];
+    StixMeshBoundingBox bbox;
+    unsigned long t = 0;
+
+    memset(visible, 0, count);
+    memset(placed, 0, count);
+
+    for (i=0, sz=solids->occ_solids.size(); i<sz; i++)
+    {
+	unsigned idx = solids->occ_solids[i];
+	stp2webgl_shell * shell = shells[idx];
+	const StixMtrx * xform = &solids->occ_xform(i);
+	if (!shell) continue;
+
+	placed[idx] = 1;
+	for (j=0; j<shell->getFacetCount(); j++, t++)
+	{
+	    const unsigned * f = shell->getFacet(j);
+	    for (k=0; k<3; k++)
+	    {
+		double pt[3];
+		stixmesh_transform(pt, *xform, shell->getVertex(f[k]));
+		bbox.update(pt);
+
+		tris[9*t+3*k] = (float) pt[0];
+		tris[9*t+3*k+1] = (float) pt[1];
+		tris[9*t+3*k+2] = (float) pt[2];
+	    }
+	    ids[t] = idx;
+	}
+    }
+
+    stp2webgl_bvh bvh;
+    bvh.build(tris, ids, (unsigned) total, opts->threads);
+
+    find_visible_ids(&bvh, &bbox, CULL_DIRECTIONS, CULL_GRID,
+		     count, visible, opts->threads);
+
+    // Solids with no shell or no placement were never in the scene,
+    // so there is nothing to say about them.
+    unsigned hidden = 0;
+    for (i=0; i<count; i++)
+    {
+	if (shells[i] && placed[i] && !visible[i]) {
+	    shells[i]->hidden = 1;
+	    solids->hidden[i] = 1;
+	    solids->hidden_shells[i] = shells[i];
+	    hidden++;
+	}
+	else
+	    delete shells[i];
+    }
+
+    stats_add("cull hidden solids", hidden);
+    stats_add("cull visible solids", count - hidden);
+    stats_add("cull facets", (double) total);
+    stats_add("cull rays", (double) CULL_DIRECTIONS * CULL_GRID * CULL_GRID);
+    stats_add("cull seconds", stats_time() - start);
+
+    delete [] shells;
+    delete [] visible;
+    delete [] placed;
+}
+
+
+
+//======================================================================
+// Spatial tiles -- every placement of a written shell, with its box
+// in model space, sorted into an octree by write_tileset().
+//
+
+static int write_tiles(
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    solid_list * solids
+    )
+{
+    unsigned i,j,k,sz;
+    int ret;
+    rose_uint_vector placements;
+
+    find_all_occurrences(opts, solids);
+    for (i=0, sz=solids->occ_solids.size(); i<sz; i++) {
+	if (solids->boxes[solids->occ_solids[i]])
+	    placements.append(i);
+    }
+
+    stp2webgl_tile_item * items =
+	new stp2webgl_tile_item[placements.size()+1];
+
+    for (i=0, sz=placements.size(); i<sz; i++)
+    {
+	unsigned idx = solids->occ_solids[placements[i]];
+	const StixMtrx * xform = &solids->occ_xform(placements[i]);
+	StixMeshBoundingBox placed;
+
+	xform_bbox(&placed, *xform,
+		   (StixMeshBoundingBox *) solids->boxes[idx]);
+
+	stp2webgl_tile_item * it = items + i;
+	it->lo[0] = placed.minx;  it->hi[0] = placed.maxx;
+	it->lo[1] = placed.miny;  it->hi[1] = placed.maxy;
+	it->lo[2] = placed.minz;  it->hi[2] = placed.maxz;
+	it->shell_id = solids->item(idx)->entity_id();
+	it->hidden = solids->hidden[idx]? 1: 0;
+
+	for (j=0; j<4; j++)
+	    for (k=0; k<4; k++)
+		it->xform[4*j+k] = xform->get(k,j);
+    }
+
+    // leave out a tileset that is missing files
+    ret = write_tileset(opts, items, placements.size());
+    if (!ret) {
+	xml->beginElement("tileset");
+	xml->addAttribute("href", "tileset.json");
+	xml->endElement("tileset");
+    }
+    delete [] items;
+    return ret;
+}
+
+
+
+//======================================================================
+// Bounds -- the product and shape elements are written before any
+// solid is faceted, so once the shells are done, a bounds element is
+// written for each with the box, sphere, and facet and vertex totals
+// of everything under it.  Shapes are measured in their own
+// coordinates, with each child shape placed by its transform, so the
+// root products are in world coordinates and a client can cull or
+// budget any subtree by placing its box.  Totals count every
+// placement of a solid.
+//
+
+struct bounds_pass {
+    solid_list * solids;
+    solid_key * keys;		// shapes by address
+    StixMeshBoundingBox * boxes;
+    double * facets;
+    double * vertices;
+    unsigned char * state;	// zero to start, one while busy, two done
+};
+
+static void add_child_bounds(
+    bounds_pass * bp,
+    unsigned sidx,
+    stp_representation * child,
+    const StixMtrx &xform
+    );
+
+static unsigned measure_shape(bounds_pass * bp, stp_representation * rep)
+{
+    unsigned i,sz;
+    solid_list * solids = bp->solids;
+
+    if (!rep) return ROSE_NOTFOUND;
+    unsigned sidx = find_key(bp->keys, solids->shapes.size(), rep);
+    if (sidx == ROSE_NOTFOUND || bp->state[sidx] == 2)
+	return sidx;
+
+    // a cycle in the shape tree, should never happen
+    if (bp->state[sidx] == 1)
+	return ROSE_NOTFOUND;
+
+    bp->state[sidx] = 1;
+
+    StixMeshBoundingBox box;
+    double facets = 0.;
+    double vertices = 0.;
+
+    SetOfstp_representation_item * items = rep->items();
+    for (i=0, sz=items->size(); i<sz; i++)
+    {
+	unsigned idx = find_solid(solids, items->get(i));
+	if (idx == ROSE_NOTFOUND) continue;
+
+	StixMeshBoundingBox * sb = (StixMeshBoundingBox *) solids->boxes[idx];
+	if (sb) {
+	    double lo[3] = { sb->minx, sb->miny, sb->minz };
+	    double hi[3] = { sb->maxx, sb->maxy, sb->maxz };
+	    box.update(lo);
+	    box.update(hi);
+	}
+	facets += solids->facets[idx];
+	vertices += solids->vertices[idx];
+    }
+
+    bp->boxes[sidx] = box;
+    bp->facets[sidx] = facets;
+    bp->vertices[sidx] = vertices;
+
+    const rose_vector * ext = stp2webgl_external_shapes(rep);
+    for (i=0, sz=ext? ext->size(): 0; i<sz; i++)
+	add_child_bounds(bp, sidx, (stp_representation *) (*ext)[i],
+			 StixMtrx());
+
+    StixMgrAsmShapeRep * mgr = StixMgrAsmShapeRep::find(rep);
+    if (mgr)
+    {
+	for (i=0, sz=mgr->child_rels.size(); i<sz; i++) {
+	    stp_shape_representation_relationship * rel = mgr->child_rels[i];
+	    add_child_bounds(bp, sidx, stix_get_shape_usage_child_rep (rel),
+			     stix_get_shape_usage_xform (rel));
+	}
+
+	for (i=0, sz=mgr->child_mapped_items.size(); i<sz; i++) {
+	    stp_mapped_item * rel = mgr->child_mapped_items[i];
+	    add_child_bounds(bp, sidx, stix_get_shape_usage_child_rep (rel),
+			     stix_get_shape_usage_xform (rel));
+	}
+    }
+
+    bp->state[sidx] = 2;
+    return sidx;
+}
+
+static void add_child_bounds(
+    bounds_pass * bp,
+    unsigned sidx,
+    stp_representation * child,
+    const StixMtrx &xform
+    )
+{
+    unsigned cidx = measure_shape(bp, child);
+    if (cidx == ROSE_NOTFOUND) return;
+
+    if (!bp->boxes[cidx].isEmpty())
+	xform_bbox(&bp->boxes[sidx], xform, &bp->boxes[cidx]);
+    bp->facets[sidx] += bp->facets[cidx];
+    bp->vertices[sidx] += bp->vertices[cidx];
+}
+
+static void append_bounds_element(
+    RoseXMLWriter * xml,
+    RoseObject * obj,
+    const StixMeshBoundingBox * box,
+    double facets,
+    double vertices
+    )
+{
+    char buff[40];
+
+    xml->beginElement("bounds");
+    append_refatt (xml, "ref", obj);
+
+    if (!box->isEmpty())
+    {
+	xml->beginAttribute("bbox");
+	append_double(xml, box->minx);  xml->text(" ");
+	append_double(xml, box->miny);  xml->text(" ");
+	append_double(xml, box->minz);  xml->text(" ");
+	append_double(xml, box->maxx);  xml->text(" ");
+	append_double(xml, box->maxy);  xml->text(" ");
+	append_double(xml, box->maxz);
+	xml->endAttribute();
+
+	xml->beginAttribute("sphere");
+	append_double(xml, (box->minx + box->maxx) / 2.);  xml->text(" ");
+	append_double(xml, (box->miny + box->maxy) / 2.);  xml->text(" ");
+	append_double(xml, (box->minz + box->maxz) / 2.);  xml->text(" ");
+	append_double(xml, box->diagonal() / 2.);
+	xml->endAttribute();
+    }
+
+    sprintf (buff, "%.0f", facets);
+    xml->addAttribute("facets", buff);
+    sprintf (buff, "%.0f", vertices);
+    xml->addAttribute("vertices", buff);
+    xml->endElement("bounds");
+}
+
+static void append_bounds(
+    RoseXMLWriter * xml,
+    solid_list * solids
+    )
+{
+    unsigned i,j,sz,szz;
+    unsigned count = solids->shapes.size();
+    bounds_pass bp;
+
+    bp.solids = solids;
+    bp.keys = sort_keys(solids->shapes);
+    bp.boxes = new StixMeshBoundingBox[count+1];
+    bp.facets = new double[count+1];
+    bp.vertices = new double[count+1];
+    bp.state = new unsigned char[count+1];
+    memset (bp.state, 0, count+1);
+
+    for (i=0, sz=solids->products.size(); i<sz; i++)
+    {
+	stp_product_definition * pd =
+	    (stp_product_definition *) solids->products[i];
+	StixMgrAsmProduct * mgr = StixMgrAsmProduct::find(pd);
+
+	StixMeshBoundingBox box;
+	double facets = 0.;
+	double vertices = 0.;
+
+	for (j=0, szz=mgr? mgr->shapes.size(): 0; j<szz; j++)
+	{
+	    unsigned sidx = measure_shape(&bp, mgr->shapes[j]);
+	    if (sidx == ROSE_NOTFOUND) continue;
+
+	    if (!bp.boxes[sidx].isEmpty()) {
+		double lo[3] = { bp.boxes[sidx].minx, bp.boxes[sidx].miny,
+				 bp.boxes[sidx].minz };
+		double hi[3] = { bp.boxes[sidx].maxx, bp.boxes[sidx].maxy,
+				 bp.boxes[sidx].maxz };
+		box.update(lo);
+		box.update(hi);
+	    }
+	    facets += bp.facets[sidx];
+	    vertices += bp.vertices[sidx];
+	}
+	append_bounds_element(xml, pd, &box, facets, vertices);
+    }
+
+    for (i=0; i<count; i++)
+    {
+	unsigned sidx = measure_shape(
+	    &bp, (stp_representation *) solids->shapes[i]
+	    );
+	if (sidx == ROSE_NOTFOUND) continue;
+
+	append_bounds_element(xml, (RoseObject *) solids->shapes[i],
+			      &bp.boxes[sidx], bp.facets[sidx],
+			      bp.vertices[sidx]);
+    }
+
+    delete [] bp.keys;
+    delete [] bp.boxes;
+    delete [] bp.facets;
+    delete [] bp.vertices;
+    delete [] bp.state;
+}
+
+
+
+
+//======================================================================
+// Write STEP Product Structure
+//
+
+static const char * get_product_name(stp_next_assembly_usage_occurrence* nauo)
+{
+    stp_product_definition * pd = stix_get_related_pdef(nauo);
+    stp_product_definition_formation * pdf = pd? pd->formation(): 0;
+    stp_product * prod = pdf? pdf->of_product(): 0;
+
+    return prod? prod->name(): 0;
+}
+
+int nauo_product_cmp(const void* a, const void* b)
+{
+    const char * name_a = get_product_name(
+	*(stp_next_assembly_usage_occurrence**) a
+	);
+
+    const char * name_b = get_product_name(
+	*(stp_next_assembly_usage_occurrence**) b
+	);
+
+    if (name_a == name_b) return 0;
+    if (!name_a) return +1;
+    if (!name_b) return -1;
+
+    return strcmp(name_a, name_b);
+}
+
+static void append_stplink (
+    stp2webgl_opts * opts,
+    RoseXMLWriter * xml,
+    stp_product_definition * pd
+    )
+{
+    // write reference to a component stepfile.  Only used when
+    // splitting a large assembly into a a collection of part files
+    // and when a file exists for this particular product.
+    // 
+    if (!opts->do_split) return;
+
+    RoseStringObject name;
+    stp2webgl_part_name (&name, pd);
+
+    if (pd-> design()-> fileExtension()) {
+	name += ".";
+	name += pd-> design()-> fileExtension();
+    }
+
+    RoseStringObject path = opts->dstdir;
+    path += "/";
+    path += name;
+
+    // expects the component files to be present already.  Do not
+    // generate link if not there.
     if (rose_file_exists(path)) {
 	xml->addAttribute("step", name);
     }
@@ -913,6 +2602,7 @@ static void append_stplink (
 static void export_product(
     stp2webgl_opts * opts,
     RoseXMLWriter * xml,
+    solid_list * solids,
     stp_product_definition * pd
     )
 {
@@ -920,6 +2610,7 @@ static void export_product(
 
     if (!pd || rose_is_marked(pd)) return;
     rose_mark_set(pd);
+    solids->products.append(pd);
     
     StixMgrAsmProduct * mgr = StixMgrAsmProduct::find(pd);    
     
@@ -965,7 +2656,7 @@ static void export_product(
     for (i=0, sz=mgr->child_nauos.size(); i<sz; i++)
     {
 	stp_next_assembly_usage_occurrence * nauo = mgr->child_nauos[i];
-	export_product(opts, xml, stix_get_related_pdef(nauo));
+	export_product(opts, xml, solids, stix_get_related_pdef(nauo));
     }
 }
 
@@ -978,7 +2669,68 @@ int write_webxml (stp2webgl_opts * opts)
     FILE * xmlout = 0;
     RoseStringObject index_file;
     unsigned i,sz;
+    double start = stats_time();
+    int index_done = 0;
+    int ret = 0;
     
+    if (opts->do_binary && !opts->do_split)
+    {
+	printf ("Binary shells (-bin) require multiple file output (-d)\n");
+	return 2;
+    }
+
+    if (opts->do_compress && !opts->do_binary)
+    {
+	printf ("Compression (-compress) requires binary shells (-bin)\n");
+	return 2;
+    }
+
+    if (opts->do_bvh && !opts->do_binary)
+    {
+	printf ("Picking trees (-bvh) require binary shells (-bin)\n");
+	return 2;
+    }
+
+    if (opts->lod_levels > 1 && !opts->do_split)
+    {
+	printf ("Detail levels (-lod) require multiple file output (-d)\n");
+	return 2;
+    }
+
+    if (opts->deadline > 0. && (!opts->do_split || opts->lod_levels > 1))
+    {
+	printf ("Deadline (-deadline) requires -d and no detail levels\n");
+	return 2;
+    }
+
+    // refined shells arrive one at a time, so there is nothing to
+    // share an assembly budget across
+    if (opts->deadline > 0. && opts->asm_facets)
+    {
+	printf ("Deadline (-deadline) can not be used with -asmtris\n");
+	return 2;
+    }
+
+    if (opts->tile_items && !opts->do_split)
+    {
+	printf ("Spatial tiles (-tiles) require multiple file output (-d)\n");
+	return 2;
+    }
+
+    if (opts->lod_levels > LOD_MAX_LEVELS)
+    {
+	printf ("At most %d detail levels (-lod) are supported\n",
+		LOD_MAX_LEVELS);
+	return 2;
+    }
+
+    if (opts->lod_levels > 1 && opts->tolerance <= 0. &&
+	opts->tol_fraction <= 0.)
+    {
+	opts->tol_fraction = LOD_DEFAULT_FRACTION;
+	opts->mesh.setToleranceFraction(opts->tol_fraction);
+    }
+
     if (opts->do_split)
     {
 	opts->dstdir = opts->dstfile;
@@ -1028,16 +2780,19 @@ int write_webxml (stp2webgl_opts * opts)
     }
     xml.endAttribute();
 
+    solid_list solids;
+
     rose_mark_begin();
     for (i=0, sz=opts->root_prods.size(); i<sz; i++)
     {
-	export_product(opts, &xml, opts->root_prods[i]);
+	export_product(opts, &xml, &solids, opts->root_prods[i]);
     }
 
-    // Schedule each solid for faceting, which will happen in child
-    // threads and then write each shell as it becomes available.
-    StixMeshStpAsyncMaker mesher;
-    StixMeshStp * mesh;
+    // Collect the solids, then schedule each one for faceting, which
+    // will happen in child threads, and write each shell as it
+    // becomes available.
+    StixMeshStpAsyncMaker * mesher = new StixMeshStpAsyncMaker;
+    stp2webgl_mesh_pump pump(mesher, opts->solid_timeout);
 
     for (i=0, sz=opts->root_prods.size(); i<sz; i++)
     {
@@ -1047,21 +2802,120 @@ int write_webxml (stp2webgl_opts * opts)
 	    );
 	
 	for (j=0, szz=mgr->shapes.size(); j<szz; j++) {
-	    queue_shapes (opts, &xml, &mesher, mgr->shapes[j]);
+	    queue_shapes (opts, &xml, &solids, mgr->shapes[j]);
 	}
     }
 
-    while ((mesh = mesher.getResult(1)) != 0)
+    index_solids(&solids);
+
+    stp2webgl_workers * workers = 0;
+    if (opts->do_binary)
+	workers = new stp2webgl_workers(opts->threads);
+
+    if (opts->min_part > 0.)
+	find_small_solids(opts, &solids);
+
+    if (opts->do_cull)
+	cull_hidden(opts, &pump, &solids);
+
+    if (opts->deadline > 0.)
     {
-	export_shell(opts, &xml, mesh);
-	delete mesh;
+	// Coarse pass and finish the index, so the output is complete
+	// and usable before anything is refined.  The coarse files
+	// must all be written before finer ones can replace them.
+	solids.pass_frac = DEADLINE_COARSE_FRACTION;
+	export_pass(opts, &xml, &pump, workers, &solids, 0);
+	solids.pass_frac = 0.;
+
+	if (workers) workers->wait();
+
+	if (opts->tile_items && write_tiles(opts, &xml, &solids))
+	    ret = 2;
+	append_bounds(&xml, &solids);
+
+	xml.endElement("step-assembly");
+	xml.close();
+	xmlfile.flush();
+	index_done = 1;
+
+	stats_add("deadline coarse seconds", stats_time() - start);
+
+	if (opts->budget)
+	    plan_budget(opts, &pump, &solids);
+
+	refine_shells(opts, &pump, workers, &solids, start + opts->deadline);
+    }
+    else
+    {
+	if (opts->budget)
+	    plan_budget(opts, &pump, &solids);
+
+	// Full detail first, then everything again for each coarser
+	// level.  Done one level at a time so that only one set of
+	// meshes is in memory.
+	for (unsigned level=0; level<opts->lod_levels; level++)
+	    export_pass(opts, &xml, &pump, workers, &solids, level);
+
+	if (opts->tile_items && write_tiles(opts, &xml, &solids))
+	    ret = 2;
+	append_bounds(&xml, &solids);
     }
 
-    xml.endElement("step-assembly");
-    xml.close();
-    xmlfile.flush();
+    // finish any shells still being written
+    delete workers;
+
+    if (solids.failed) {
+	stats_add("shell write failures", solids.failed);
+	ret = 2;
+    }
+
+    if (opts->do_batch)
+    {
+	unsigned faces = 0, before = 0, after = 0;
+	for (i=0, sz=solids.size(); i<sz; i++) {
+	    faces += solids.batch[3*i];
+	    before += solids.batch[3*i+1];
+	    after += solids.batch[3*i+2];
+	}
+	stats_add("batch faces", faces);
+	stats_add("batch groups before", before);
+	stats_add("batch groups after", after);
+    }
+
+    pump.release();
+
+    if (opts->do_stats && stats_get("encode output bytes") > 0.)
+    {
+	double in = stats_get("encode input bytes");
+	double out = stats_get("encode output bytes");
+	double secs = stats_get("encode seconds");
+
+	stats_add("encode ratio", in / out);
+	if (secs > 0.)
+	    stats_add("encode MB/s per thread", in / secs / 1e6);
+    }
+
+    if (opts->do_stats && stats_get("decimate seconds") > 0.)
+    {
+	stats_add("decimate facets/s per thread",
+		  stats_get("decimate facets before") /
+		  stats_get("decimate seconds"));
+    }
+
+    if (opts->do_stats && stats_get("reorder facets") > 0.)
+    {
+	double tris = stats_get("reorder facets");
+	stats_add("ACMR before", stats_get("reorder cache misses before") / tris);
+	stats_add("ACMR after", stats_get("reorder cache misses after") / tris);
+    }
+
+    if (!index_done) {
+	xml.endElement("step-assembly");
+	xml.close();
+	xmlfile.flush();
+    }
     rose_mark_end();
 
-    return 0;
+    return ret;
 }
 